@@ -4,33 +4,196 @@ declare module 'video-module' {
   export interface Frame {
     width: (number) => number;
     height: (number) => number;
-    // Buffers are valid only as long as Frame is alive. In addition there
-    // seems to be bug in V8 (?) that sometimes causes crashing if this is
-    // called multiple times, so beware!
+    // Buffers point directly to the frame data without copying. Each Buffer
+    // keeps its plane alive on its own, so it stays valid after Frame has
+    // been collected. Repeated calls return the same Buffers.
     getTextures: () => [Buffer];
     frameNumber: () => number;
     planes: () => number;
+    /**
+     * Encodes the frame in the background, resolves to the image. Only
+     * frames decoded by FFmpeg can be encoded.
+     */
+    encode: (options?: ImageOptions) => Promise<Buffer>;
   }
 
   export interface VideoMode {
     width: number;
     height: number;
     fps: number;
+    /**
+     * Frames that can wait for delivery to frame callbacks (default 4). When
+     * the queue is full new frames are dropped and counted in `queueDropped`.
+     * Changed only when no frames are in flight.
+     */
+    frameQueueDepth?: number;
+    /** Recycled frame shells kept by the stream for reuse (default 8) */
+    framePoolSize?: number;
+    /** Decoder threads (default 4), `auto` picks based on the core count */
+    threads?: number | 'auto';
+    /** Decoder threading method, FFmpeg picks by default */
+    threadType?: 'frame' | 'slice';
+    /** Converts frames before delivery, `format()` reports the new format */
+    output?: FrameConversion;
+    /**
+     * Milliseconds without a frame before `input-stalled` is emitted
+     * (default 500, 0 disables). Stalls are counted, the stream keeps going.
+     */
+    stallTimeout?: number;
+    /** Milliseconds without a frame before `fatal-error` (default 10000, 0 waits forever) */
+    inputTimeout?: number;
+    /**
+     * Packets read ahead of the decoder (default 4). When decoding falls
+     * behind live input, the oldest are dropped.
+     */
+    packetQueueDepth?: number;
+  }
+
+  export interface FrameConversion {
+    /** FFmpeg pixel format name (`nv12`, `rgba`...), defaults to the one of the input */
+    pixelFormat?: string;
+    /** Output size, aspect ratio is kept if only one is given */
+    width?: number;
+    height?: number;
+    /** Scaling algorithm (default bilinear) */
+    scaling?: 'fast-bilinear' | 'bilinear' | 'bicubic' | 'point' | 'area' | 'lanczos';
+    /**
+     * Threads converting bands of the frame, 0 (default) uses all cores.
+     * Frames that are scaled vertically are converted by a single thread.
+     */
+    threads?: number;
   }
 
   export type FrameHandler = (frame: Frame) => void;
 
+  export interface FrameCallbackOptions {
+    /**
+     * `queue` (default) delivers every frame that fits into the frame queue.
+     * `latest` keeps at most one frame waiting for the callback, older
+     * pending frames are replaced and counted in `skippedFrames`.
+     */
+    mode?: 'queue' | 'latest';
+    /** Name of the tap (see `Stream.addTap`) whose frames are delivered */
+    tap?: string;
+  }
+
+  /**
+   * Tap is converted from the frames the stream delivers, so it can only
+   * make them smaller or change their format, not improve them.
+   */
+  export interface TapOptions extends FrameConversion {
+    /** Only every n:th frame of the stream is tapped, defaults to 1 */
+    every?: number;
+    /** Converted frames that can wait for the callbacks of the tap */
+    queueDepth?: number;
+  }
+
   export type PixelFormat = 'uyvu422' | 'yuvj422p';
 
   export type LogLevel = 0 | 1 | 2 | 3 | 4;
 
   export interface Stats {
-    decode: number;
-    passing: number;
-    nodeDelay: number;
-    render: number;
-    total: number;
-    frameNumber: number;
+    /** Timings are present once a frame has been traced from decode to render */
+    decode?: number;
+    passing?: number;
+    nodeDelay?: number;
+    render?: number;
+    total?: number;
+    frameNumber?: number;
+    queueDepth: number;
+    /** Frames dropped because the callback queue was full */
+    queueDropped: number;
+    /** Frames replaced by a newer one before a `latest` callback was run */
+    skippedFrames: number;
+    /** Frame pool counters, only for FFmpeg streams */
+    poolHits?: number;
+    poolMisses?: number;
+    poolAvailable?: number;
+    /** Decoded frames the callbacks missed because they couldn't be referenced, only for FFmpeg streams */
+    framesDropped?: number;
+    /** Input stalls since start and whether the input is stalled now, only for FFmpeg streams */
+    inputStalls?: number;
+    inputStalled?: boolean;
+    /** Packets waiting for the decoder and dropped since start, only for FFmpeg streams */
+    packetQueueDepth?: number;
+    packetQueueCapacity?: number;
+    packetsDropped?: number;
+    /** Frames written for remote streams, only while remote stream is enabled */
+    remoteFrames?: number;
+    /** Frames replaced in shared memory before any remote stream read them */
+    remoteUnread?: number;
+    /** Frames not shared because remote streams held on to all the slots */
+    remoteBlocked?: number;
+    /** Recording pipeline stages, only while recording */
+    recordingStages?: RecordingStageStats[];
+    /** Present once a tap has been added */
+    taps?: TapStats[];
+  }
+
+  export interface TapStats {
+    name: string;
+    queueDepth: number;
+    /** Frames the tap didn't keep up with or couldn't convert */
+    dropped: number;
+    /** Frames replaced before a `latest` callback of the tap was run */
+    skippedFrames: number;
+  }
+
+  export interface RecordingStageStats {
+    /** Only mux when copying */
+    name: 'convert' | 'encode' | 'mux';
+    /** Items waiting for the stage */
+    queueDepth: number;
+    queueCapacity: number;
+    /** Frames refused because the queue was full or skipped by the stage */
+    dropped: number;
+    processed: number;
+    /** Moving average from entering the queue until done (ms) */
+    latency: number;
+  }
+
+  export interface RemoteStreamStats {
+    framesRead: number;
+    /** Reads that raced with the writer and were retried */
+    tornReads: number;
+    /** Frames published between two reads that were never read */
+    skippedFrames: number;
+  }
+
+  export interface RemoteFrameOptions {
+    /**
+     * Frame points directly into shared memory instead of being copied out.
+     * The frame keeps its slot from being overwritten until it is garbage
+     * collected, so keep `RemoteStreamOptions.slots` above the amount of
+     * frames held at once.
+     */
+    zeroCopy?: boolean;
+    /**
+     * Returns null without reading when the latest frame is still this
+     * frame number. Numbers start over with the stream, so any other
+     * frame counts as newer.
+     */
+    ifNewerThan?: number;
+  }
+
+  export interface RemoteStreamOptions {
+    /** Frames kept in shared memory (default 4, 3 to 16) */
+    slots?: number;
+  }
+
+  /** Reads frames shared by a stream in another process */
+  export class RemoteStream {
+    /** Takes the id resolved by `enableRemoteStream` */
+    constructor(streamId: string);
+    getLatestFrame: (options?: RemoteFrameOptions) => Frame | null;
+    /**
+     * Resolves to true once a frame other than the one last returned by
+     * `getLatestFrame` has been published, false on timeout
+     */
+    waitForFrame: (timeoutMs: number) => Promise<boolean>;
+    streamId: () => string;
+    /** Counters aren't kept on Windows */
+    stats: () => RemoteStreamStats;
   }
 
   /** Events that can be handled on a `Stream` */
@@ -43,46 +206,179 @@ declare module 'video-module' {
     | 'started-recording'
     | 'stopped-recording'
     | 'snapshot-taken'
-    | 'failed-start-recording';
+    | 'failed-start-recording'
+    | 'decoder-configured'
+    | 'input-stalled'
+    | 'input-recovered'
+    | 'mode-switched';
 
   export interface Event {
     timestamp: number;
     type: EventType;
+    /** Effective decoder settings, only in `decoder-configured` */
+    threads?: number;
+    threadType?: 'frame' | 'slice' | 'none';
+    codec?: string;
+    /** Milliseconds since the last frame, in `input-stalled` and `input-recovered` */
+    withoutInput?: number;
+    /** Stalls since the stream was started, in `input-stalled` */
+    stalls?: number;
+    /**
+     * Milliseconds spent in each phase, in `mode-switched`: waiting for the
+     * previous mode to stop, closing and opening the input, probing it,
+     * setting up the decoder, and from there to the first frame.
+     */
+    stop?: number;
+    close?: number;
+    open?: number;
+    streamInfo?: number;
+    decoder?: number;
+    firstFrame?: number;
+    total?: number;
+    /** Mode was opened before and probing was skipped, in `mode-switched` */
+    streamInfoSkipped?: boolean;
+    /** Decoder of the previous mode was kept, in `mode-switched` */
+    decoderReused?: boolean;
   }
 
   export type StreamEventHandler = (event: Event) => void;
 
   export interface Stream {
     name: () => string;
-    addFrameCallback: (T: FrameHandler) => void;
+    addFrameCallback: (T: FrameHandler, options?: FrameCallbackOptions) => void;
     clearFrameCallbacks: () => void;
-    start: (mode: VideoMode) => void;
+    /** Throws if a tap with the name already exists */
+    addTap: (name: string, options: TapOptions) => void;
+    removeTap: (name: string) => void;
+    start: (mode?: VideoMode) => void;
+    /**
+     * FFmpeg streams wait up to 2 s for the input to close. A later `start`
+     * opens the input only once the previous run has closed it.
+     */
     stop: () => void;
     videoModes: () => [VideoMode];
     /** Can only be returned on a running stream */
     format: () => PixelFormat;
     isActive: () => boolean;
-    latestFrameStats: () => ?Stats;
+    latestFrameStats: () => Stats;
     setEventListener: (T: StreamEventHandler) => void;
     removeEventListener: () => void;
+    /** Resolves to the id for opening `RemoteStream` once the first frame is shared */
+    enableRemoteStream: (options?: RemoteStreamOptions) => Promise<string>;
+    disableRemoteStream: () => void;
   }
 
   export interface RecordingOptions {
     /** Path to output file, including extension (`[path-to-file].mp4`) */
     outputPath: string;
+    /** Container format (`mp4`, `matroska`...), defaults to the one of the extension */
+    format?: string;
+    /**
+     * Start a new file every `segmentDuration` seconds and/or `segmentSize`
+     * bytes, at the next key frame. A `%d` in outputPath is replaced by the
+     * segment number, otherwise `-001`, `-002`... is added before the extension.
+     */
+    segmentDuration?: number;
+    segmentSize?: number;
+    /** Captured frames that can wait for the encoder (default 8) */
+    queueSize?: number;
+    /**
+     * What happens when the encoder has fallen `queueSize` frames behind:
+     * drop new frames (default) or make capture wait
+     */
+    overflow?: 'drop' | 'block';
+    /**
+     * Timestamps of the decoded frames (default) or the time they were
+     * captured. Either way recordings play at the speed they were captured.
+     */
+    timestamps?: 'input' | 'wallclock';
+    /**
+     * Store the compressed packets of the camera (MJPEG, H.264...) without
+     * re-encoding. Starts from the next key frame, the container defaults
+     * to Matroska. Encoder options and wallclock timestamps don't apply.
+     */
+    copy?: boolean;
+    /** Encoder name (`libx264`, `mjpeg`...), defaults to the one of the container */
+    codec?: string;
+    /** Target bitrate in bits/s */
+    bitrate?: number;
+    /** Constant rate factor, for encoders that support it */
+    crf?: number;
+    /** Encoder speed preset (`ultrafast`...`veryslow` for x264) */
+    preset?: string;
+    /** Frames between key frames (default 12) */
+    gop?: number;
+    /** FFmpeg pixel format name, defaults to yuv420p or closest supported */
+    pixelFormat?: string;
+    /** Encoder threads, 0 (default) lets FFmpeg decide */
+    threads?: number;
+    /** Nominal output frame rate, defaults to the frame rate of the input */
+    fps?: number;
+    /** Extra AVOptions for the encoder */
+    codecOptions?: Record<string, string | number>;
+    /** Extra AVOptions for the muxer (`movflags`...) */
+    formatOptions?: Record<string, string | number>;
   }
 
-  export interface SnapshotOptions extends VideoMode {
-    /** Path to output file, including extension (`[path-to-file].[png/jpeg]` */
-    outputPath: string;
+  export interface PreRollOptions extends Omit<RecordingOptions, 'outputPath'> {
+    outputPath?: string;
+    /**
+     * Seconds kept in memory before startRecording is called. Recordings
+     * start from a key frame, so up to `gop` frames more may be included.
+     */
+    preRoll: number;
+  }
+
+  export interface ImageOptions {
+    /** Image is written here and the path returned, otherwise resolves to a Buffer */
+    outputPath?: string;
+    /** Defaults to the extension of outputPath, jpeg if there is none */
+    format?: 'jpeg' | 'png' | 'webp';
+    /** 1 (smallest) - 100 (best), ignored by png */
+    quality?: number;
+    /** Scaled to this size, aspect ratio is kept if only one is given */
+    width?: number;
+    height?: number;
+  }
+
+  /**
+   * Mode is used only when the stream isn't running already, width and
+   * height scale the image of a running stream
+   */
+  export interface SnapshotOptions extends Partial<VideoMode>, ImageOptions {
+    /**
+     * Burst of consecutive frames (default 1). Resolves to an array, files
+     * are numbered like recording segments.
+     */
+    count?: number;
   }
 
   export interface RecordableStream extends Stream {
+    /**
+     * Modes probed in the background, cached after the first probe (as are
+     * those of `videoModes`). Empty for file streams.
+     */
+    videoModesAsync: (options?: { refresh?: boolean }) => Promise<VideoMode[]>;
+    /**
+     * Restarts a running stream in another mode without emitting `stopped`.
+     * Frame callbacks and pending snapshots stay, `mode-switched` reports
+     * the time taken on the first frame. Starts a stream that isn't running.
+     */
+    switchMode: (mode: VideoMode) => void;
     isRecording: () => boolean;
     startRecording: (options: RecordingOptions) => void;
     stopRecording: () => void;
-    // TODO: shouldn't be possible to take snapshot while running
-    takeSnapshot: (options: SnapshotOptions) => void; // <- Only for non running stream
+    /**
+     * Keeps encoding with these options while not recording. Encoder options
+     * of startRecording are ignored while pre-roll is enabled.
+     */
+    enablePreRoll: (options: PreRollOptions) => void;
+    disablePreRoll: () => void;
+    /**
+     * Encodes the next frame in the background without disturbing capture.
+     * Stream that isn't running is started for the snapshot only.
+     */
+    takeSnapshot: (options?: SnapshotOptions) => Promise<string | Buffer | (string | Buffer)[]>;
   }
 
   export class PerfLogger {
@@ -94,6 +390,98 @@ declare module 'video-module' {
   /** Returns the list of video streams (devices) available to FFmpeg */
   export function listStreams(): RecordableStream[];
 
+  /**
+   * Same streams as `listStreams` without blocking. Devices and their modes
+   * are probed in the background once and cached, `refresh` probes again.
+   */
+  export function listStreamsAsync(options?: { refresh?: boolean }): Promise<RecordableStream[]>;
+
+  /**
+   * Callback gets the streams again after a device is plugged in or
+   * removed. Only one listener at a time. Returns false if changes can't be
+   * watched on this platform (only Linux is), use `listStreamsAsync` with
+   * `refresh` instead.
+   */
+  export function setDeviceChangeListener(callback: (streams: RecordableStream[]) => void): boolean;
+  export function removeDeviceChangeListener(): void;
+
+  export interface FileStreamOptions {
+    /** Input format (e.g. `lavfi` for `testsrc2=size=3840x2160:rate=60`), probed if not given */
+    format?: string;
+    /** Deliver frames at their native rate (default) or as fast as they decode */
+    realtime?: boolean;
+    /** Start over at the end of input instead of stopping */
+    loop?: boolean;
+  }
+
+  /**
+   * Stream reading a file, URL or lavfi graph instead of a capture device.
+   * `start` takes an optional mode, resolution and rate come from the input.
+   */
+  export function createFileStream(
+    url: string,
+    options?: FileStreamOptions,
+  ): RecordableStream;
+
+  export interface DecodeBenchmarkOptions {
+    /** File or URL to decode, e.g. `testsrc2=size=3840x2160:rate=60` */
+    url: string;
+    /** Input format (e.g. `lavfi`), probed if not given */
+    format?: string;
+    /** Packets to decode per run (default 300) */
+    packets?: number;
+    /** Thread counts to compare (default [1, 2, 4, 8, 'auto']) */
+    threads?: (number | 'auto')[];
+    threadType?: 'frame' | 'slice';
+  }
+
+  export interface DecodeBenchmarkResult {
+    requestedThreads: number;
+    threads: number;
+    threadType: 'frame' | 'slice' | 'none';
+    frames: number;
+    seconds: number;
+    fps: number;
+  }
+
+  /** Measures decode throughput of the input with different thread counts */
+  export function benchmarkDecode(
+    options: DecodeBenchmarkOptions,
+  ): Promise<DecodeBenchmarkResult[]>;
+
+  export interface ConversionBenchmarkOptions {
+    /** Frame size (default 3840x2160), width needs to be even */
+    width?: number;
+    height?: number;
+    /** Frames converted per implementation (default 30) */
+    frames?: number;
+    /**
+     * FFmpeg pixel format names, defaults to every conversion that has a
+     * dedicated kernel: `uyvy422`, `yuyv422`, `nv12`, `yuv422p` to
+     * `yuv420p`, `rgba`, `bgra` and `yuvj422p` to `yuvj420p`, `rgba`, `bgra`
+     */
+    conversions?: { input: string; output: string }[];
+  }
+
+  export interface ConversionBenchmarkResult {
+    inputFormat: string;
+    outputFormat: string;
+    /** Instruction set of the kernel or `swscale` */
+    implementation: 'avx2' | 'sse4.1' | 'neon' | 'c' | 'swscale';
+    /** Per frame, on a single thread */
+    milliseconds: number;
+    /** Output was identical to the C kernel, always true for swscale */
+    exact: boolean;
+  }
+
+  /**
+   * Compares the conversion kernels this CPU can run with swscale. Streams
+   * use the best kernel automatically for conversions that keep the size.
+   */
+  export function benchmarkConversion(
+    options?: ConversionBenchmarkOptions,
+  ): Promise<ConversionBenchmarkResult[]>;
+
   export function logPerf(
     name: string,
     key: LogLevel,
@@ -2,40 +2,57 @@
 
 namespace ffmpeg {
 
-  AVFrameData::AVFrameData(bool masterFrame)
-    : m_masterFrame(masterFrame)
+  AVFrameData::AVFrameData()
+    : m_avFrame(av_frame_alloc())
   {
-    if(m_masterFrame) {
-      m_avFrame = av_frame_alloc();
-    }
   }
 
   AVFrameData::AVFrameData(AVFrame* avFrame)
-    : m_masterFrame(true)
+    : m_avFrame(av_frame_alloc())
   {
-    m_avFrame = av_frame_alloc();
-    refFrame(avFrame, 0);
+    refFrame(avFrame);
   }
 
-  void AVFrameData::refFrame(AVFrame* avFrame, size_t plane) {
-    if (m_masterFrame) {
-      av_frame_ref(m_avFrame, avFrame);
+  bool AVFrameData::refFrame(AVFrame* avFrame) {
+    clearPlanes();
+    if (av_frame_ref(m_avFrame, avFrame) < 0) {
+      return false;
+    }
+    const AVPixFmtDescriptor* desc =
+      av_pix_fmt_desc_get(static_cast<AVPixelFormat>(m_avFrame->format));
+    for (size_t i = 0; i < MaxPlanes; ++i) {
+      int lineSize = m_avFrame->linesize[i];
+      if (lineSize == 0) {
+        break;
+      }
+      int height = m_avFrame->height;
+      // Chroma planes of vertically subsampled formats have less rows
+      if (desc && (i == 1 || i == 2) && !(desc->flags & AV_PIX_FMT_FLAG_PAL)) {
+        height = AV_CEIL_RSHIFT(height, desc->log2_chroma_h);
+      }
+      addPlane(m_avFrame->data[i],
+               static_cast<unsigned>(height * lineSize),
+               static_cast<unsigned>(m_avFrame->width),
+               static_cast<unsigned>(height));
     }
-    m_data = avFrame->data[plane];
-    m_length = static_cast<unsigned>(avFrame->height * avFrame->linesize[plane]);
-    m_width =  static_cast<unsigned>(avFrame->width);
-    m_height = static_cast<unsigned>(avFrame->height);
+    return true;
+  }
+
+  void AVFrameData::unrefFrame() {
+    clearPlanes();
+    av_frame_unref(m_avFrame);
   }
 
   void AVFrameData::setFrameNumber(unsigned frameNumber) {
     m_frameNumber = frameNumber;
   }
 
+  const AVFrame* AVFrameData::avFrame() const {
+    return m_avFrame;
+  }
+
   AVFrameData::~AVFrameData() {
-    m_data = nullptr;
-    if (m_masterFrame) {
-      av_frame_unref(m_avFrame);
-      av_frame_free(&m_avFrame);
-    }
+    unrefFrame();
+    av_frame_free(&m_avFrame);
   }
 } // namespace ffmpeg
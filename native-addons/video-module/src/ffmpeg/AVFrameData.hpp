@@ -5,17 +5,22 @@
 
 namespace ffmpeg {
 
+  // FrameData that keeps reference to FFmpeg frame, all the planes point to
+  // the data of the referenced AVFrame. The shell (including AVFrame) can be
+  // reused for multiple frames, see FramePool.
   class AVFrameData : public video::FrameData {
   public:
-    AVFrameData(bool masterFrame);
+    AVFrameData();
     AVFrameData(AVFrame* avFrame);
 
-    void refFrame(AVFrame* avFrame, size_t plane);
+    // Returns false if the planes couldn't be referenced
+    bool refFrame(AVFrame* avFrame);
+    void unrefFrame();
     void setFrameNumber(unsigned frameNumber);
+    const AVFrame* avFrame() const override;
     virtual ~AVFrameData();
 
   private:
     AVFrame* m_avFrame;
-    bool m_masterFrame;
   };
 } // namespace ffmpeg
@@ -0,0 +1,144 @@
+#include "ConversionBenchmark.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <optional>
+
+#include "PixelKernels.hpp"
+#include "ffmpeg.hpp"
+
+namespace ffmpeg {
+
+  typedef std::variant<std::vector<ConversionBenchmarkResult>, std::string> BenchmarkResult;
+
+  static const AVPixelFormat InputFormats[] = {
+    AV_PIX_FMT_UYVY422, AV_PIX_FMT_YUYV422, AV_PIX_FMT_NV12, AV_PIX_FMT_YUV422P, AV_PIX_FMT_YUVJ422P
+  };
+  static const AVPixelFormat OutputFormats[] = {
+    AV_PIX_FMT_YUV420P, AV_PIX_FMT_YUVJ420P, AV_PIX_FMT_RGBA, AV_PIX_FMT_BGRA
+  };
+
+  // Noise rather than a flat image, so nothing gets lucky with the data
+  static void fillFrame(AVFrame* frame) {
+    uint32_t state = 1;
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(static_cast<AVPixelFormat>(frame->format));
+    for (int plane = 0; plane < 4 && frame->data[plane]; ++plane) {
+      bool chroma = plane == 1 || plane == 2;
+      int height = chroma ? AV_CEIL_RSHIFT(frame->height, desc->log2_chroma_h) : frame->height;
+      for (int row = 0; row < height; ++row) {
+        uint8_t* data = frame->data[plane] + static_cast<ptrdiff_t>(row) * frame->linesize[plane];
+        for (int i = 0; i < frame->linesize[plane]; ++i) {
+          state = state * 1664525 + 1013904223;
+          data[i] = static_cast<uint8_t>(state >> 24);
+        }
+      }
+    }
+  }
+
+  static bool sameImage(const AVFrame* a, const AVFrame* b) {
+    const AVPixFmtDescriptor* desc = av_pix_fmt_desc_get(static_cast<AVPixelFormat>(a->format));
+    for (int plane = 0; plane < 4 && a->data[plane]; ++plane) {
+      int width = av_image_get_linesize(static_cast<AVPixelFormat>(a->format), a->width, plane);
+      bool chroma = plane == 1 || plane == 2;
+      int height = chroma ? AV_CEIL_RSHIFT(a->height, desc->log2_chroma_h) : a->height;
+      for (int row = 0; row < height; ++row) {
+        if (std::memcmp(a->data[plane] + static_cast<ptrdiff_t>(row) * a->linesize[plane],
+                        b->data[plane] + static_cast<ptrdiff_t>(row) * b->linesize[plane],
+                        static_cast<size_t>(width)) != 0) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  template <typename Convert>
+  static double millisecondsPerFrame(int frames, Convert convert) {
+    auto begin = std::chrono::steady_clock::now();
+    for (int i = 0; i < frames; ++i) {
+      convert();
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - begin).count() / frames;
+  }
+
+  static std::optional<std::string> benchmarkPair(const ConversionBenchmarkOptions& options,
+                                                  AVPixelFormat inputFormat, AVPixelFormat outputFormat,
+                                                  std::vector<ConversionBenchmarkResult>& results) {
+    int width = options.width;
+    int height = options.height;
+    AVFrame* input = initFrame(inputFormat, width, height);
+    AVFrame* reference = initFrame(outputFormat, width, height);
+    AVFrame* output = initFrame(outputFormat, width, height);
+    SwsContext* sws = sws_getContext(width, height, inputFormat, width, height, outputFormat,
+                                     SWS_FAST_BILINEAR, nullptr, nullptr, nullptr);
+    std::optional<std::string> error;
+    if (!input || !reference || !output) {
+      error = errorString(outOfMemoryError());
+    } else if (!sws) {
+      error = "Couldn't allocate pix_fmt transform";
+    } else {
+      fillFrame(input);
+      PixelKernel scalar = findPixelKernel(inputFormat, outputFormat, SimdLevel::None);
+      if (scalar) {
+        scalar(input, reference, 0, height);
+      }
+      for (SimdLevel level : supportedSimdLevels()) {
+        PixelKernel kernel = findPixelKernel(inputFormat, outputFormat, level);
+        if (!kernel) {
+          break;
+        }
+        ConversionBenchmarkResult result;
+        result.inputFormat = inputFormat;
+        result.outputFormat = outputFormat;
+        result.implementation = simdLevelName(level);
+        result.milliseconds = millisecondsPerFrame(options.frames, [&]() { kernel(input, output, 0, height); });
+        result.exact = sameImage(reference, output);
+        results.push_back(result);
+      }
+      ConversionBenchmarkResult result;
+      result.inputFormat = inputFormat;
+      result.outputFormat = outputFormat;
+      result.implementation = "swscale";
+      result.milliseconds = millisecondsPerFrame(options.frames, [&]() {
+        sws_scale(sws, input->data, input->linesize, 0, height, output->data, output->linesize);
+      });
+      result.exact = true;
+      results.push_back(result);
+    }
+    sws_freeContext(sws);
+    av_frame_free(&output);
+    av_frame_free(&reference);
+    av_frame_free(&input);
+    return error;
+  }
+
+  BenchmarkResult benchmarkConversion(const ConversionBenchmarkOptions& options) {
+    if (options.width <= 0 || options.height <= 0 || options.width % 2 != 0) {
+      return std::string("Width needs to be even and height positive");
+    }
+    if (options.frames <= 0) {
+      return std::string("frames needs to be positive");
+    }
+    std::vector<std::pair<AVPixelFormat, AVPixelFormat>> conversions = options.conversions;
+    if (conversions.empty()) {
+      for (AVPixelFormat input : InputFormats) {
+        for (AVPixelFormat output : OutputFormats) {
+          if (findPixelKernel(input, output, SimdLevel::None)) {
+            conversions.emplace_back(input, output);
+          }
+        }
+      }
+    }
+
+    std::vector<ConversionBenchmarkResult> results;
+    for (const auto& [input, output] : conversions) {
+      std::optional<std::string> error = benchmarkPair(options, input, output, results);
+      if (error) {
+        return *error;
+      }
+    }
+    return results;
+  }
+
+} // namespace ffmpeg
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "ffmpeg_include.hpp"
+
+namespace ffmpeg {
+
+  struct ConversionBenchmarkOptions {
+    int width = 3840;
+    int height = 2160;
+    // Frames converted per implementation
+    int frames = 30;
+    // Input and output formats, empty measures every conversion with a
+    // PixelKernel
+    std::vector<std::pair<AVPixelFormat, AVPixelFormat>> conversions;
+  };
+
+  struct ConversionBenchmarkResult {
+    AVPixelFormat inputFormat;
+    AVPixelFormat outputFormat;
+    // Instruction set of the kernel or "swscale"
+    std::string implementation;
+    double milliseconds;
+    // Output was identical to the C kernel, always true for swscale
+    bool exact;
+  };
+
+  // Times the kernels this CPU can run and swscale (SWS_FAST_BILINEAR, as
+  // used when recording) converting the same frame on a single thread.
+  // Returns error message in the case of failure.
+  std::variant<std::vector<ConversionBenchmarkResult>, std::string>
+  benchmarkConversion(const ConversionBenchmarkOptions& options);
+
+} // namespace ffmpeg
@@ -0,0 +1,139 @@
+#include "DecodeBenchmark.hpp"
+
+#include <chrono>
+#include <memory>
+
+#include "ffmpeg_include.hpp"
+
+namespace ffmpeg {
+
+  typedef std::variant<std::vector<DecodeBenchmarkResult>, std::string> BenchmarkResult;
+
+  static void freePackets(std::vector<AVPacket*>& packets) {
+    for (AVPacket* packet : packets) {
+      av_packet_free(&packet);
+    }
+    packets.clear();
+  }
+
+  static int drainFrames(AVCodecContext* codecContext, AVFrame* frame, int& frames) {
+    int err = 0;
+    while (err >= 0) {
+      err = avcodec_receive_frame(codecContext, frame);
+      if (err == AVERROR(EAGAIN) || err == AVERROR_EOF) {
+        return 0;
+      } else if (err < 0) {
+        return err;
+      }
+      ++frames;
+      av_frame_unref(frame);
+    }
+    return err;
+  }
+
+  static std::variant<DecodeBenchmarkResult, std::string> decodePackets(
+    const AVCodec* codec,
+    const AVCodecParameters* parameters,
+    const std::vector<AVPacket*>& packets,
+    int threads,
+    int threadType)
+  {
+    AVCodecContext* codecContext = avcodec_alloc_context3(codec);
+    avcodec_parameters_to_context(codecContext, parameters);
+    codecContext->thread_count = threads;
+    if (threadType != 0) {
+      codecContext->thread_type = threadType;
+    }
+    if (avcodec_open2(codecContext, codec, nullptr) < 0) {
+      avcodec_free_context(&codecContext);
+      return std::string("Couldn't open codec");
+    }
+    DecodeBenchmarkResult result;
+    result.requestedThreads = threads;
+    result.threads = codecContext->thread_count;
+    result.threadType = codecContext->active_thread_type;
+    result.frames = 0;
+
+    AVFrame* frame = av_frame_alloc();
+    int err = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (AVPacket* packet : packets) {
+      err = avcodec_send_packet(codecContext, packet);
+      if (err < 0) {
+        break;
+      }
+      err = drainFrames(codecContext, frame, result.frames);
+      if (err < 0) {
+        break;
+      }
+    }
+    if (err >= 0) {
+      // Flush frames buffered by frame threading
+      avcodec_send_packet(codecContext, nullptr);
+      err = drainFrames(codecContext, frame, result.frames);
+    }
+    auto end = std::chrono::steady_clock::now();
+    result.seconds = std::chrono::duration<double>(end - begin).count();
+
+    av_frame_free(&frame);
+    avcodec_free_context(&codecContext);
+    if (err < 0) {
+      return std::string("Decoding failed");
+    }
+    return result;
+  }
+
+  BenchmarkResult benchmarkDecode(const DecodeBenchmarkOptions& options) {
+    AVInputFormat* iformat = nullptr;
+    if (!options.format.empty()) {
+      iformat = av_find_input_format(options.format.c_str());
+      if (!iformat) {
+        return std::string("Unknown input format " + options.format);
+      }
+    }
+    AVFormatContext* formatContext = nullptr;
+    if (avformat_open_input(&formatContext, options.url.c_str(), iformat, nullptr) != 0) {
+      return std::string("Failed to open input " + options.url);
+    }
+    std::unique_ptr<AVFormatContext*, void(*)(AVFormatContext**)> guard(&formatContext, avformat_close_input);
+    if (avformat_find_stream_info(formatContext, nullptr) < 0) {
+      return std::string("Failed to find stream info");
+    }
+    AVCodec* codec = nullptr;
+    int streamIndex = av_find_best_stream(formatContext, AVMEDIA_TYPE_VIDEO, -1, -1, &codec, 0);
+    if (streamIndex < 0) {
+      return std::string("No video stream found");
+    }
+
+    std::vector<AVPacket*> packets;
+    while (static_cast<int>(packets.size()) < options.packets) {
+      AVPacket* packet = av_packet_alloc();
+      if (av_read_frame(formatContext, packet) < 0) {
+        av_packet_free(&packet);
+        break;
+      }
+      if (packet->stream_index != streamIndex) {
+        av_packet_free(&packet);
+        continue;
+      }
+      packets.push_back(packet);
+    }
+    if (packets.empty()) {
+      return std::string("Input didn't contain any packets");
+    }
+
+    std::vector<DecodeBenchmarkResult> results;
+    const AVCodecParameters* parameters = formatContext->streams[streamIndex]->codecpar;
+    for (int threads : options.threads) {
+      auto result = decodePackets(codec, parameters, packets, threads, options.threadType);
+      if (std::holds_alternative<std::string>(result)) {
+        freePackets(packets);
+        return std::get<std::string>(result);
+      }
+      results.push_back(std::get<DecodeBenchmarkResult>(result));
+    }
+    freePackets(packets);
+    return results;
+  }
+
+} // namespace ffmpeg
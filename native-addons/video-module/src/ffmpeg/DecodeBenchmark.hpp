@@ -0,0 +1,36 @@
+#pragma once
+
+#include <string>
+#include <variant>
+#include <vector>
+
+namespace ffmpeg {
+
+  struct DecodeBenchmarkOptions {
+    std::string url;
+    // Input format, empty lets FFmpeg probe (file) or e.g. "lavfi"
+    std::string format;
+    // Amount of packets read into memory before timing the decode
+    int packets = 300;
+    // Thread counts to test, 0 = automatic
+    std::vector<int> threads;
+    // FF_THREAD_FRAME / FF_THREAD_SLICE, 0 keeps FFmpeg's default
+    int threadType = 0;
+  };
+
+  struct DecodeBenchmarkResult {
+    int requestedThreads;
+    // Values reported by the codec after opening
+    int threads;
+    int threadType;
+    int frames;
+    double seconds;
+  };
+
+  // Measures decode throughput of the same packets with different thread
+  // settings. Demuxing is done up front and is not part of the timing.
+  // Returns error message in the case of failure.
+  std::variant<std::vector<DecodeBenchmarkResult>, std::string>
+  benchmarkDecode(const DecodeBenchmarkOptions& options);
+
+} // namespace ffmpeg
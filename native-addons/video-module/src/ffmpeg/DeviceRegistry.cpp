@@ -0,0 +1,109 @@
+#include "DeviceRegistry.hpp"
+
+#include <algorithm>
+
+#include "ffmpeg.hpp"
+
+namespace ffmpeg {
+
+  DeviceRegistry& DeviceRegistry::shared() {
+    static DeviceRegistry registry;
+    return registry;
+  }
+
+  DeviceRegistry::DeviceRegistry()
+    : m_generation(0)
+  {}
+
+  std::vector<std::string> DeviceRegistry::deviceNames(bool refresh) {
+    uint64_t generation;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (m_names && !refresh) {
+        return *m_names;
+      }
+      generation = m_generation;
+    }
+    std::lock_guard<std::mutex> probing(m_probeMutex);
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (m_names && m_generation != generation) {
+        // Refreshed while waiting
+        return *m_names;
+      }
+    }
+    std::vector<std::string> names = inputVideoDevices();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_names = names;
+    ++m_generation;
+    // Modes of devices that are gone are forgotten
+    for (auto it = m_modes.begin(); it != m_modes.end();) {
+      if (std::find(names.begin(), names.end(), it->first) == names.end()) {
+        it = m_modes.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    return names;
+  }
+
+  std::vector<VideoMode> DeviceRegistry::videoModes(const std::string& name, bool refresh) {
+    if (!refresh) {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      auto it = m_modes.find(name);
+      if (it != m_modes.end()) {
+        return it->second;
+      }
+    }
+    std::lock_guard<std::mutex> probing(m_probeMutex);
+    if (!refresh) {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      auto it = m_modes.find(name);
+      if (it != m_modes.end()) {
+        // Probed while waiting
+        return it->second;
+      }
+    }
+    std::vector<VideoMode> modes = getVideoModes(name);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_modes[name] = modes;
+    return modes;
+  }
+
+  std::vector<DeviceInfo> DeviceRegistry::devices(bool refresh) {
+    std::vector<DeviceInfo> devices;
+    for (const std::string& name : deviceNames(refresh)) {
+      devices.push_back({ name, videoModes(name, refresh) });
+    }
+    return devices;
+  }
+
+  bool DeviceRegistry::setChangeCallback(ChangeCallback callback) {
+    std::lock_guard<std::mutex> lock(m_watchMutex);
+    m_callback = std::move(callback);
+    if (!m_watcher) {
+      m_watcher = utils::DeviceWatcher::create([this] { devicesChanged(); });
+    }
+    return m_watcher != nullptr;
+  }
+
+  std::unique_ptr<utils::DeviceWatcher> DeviceRegistry::stopWatching() {
+    std::lock_guard<std::mutex> lock(m_watchMutex);
+    m_callback = nullptr;
+    return std::move(m_watcher);
+  }
+
+  void DeviceRegistry::devicesChanged() {
+    std::vector<DeviceInfo> devices;
+    for (const std::string& name : deviceNames(true)) {
+      devices.push_back({ name, videoModes(name, false) });
+    }
+    std::lock_guard<std::mutex> lock(m_watchMutex);
+    if (m_callback) {
+      m_callback(devices);
+    }
+  }
+
+} // namespace ffmpeg
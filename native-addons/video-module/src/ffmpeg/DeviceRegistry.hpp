@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "VideoMode.hpp"
+#include "../utils/DeviceWatcher.hpp"
+
+namespace ffmpeg {
+
+  struct DeviceInfo {
+    std::string name;
+    std::vector<VideoMode> modes;
+  };
+
+  /**
+   *  Capture devices and their modes, probed once and kept until refreshed.
+   *
+   *  Enumerating opens the capture format and parses what it prints, which
+   *  takes hundreds of milliseconds per device, so none of this is meant
+   *  for the JS thread. Probing is serialized (prints are captured process
+   *  wide) and callers waiting for a refresh in progress share its result.
+   *
+   *  While a change callback is set, devices plugged in or removed refresh
+   *  the names on the watcher thread. Modes are probed only for new devices.
+   */
+  class DeviceRegistry {
+  public:
+    typedef std::function<void(const std::vector<DeviceInfo>& devices)> ChangeCallback;
+
+    static DeviceRegistry& shared();
+
+    // Block while probing
+    std::vector<std::string> deviceNames(bool refresh);
+    std::vector<VideoMode> videoModes(const std::string& name, bool refresh);
+    // Names and modes of all devices
+    std::vector<DeviceInfo> devices(bool refresh);
+
+    // Called on the watcher thread after devices have changed. Returns false
+    // if changes can't be watched on this platform.
+    bool setChangeCallback(ChangeCallback callback);
+    // No calls are made after this returns. Destroying the returned watcher
+    // waits for its thread, which may be in the middle of probing.
+    std::unique_ptr<utils::DeviceWatcher> stopWatching();
+
+  private:
+    DeviceRegistry();
+    void devicesChanged();
+
+    std::mutex m_probeMutex;
+    std::mutex m_mutex;
+    std::optional<std::vector<std::string>> m_names;
+    // Probes of the names so far
+    uint64_t m_generation;
+    std::map<std::string, std::vector<VideoMode>> m_modes;
+
+    std::mutex m_watchMutex;
+    ChangeCallback m_callback;
+    std::unique_ptr<utils::DeviceWatcher> m_watcher;
+  };
+
+} // namespace ffmpeg
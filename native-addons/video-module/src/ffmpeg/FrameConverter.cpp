@@ -0,0 +1,171 @@
+#include "FrameConverter.hpp"
+
+#include <algorithm>
+#include <thread>
+
+#include "ffmpeg.hpp"
+
+namespace ffmpeg {
+
+  // Bands shorter than this aren't worth a thread of their own
+  static constexpr int MinBandRows = 64;
+  static constexpr int BufferAlignment = 32;
+
+  // Start of the row in a plane, chroma planes of vertically subsampled
+  // formats have less rows
+  static uint8_t* planeRow(const AVPixFmtDescriptor* desc, uint8_t* data, int lineSize, int plane, int row) {
+    if (!data) {
+      return nullptr;
+    }
+    bool chroma = (plane == 1 || plane == 2) && !(desc->flags & AV_PIX_FMT_FLAG_PAL);
+    return data + static_cast<ptrdiff_t>(chroma ? row >> desc->log2_chroma_h : row) * lineSize;
+  }
+
+  FrameConverter::FrameConverter(const FrameConversion& conversion)
+    : m_conversion(conversion),
+      m_inputFormat(AV_PIX_FMT_NONE),
+      m_inputWidth(0),
+      m_inputHeight(0),
+      m_outputFormat(AV_PIX_FMT_NONE),
+      m_outputWidth(0),
+      m_outputHeight(0),
+      m_kernel(nullptr),
+      m_buffers(nullptr)
+  {
+    int threads = conversion.threads > 0
+      ? conversion.threads
+      : static_cast<int>(std::thread::hardware_concurrency());
+    if (threads > 1) {
+      // Capture thread converts one of the bands
+      m_workers = std::make_unique<utils::WorkerPool>(static_cast<size_t>(threads - 1));
+    }
+  }
+
+  FrameConverter::~FrameConverter() {
+    for (SwsContext* band : m_bands) {
+      sws_freeContext(band);
+    }
+    // Buffers still referenced by frames are freed along with them
+    av_buffer_pool_uninit(&m_buffers);
+  }
+
+  int FrameConverter::convert(const AVFrame* input, AVFrame* output) {
+    int ret = prepare(input);
+    if (ret < 0) {
+      return ret;
+    }
+    output->buf[0] = av_buffer_pool_get(m_buffers);
+    if (!output->buf[0]) {
+      return outOfMemoryError();
+    }
+    ret = av_image_fill_arrays(output->data, output->linesize, output->buf[0]->data,
+                               m_outputFormat, m_outputWidth, m_outputHeight, BufferAlignment);
+    if (ret < 0) {
+      av_frame_unref(output);
+      return ret;
+    }
+    output->format = m_outputFormat;
+    output->width = m_outputWidth;
+    output->height = m_outputHeight;
+    av_frame_copy_props(output, input);
+
+    const AVPixFmtDescriptor* inputDesc = av_pix_fmt_desc_get(static_cast<AVPixelFormat>(input->format));
+    const AVPixFmtDescriptor* outputDesc = av_pix_fmt_desc_get(m_outputFormat);
+    // Bands have the same rows in input and output
+    auto convertBand = [&](size_t band) {
+      int row = m_bandRows[band];
+      if (m_kernel) {
+        m_kernel(input, output, row, m_bandRows[band + 1]);
+        return;
+      }
+      uint8_t* source[AV_NUM_DATA_POINTERS];
+      uint8_t* target[AV_NUM_DATA_POINTERS];
+      for (int i = 0; i < AV_NUM_DATA_POINTERS; ++i) {
+        source[i] = planeRow(inputDesc, input->data[i], input->linesize[i], i, row);
+        target[i] = planeRow(outputDesc, output->data[i], output->linesize[i], i, row);
+      }
+      sws_scale(m_bands[band], source, input->linesize, 0, m_bandRows[band + 1] - row,
+                target, output->linesize);
+    };
+    size_t bands = m_bandRows.size() - 1;
+    if (bands > 1) {
+      m_workers->run(bands, convertBand);
+    } else {
+      convertBand(0);
+    }
+    return 0;
+  }
+
+  int FrameConverter::prepare(const AVFrame* input) {
+    if (input->format == m_inputFormat && input->width == m_inputWidth &&
+        input->height == m_inputHeight) {
+      return 0;
+    }
+    AVPixelFormat inputFormat = static_cast<AVPixelFormat>(input->format);
+    m_outputFormat = m_conversion.pixelFormat != AV_PIX_FMT_NONE ? m_conversion.pixelFormat : inputFormat;
+    m_outputWidth = m_conversion.width;
+    m_outputHeight = m_conversion.height;
+    if (m_outputWidth <= 0 && m_outputHeight <= 0) {
+      m_outputWidth = input->width;
+      m_outputHeight = input->height;
+    } else if (m_outputWidth <= 0) {
+      m_outputWidth = static_cast<int>(av_rescale(m_outputHeight, input->width, input->height));
+    } else if (m_outputHeight <= 0) {
+      m_outputHeight = static_cast<int>(av_rescale(m_outputWidth, input->height, input->width));
+    }
+    const AVPixFmtDescriptor* inputDesc = av_pix_fmt_desc_get(inputFormat);
+    const AVPixFmtDescriptor* outputDesc = av_pix_fmt_desc_get(m_outputFormat);
+    if (!inputDesc || !outputDesc || m_outputWidth <= 0 || m_outputHeight <= 0) {
+      return invalidArgumentError();
+    }
+
+    size_t bands = 1;
+    if (m_workers && m_outputHeight == input->height) {
+      bands = static_cast<size_t>(std::clamp(input->height / MinBandRows, 1,
+                                              static_cast<int>(m_workers->threads()) + 1));
+    }
+    // Band edges on rows that start a chroma row in both formats
+    int alignment = 1 << std::max(inputDesc->log2_chroma_h, outputDesc->log2_chroma_h);
+    m_bandRows.clear();
+    for (size_t i = 0; i < bands; ++i) {
+      m_bandRows.push_back(static_cast<int>(input->height * i / bands) / alignment * alignment);
+    }
+    m_bandRows.push_back(input->height);
+
+    m_kernel = nullptr;
+    if (m_outputWidth == input->width && m_outputHeight == input->height && input->width % 2 == 0) {
+      m_kernel = findPixelKernel(inputFormat, m_outputFormat);
+    }
+    for (size_t i = m_kernel ? 0 : bands; i < m_bands.size(); ++i) {
+      sws_freeContext(m_bands[i]);
+    }
+    m_bands.resize(m_kernel ? 0 : bands, nullptr);
+    for (size_t i = 0; i < m_bands.size(); ++i) {
+      int rows = m_bandRows[i + 1] - m_bandRows[i];
+      m_bands[i] = sws_getCachedContext(
+        m_bands[i],
+        input->width, rows, inputFormat,
+        m_outputWidth, bands > 1 ? rows : m_outputHeight, m_outputFormat,
+        m_conversion.algorithm, nullptr, nullptr, nullptr);
+      if (!m_bands[i]) {
+        return invalidArgumentError();
+      }
+    }
+
+    int size = av_image_get_buffer_size(m_outputFormat, m_outputWidth, m_outputHeight, BufferAlignment);
+    if (size < 0) {
+      return size;
+    }
+    av_buffer_pool_uninit(&m_buffers);
+    m_buffers = av_buffer_pool_init(size, nullptr);
+    if (!m_buffers) {
+      return outOfMemoryError();
+    }
+
+    m_inputFormat = input->format;
+    m_inputWidth = input->width;
+    m_inputHeight = input->height;
+    return 0;
+  }
+
+} // namespace ffmpeg
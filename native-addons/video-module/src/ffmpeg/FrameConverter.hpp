@@ -0,0 +1,55 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "../utils/WorkerPool.hpp"
+#include "PixelKernels.hpp"
+#include "VideoMode.hpp"
+
+namespace ffmpeg {
+
+  /**
+   *  Converts decoded frames to the pixel format and size of the conversion.
+   *
+   *  Scaler contexts are kept between frames with sws_getCachedContext and
+   *  only rebuilt when the input changes. When the height stays the same the
+   *  image is split into horizontal bands converted in parallel, each band
+   *  with a context of its own. Scaling vertically runs in a single context,
+   *  bands would need rows of their neighbours. Format changes of the same
+   *  size that have a PixelKernel use it instead of swscale.
+   *
+   *  Output buffers come from a pool and go back to it once the last
+   *  reference to the converted frame is dropped.
+   */
+  class FrameConverter {
+  public:
+    FrameConverter(const FrameConversion& conversion);
+    ~FrameConverter();
+
+    // Output gets references to pooled buffers, it needs to be unreferenced
+    // before. Returns AVERROR code.
+    int convert(const AVFrame* input, AVFrame* output);
+
+  private:
+    int prepare(const AVFrame* input);
+
+    const FrameConversion m_conversion;
+    std::unique_ptr<utils::WorkerPool> m_workers;
+
+    // Input geometry the contexts are for
+    int m_inputFormat;
+    int m_inputWidth;
+    int m_inputHeight;
+    AVPixelFormat m_outputFormat;
+    int m_outputWidth;
+    int m_outputHeight;
+    // First input row of each band and the end of the last one
+    std::vector<int> m_bandRows;
+    std::vector<SwsContext*> m_bands;
+    // Used instead of the contexts when set
+    PixelKernel m_kernel;
+    AVBufferPool* m_buffers;
+  };
+
+} // namespace ffmpeg
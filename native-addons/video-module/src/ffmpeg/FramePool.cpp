@@ -0,0 +1,82 @@
+#include "FramePool.hpp"
+
+namespace ffmpeg {
+
+  std::shared_ptr<FramePool> FramePool::create(size_t capacity) {
+    return std::make_shared<FramePool>(capacity);
+  }
+
+  FramePool::FramePool(size_t capacity)
+    : m_capacity(capacity),
+      m_hits(0),
+      m_misses(0)
+  {
+  }
+
+  std::shared_ptr<AVFrameData> FramePool::acquire(AVFrame* avFrame, unsigned frameNumber) {
+    std::unique_ptr<AVFrameData> shell;
+    {
+      std::lock_guard<std::mutex> g(m_mutex);
+      if (!m_free.empty()) {
+        shell = std::move(m_free.back());
+        m_free.pop_back();
+      }
+    }
+    if (shell) {
+      m_hits.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      m_misses.fetch_add(1, std::memory_order_relaxed);
+      shell = std::make_unique<AVFrameData>();
+    }
+    if (!shell->refFrame(avFrame)) {
+      recycle(shell.release());
+      return nullptr;
+    }
+    shell->setFrameNumber(frameNumber);
+
+    std::weak_ptr<FramePool> pool = shared_from_this();
+    return std::shared_ptr<AVFrameData>(shell.release(), [pool](AVFrameData* data) {
+      if (auto owner = pool.lock()) {
+        owner->recycle(data);
+      } else {
+        delete data;
+      }
+    });
+  }
+
+  void FramePool::recycle(AVFrameData* shell) {
+    std::unique_ptr<AVFrameData> data(shell);
+    // Release FFmpeg buffers right away, decoder may be waiting for them
+    data->unrefFrame();
+    std::lock_guard<std::mutex> g(m_mutex);
+    if (m_free.size() < m_capacity) {
+      m_free.push_back(std::move(data));
+    }
+  }
+
+  void FramePool::setCapacity(size_t capacity) {
+    std::vector<std::unique_ptr<AVFrameData>> extra;
+    {
+      std::lock_guard<std::mutex> g(m_mutex);
+      m_capacity = capacity;
+      while (m_free.size() > m_capacity) {
+        extra.push_back(std::move(m_free.back()));
+        m_free.pop_back();
+      }
+    }
+  }
+
+  size_t FramePool::available() {
+    std::lock_guard<std::mutex> g(m_mutex);
+    return m_free.size();
+  }
+
+  uint64_t FramePool::hits() const {
+    return m_hits.load(std::memory_order_relaxed);
+  }
+
+  uint64_t FramePool::misses() const {
+    return m_misses.load(std::memory_order_relaxed);
+  }
+
+} // namespace ffmpeg
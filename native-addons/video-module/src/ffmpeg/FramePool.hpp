@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "AVFrameData.hpp"
+
+namespace ffmpeg {
+
+  /**
+   *  Pool of reusable AVFrameData shells (FrameData + AVFrame).
+   *
+   *  Frames handed out by the pool are returned to it when the last reference
+   *  (typically the JS Frame) is dropped. At that point the reference to the
+   *  FFmpeg buffers is released, only the shell is kept for reuse. Pool keeps
+   *  at most capacity shells, the rest are freed.
+   *
+   *  Pool is shared with the frames it has handed out so it is safe to drop
+   *  the owning stream while frames are still alive.
+   */
+  class FramePool : public std::enable_shared_from_this<FramePool> {
+  public:
+    static constexpr size_t DefaultCapacity = 8;
+
+    static std::shared_ptr<FramePool> create(size_t capacity = DefaultCapacity);
+
+    // Returns frame that references the planes of avFrame, nullptr if out
+    // of memory
+    std::shared_ptr<AVFrameData> acquire(AVFrame* avFrame, unsigned frameNumber);
+
+    void setCapacity(size_t capacity);
+
+    size_t available();
+    uint64_t hits() const;
+    uint64_t misses() const;
+
+    FramePool(size_t capacity);
+
+  private:
+    void recycle(AVFrameData* shell);
+
+    std::mutex m_mutex;
+    std::vector<std::unique_ptr<AVFrameData>> m_free;
+    size_t m_capacity;
+
+    std::atomic<uint64_t> m_hits;
+    std::atomic<uint64_t> m_misses;
+  };
+
+} // namespace ffmpeg
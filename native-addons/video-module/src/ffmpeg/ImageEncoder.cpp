@@ -0,0 +1,220 @@
+#include "ImageEncoder.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <utility>
+
+#include "ffmpeg.hpp"
+
+namespace ffmpeg {
+
+  // Full range formats, limited range JPEG is non-standard
+  static const AVPixelFormat JpegPixelFormats[] = {
+    AV_PIX_FMT_YUVJ420P, AV_PIX_FMT_YUVJ422P, AV_PIX_FMT_YUVJ444P, AV_PIX_FMT_NONE
+  };
+
+  struct ImageEncoder::Encoder {
+    Key key;
+    AVCodecContext* codecContext = nullptr;
+    // Scales and converts input to the encoder when they differ
+    SwsContext* swsContext = nullptr;
+    AVFrame* frame = nullptr;
+    // Some encoders refuse timestamps that don't increase
+    int64_t nextPts = 0;
+
+    ~Encoder() {
+      av_frame_free(&frame);
+      sws_freeContext(swsContext);
+      avcodec_free_context(&codecContext);
+    }
+  };
+
+  static std::string imageFormat(const ImageOptions& options) {
+    std::string format = options.format;
+    size_t dot = options.outputPath.find_last_of('.');
+    if (format.empty() && dot != std::string::npos) {
+      format = options.outputPath.substr(dot + 1);
+    }
+    std::transform(format.begin(), format.end(), format.begin(),
+                   [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return format.empty() || format == "jpg" ? "jpeg" : format;
+  }
+
+  static AVCodec* imageCodec(const std::string& format) {
+    if (format == "jpeg") {
+      return avcodec_find_encoder(AV_CODEC_ID_MJPEG);
+    } else if (format == "png") {
+      return avcodec_find_encoder(AV_CODEC_ID_PNG);
+    } else if (format == "webp") {
+      // Animated WebP encoder is registered first for the same codec id
+      return avcodec_find_encoder_by_name("libwebp");
+    }
+    return nullptr;
+  }
+
+  static std::pair<int, int> imageSize(const AVFrame* input, const ImageOptions& options) {
+    int width = options.width;
+    int height = options.height;
+    if (width <= 0 && height <= 0) {
+      return std::make_pair(input->width, input->height);
+    } else if (width <= 0) {
+      width = static_cast<int>(av_rescale(height, input->width, input->height));
+    } else if (height <= 0) {
+      height = static_cast<int>(av_rescale(width, input->height, input->width));
+    }
+    return std::make_pair(std::max(width, 1), std::max(height, 1));
+  }
+
+  ImageEncoder& ImageEncoder::shared() {
+    static ImageEncoder encoder;
+    return encoder;
+  }
+
+  ImageEncoder::ImageEncoder(size_t capacity)
+    : m_capacity(capacity)
+  {}
+
+  ImageEncoder::~ImageEncoder() {
+  }
+
+  std::variant<AVPacket*, std::string> ImageEncoder::encode(
+    const AVFrame* input,
+    const ImageOptions& options)
+  {
+    std::pair<int, int> size = imageSize(input, options);
+    Key key(imageFormat(options), std::min(options.quality, 100), size.first, size.second,
+            input->format, input->width, input->height);
+    std::unique_ptr<Encoder> encoder = take(key);
+    if (!encoder) {
+      auto opened = open(key);
+      if (std::holds_alternative<std::string>(opened)) {
+        return std::get<std::string>(opened);
+      }
+      encoder = std::move(std::get<std::unique_ptr<Encoder>>(opened));
+    }
+
+    if (encoder->swsContext) {
+      // Encoder may still reference the buffers of the previous image
+      int ret = av_frame_make_writable(encoder->frame);
+      if (ret < 0) {
+        return "Couldn't allocate frame: " + errorString(ret);
+      }
+      sws_scale(encoder->swsContext, input->data, input->linesize, 0, input->height,
+                encoder->frame->data, encoder->frame->linesize);
+    }
+    // New reference only, quality and timestamp are set per frame
+    AVFrame* frame = av_frame_clone(encoder->swsContext ? encoder->frame : input);
+    if (!frame) {
+      return errorString(outOfMemoryError());
+    }
+    AVCodecContext* ctx = encoder->codecContext;
+    frame->quality = ctx->global_quality;
+    frame->pts = encoder->nextPts++;
+
+    // Image encoders without delay give the packet right away and stay
+    // usable, others need to be drained and can't be kept
+    bool delayed = ctx->codec->capabilities & AV_CODEC_CAP_DELAY;
+    int ret = avcodec_send_frame(ctx, frame);
+    av_frame_free(&frame);
+    if (ret >= 0 && delayed) {
+      ret = avcodec_send_frame(ctx, nullptr);
+    }
+    AVPacket* packet = av_packet_alloc();
+    if (!packet) {
+      return errorString(outOfMemoryError());
+    }
+    if (ret >= 0) {
+      ret = avcodec_receive_packet(ctx, packet);
+    }
+    if (ret < 0) {
+      av_packet_free(&packet);
+      return "Couldn't encode image: " + errorString(ret);
+    }
+    if (!delayed) {
+      recycle(std::move(encoder));
+    }
+
+    if (!options.outputPath.empty()) {
+      std::ofstream file(options.outputPath, std::ios::binary);
+      file.write(reinterpret_cast<const char*>(packet->data), packet->size);
+      if (!file) {
+        av_packet_free(&packet);
+        return "Couldn't write " + options.outputPath;
+      }
+    }
+    return packet;
+  }
+
+  std::variant<std::unique_ptr<ImageEncoder::Encoder>, std::string> ImageEncoder::open(const Key& key) {
+    const auto& [format, quality, width, height, input, inputWidth, inputHeight] = key;
+    AVCodec* codec = imageCodec(format);
+    if (!codec) {
+      return "No encoder for image format " + format;
+    }
+    bool jpeg = codec->id == AV_CODEC_ID_MJPEG;
+    AVPixelFormat inputFormat = static_cast<AVPixelFormat>(input);
+    AVPixelFormat pixelFormat = avcodec_find_best_pix_fmt_of_list(
+      jpeg ? JpegPixelFormats : codec->pix_fmts, inputFormat, 0, nullptr);
+    if (pixelFormat == AV_PIX_FMT_NONE) {
+      pixelFormat = inputFormat;
+    }
+
+    auto encoder = std::make_unique<Encoder>();
+    encoder->key = key;
+    AVCodecContext* ctx = encoder->codecContext = avcodec_alloc_context3(codec);
+    if (!ctx) {
+      return std::string("Couldn't allocate codec context");
+    }
+    ctx->width = width;
+    ctx->height = height;
+    ctx->pix_fmt = pixelFormat;
+    ctx->time_base = AVRational{1, DefaultOutputFps};
+    AVDictionary* codecOptions = nullptr;
+    if (quality > 0 && jpeg) {
+      // Quality scale 2 (best) - 31, taken from the frame
+      ctx->flags |= AV_CODEC_FLAG_QSCALE;
+      ctx->global_quality = FF_QP2LAMBDA * (31 - (quality - 1) * 29 / 99);
+    } else if (quality > 0 && codec->id == AV_CODEC_ID_WEBP) {
+      av_dict_set_int(&codecOptions, "quality", quality, 0);
+    }
+    int ret = avcodec_open2(ctx, codec, &codecOptions);
+    av_dict_free(&codecOptions);
+    if (ret < 0) {
+      return "Couldn't open codec: " + errorString(ret);
+    }
+
+    if (pixelFormat != inputFormat || width != inputWidth || height != inputHeight) {
+      encoder->frame = initFrame(pixelFormat, width, height);
+      encoder->swsContext = sws_getContext(
+        inputWidth, inputHeight, inputFormat,
+        width, height, pixelFormat,
+        SWS_BICUBIC, nullptr, nullptr, nullptr);
+      if (!encoder->frame || !encoder->swsContext) {
+        return std::string("Couldn't allocate pix_fmt transform");
+      }
+    }
+    return encoder;
+  }
+
+  std::unique_ptr<ImageEncoder::Encoder> ImageEncoder::take(const Key& key) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto it = m_idle.begin(); it != m_idle.end(); ++it) {
+      if ((*it)->key == key) {
+        std::unique_ptr<Encoder> encoder = std::move(*it);
+        m_idle.erase(it);
+        return encoder;
+      }
+    }
+    return nullptr;
+  }
+
+  void ImageEncoder::recycle(std::unique_ptr<Encoder> encoder) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_idle.push_front(std::move(encoder));
+    if (m_idle.size() > m_capacity) {
+      m_idle.pop_back();
+    }
+  }
+
+} // namespace ffmpeg
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <variant>
+
+#include "ffmpeg_include.hpp"
+
+namespace ffmpeg {
+
+  struct ImageOptions {
+    // "jpeg", "png" or "webp", empty picks by the extension of outputPath
+    // and falls back to jpeg
+    std::string format = "";
+    // Image is also written here when set
+    std::string outputPath = "";
+    // 1 (smallest) - 100 (best), -1 keeps the default of the encoder.
+    // Ignored by lossless formats.
+    int quality = -1;
+    // Scaled to this size, 0 keeps the size of the frame (or the aspect
+    // ratio if the other one is given)
+    int width = 0;
+    int height = 0;
+  };
+
+  /**
+   *  Encodes single frames as still images.
+   *
+   *  Opened encoders, with the scaler feeding them, are kept for reuse by
+   *  format, quality, output size and input format, so encoding frames of a
+   *  stream one by one doesn't open a new encoder each time. Encoder is taken
+   *  out of the cache for the duration of an encode, so the same instance can
+   *  be used from multiple threads.
+   */
+  class ImageEncoder {
+  public:
+    static constexpr size_t DefaultCapacity = 8;
+
+    // Shared by all the streams and frames
+    static ImageEncoder& shared();
+
+    ImageEncoder(size_t capacity = DefaultCapacity);
+    ~ImageEncoder();
+
+    // Returns packet holding the whole image (free with av_packet_free) or
+    // error message
+    std::variant<AVPacket*, std::string> encode(const AVFrame* frame, const ImageOptions& options);
+
+  private:
+    struct Encoder;
+    // Format, quality, width, height, input format, input width, input height
+    typedef std::tuple<std::string, int, int, int, int, int, int> Key;
+
+    std::variant<std::unique_ptr<Encoder>, std::string> open(const Key& key);
+    std::unique_ptr<Encoder> take(const Key& key);
+    void recycle(std::unique_ptr<Encoder> encoder);
+
+    std::mutex m_mutex;
+    // Idle encoders, most recently used first
+    std::list<std::unique_ptr<Encoder>> m_idle;
+    const size_t m_capacity;
+  };
+
+} // namespace ffmpeg
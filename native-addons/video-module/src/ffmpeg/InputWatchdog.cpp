@@ -0,0 +1,122 @@
+#include "InputWatchdog.hpp"
+
+#include <algorithm>
+
+using std::chrono::duration_cast;
+using std::chrono::steady_clock;
+
+namespace ffmpeg {
+
+  InputWatchdog::InputWatchdog(Duration stallTimeout, Duration inputTimeout, StallCallback callback,
+                               TimeoutCallback timeoutCallback)
+    : m_stallTimeout(stallTimeout),
+      m_inputTimeout(inputTimeout),
+      m_callback(std::move(callback)),
+      m_timeoutCallback(std::move(timeoutCallback)),
+      m_lastPacket(steady_clock::now()),
+      m_watching(false),
+      m_stalled(false),
+      m_timedOut(false),
+      m_stopping(false),
+      m_interrupted(false),
+      m_stalls(0)
+  {
+    if (m_stallTimeout.count() > 0 || m_inputTimeout.count() > 0) {
+      m_thread = std::thread(&InputWatchdog::loop, this);
+    }
+  }
+
+  InputWatchdog::~InputWatchdog() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stopping = true;
+    }
+    m_wake.notify_all();
+    if (m_thread.joinable()) {
+      m_thread.join();
+    }
+  }
+
+  void InputWatchdog::begin() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_watching = true;
+      m_lastPacket = steady_clock::now();
+    }
+    m_wake.notify_all();
+  }
+
+  void InputWatchdog::packetReceived() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto now = steady_clock::now();
+    if (m_stalled) {
+      m_stalled = false;
+      // Under the lock so that recovering can't overtake the stall
+      m_callback(false, duration_cast<Duration>(now - m_lastPacket), m_stalls);
+      m_wake.notify_all();
+    }
+    m_lastPacket = now;
+  }
+
+  bool InputWatchdog::expired() const {
+    if (m_interrupted) {
+      return true;
+    }
+    if (m_inputTimeout.count() <= 0) {
+      return false;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return steady_clock::now() - m_lastPacket > m_inputTimeout;
+  }
+
+  bool InputWatchdog::interrupt() {
+    return !m_interrupted.exchange(true);
+  }
+
+  bool InputWatchdog::interrupted() const {
+    return m_interrupted;
+  }
+
+  bool InputWatchdog::stalled() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stalled;
+  }
+
+  uint64_t InputWatchdog::stalls() const {
+    return m_stalls;
+  }
+
+  int InputWatchdog::interruptCallback(void* opaque) {
+    return static_cast<const InputWatchdog*>(opaque)->expired() ? 1 : 0;
+  }
+
+  void InputWatchdog::loop() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stopping) {
+      bool watchStall = m_watching && !m_stalled && m_stallTimeout.count() > 0;
+      // Run that has ended already isn't timed out
+      bool watchTimeout = m_watching && !m_timedOut && !m_interrupted && m_inputTimeout.count() > 0;
+      if (!watchStall && !watchTimeout) {
+        // Nothing to do until reading starts or the input recovers
+        m_wake.wait(lock);
+        continue;
+      }
+      auto stallDue = m_lastPacket + m_stallTimeout;
+      auto timeoutDue = m_lastPacket + m_inputTimeout;
+      auto now = steady_clock::now();
+      if (watchStall && now >= stallDue) {
+        m_stalled = true;
+        ++m_stalls;
+        m_callback(true, duration_cast<Duration>(now - m_lastPacket), m_stalls);
+      } else if (watchTimeout && now >= timeoutDue) {
+        m_timedOut = true;
+        m_timeoutCallback(*this);
+      } else if (watchStall && watchTimeout) {
+        m_wake.wait_until(lock, std::min(stallDue, timeoutDue));
+      } else {
+        m_wake.wait_until(lock, watchStall ? stallDue : timeoutDue);
+      }
+    }
+  }
+
+} // namespace ffmpeg
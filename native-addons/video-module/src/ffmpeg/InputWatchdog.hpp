@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+namespace ffmpeg {
+
+  /**
+   *  Keeps track of packets arriving from the input. Input that goes
+   *  stallTimeout without a packet is stalled until the next one arrives.
+   *  Watching runs on a thread of its own, so a stall is noticed also while
+   *  the reading thread is blocked inside a capture driver.
+   *
+   *  Reading is given up after inputTimeout without a packet or once
+   *  interrupted. FFmpeg asks through AVIOInterruptCB while it waits on
+   *  network input, other waits check expired(). Capture drivers may block
+   *  in a read that never returns, so the watchdog thread also reports the
+   *  timeout itself.
+   */
+  class InputWatchdog {
+  public:
+    typedef std::chrono::milliseconds Duration;
+    // Called with true on the watchdog thread when the input stalls and with
+    // false on the reading thread when it recovers, along with the time
+    // since the last packet and the stalls so far
+    typedef std::function<void(bool stalled, Duration withoutInput, uint64_t stalls)> StallCallback;
+    // Called once on the watchdog thread when reading has gone inputTimeout
+    // without a packet, whether or not the reading thread noticed
+    typedef std::function<void(InputWatchdog& watchdog)> TimeoutCallback;
+
+    // Zero timeout disables the check
+    InputWatchdog(Duration stallTimeout, Duration inputTimeout, StallCallback callback,
+                  TimeoutCallback timeoutCallback);
+    ~InputWatchdog();
+
+    // Reading thread. Stalls are only watched after begin, opening the input
+    // is covered by inputTimeout.
+    void begin();
+    void packetReceived();
+    bool expired() const;
+
+    // Any thread, aborts reading. Returns false if already interrupted.
+    bool interrupt();
+    bool interrupted() const;
+
+    bool stalled() const;
+    uint64_t stalls() const;
+
+    // AVIOInterruptCB::callback with the watchdog as opaque
+    static int interruptCallback(void* opaque);
+
+  private:
+    void loop();
+
+    const Duration m_stallTimeout;
+    const Duration m_inputTimeout;
+    const StallCallback m_callback;
+    const TimeoutCallback m_timeoutCallback;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::chrono::steady_clock::time_point m_lastPacket;
+    bool m_watching;
+    bool m_stalled;
+    bool m_timedOut;
+    bool m_stopping;
+    std::atomic<bool> m_interrupted;
+    std::atomic<uint64_t> m_stalls;
+
+    std::thread m_thread;
+  };
+
+} // namespace ffmpeg
@@ -1,28 +1,37 @@
 #pragma once
 
 #include "ffmpeg_include.hpp"
+#include "PixelKernels.hpp"
+#include "RecordingOptions.hpp"
 
 #include <string>
 
 namespace ffmpeg {
 
   struct OutputContext {
-    OutputContext(const std::string& fileName, bool snapshot)
-      : outputPath(fileName),
-        isSnapshot(snapshot)
+    OutputContext(const RecordingOptions& recordingOptions)
+      : options(recordingOptions),
+        outputPath(recordingOptions.outputPath)
     {}
 
+    const RecordingOptions options;
     const std::string outputPath;
-    bool isSnapshot;
-    AVFormatContext* formatContext = nullptr;
     AVOutputFormat* outputFormat = nullptr;
     AVCodec* codec = nullptr;
-    AVStream *stream = nullptr;
     AVCodecContext* codecContext = nullptr;
-    AVFrame* frame = nullptr;
     SwsContext* swsContext = nullptr;
-    int64_t nextPts = 0;
-    bool encodingFrames = false;
+    // Used instead of swsContext when set
+    PixelKernel kernel = nullptr;
+    // Input needs to be converted to pixel format of the encoder
+    bool convertFrames = false;
+    // Stream parameters and time base of the packets, same for every file
+    AVCodecParameters* parameters = nullptr;
+    AVRational timeBase = AVRational{0, 1};
+
+    // File being written
+    AVFormatContext* formatContext = nullptr;
+    AVStream *stream = nullptr;
+    bool headerWritten = false;
   };
 
 }
@@ -0,0 +1,115 @@
+#include "PacketQueue.hpp"
+
+#include <algorithm>
+
+namespace ffmpeg {
+
+  static bool isKeyframe(const AVPacket* packet) {
+    return packet->flags & AV_PKT_FLAG_KEY;
+  }
+
+  PacketQueue::PacketQueue(size_t capacity, bool intraOnly, bool blocking)
+    : m_capacity(capacity > 0 ? capacity : 1),
+      m_intraOnly(intraOnly),
+      m_blocking(blocking),
+      m_closed(false),
+      m_waitForKeyframe(false),
+      m_dropped(0)
+  {}
+
+  PacketQueue::~PacketQueue() {
+    for (AVPacket* packet : m_packets) {
+      av_packet_free(&packet);
+    }
+  }
+
+  bool PacketQueue::push(AVPacket* packet) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_blocking) {
+      m_notFull.wait(lock, [this] { return m_closed || m_packets.size() < m_capacity; });
+    }
+    if (m_closed) {
+      av_packet_free(&packet);
+      return false;
+    }
+    // Packet can't be decoded without the ones dropped before it
+    auto undecodable = [this](const AVPacket* p) { return p && m_waitForKeyframe && !isKeyframe(p); };
+    if (m_packets.size() >= m_capacity && !undecodable(packet)) {
+      // Room first: dropping may start the wait for a keyframe
+      dropOldest();
+    }
+    if (undecodable(packet)) {
+      drop(packet);
+      return true;
+    }
+    if (packet) {
+      m_waitForKeyframe = false;
+    }
+    m_packets.push_back(packet);
+    lock.unlock();
+    m_notEmpty.notify_one();
+    return true;
+  }
+
+  std::optional<AVPacket*> PacketQueue::pop() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_notEmpty.wait(lock, [this] { return m_closed || !m_packets.empty(); });
+    if (m_packets.empty()) {
+      return std::nullopt;
+    }
+    AVPacket* packet = m_packets.front();
+    m_packets.pop_front();
+    lock.unlock();
+    m_notFull.notify_one();
+    return packet;
+  }
+
+  void PacketQueue::close() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_closed = true;
+    }
+    m_notEmpty.notify_all();
+    m_notFull.notify_all();
+  }
+
+  size_t PacketQueue::size() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_packets.size();
+  }
+
+  size_t PacketQueue::capacity() const {
+    return m_capacity;
+  }
+
+  uint64_t PacketQueue::dropped() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_dropped;
+  }
+
+  void PacketQueue::dropOldest() {
+    auto it = std::find_if(m_packets.begin(), m_packets.end(), [](AVPacket* packet) { return packet; });
+    if (it == m_packets.end()) {
+      return;
+    }
+    drop(*it);
+    it = m_packets.erase(it);
+    if (m_intraOnly) {
+      return;
+    }
+    // Rest of the group of pictures refers to the dropped packet
+    while (it != m_packets.end() && *it && !isKeyframe(*it)) {
+      drop(*it);
+      it = m_packets.erase(it);
+    }
+    if (it == m_packets.end()) {
+      m_waitForKeyframe = true;
+    }
+  }
+
+  void PacketQueue::drop(AVPacket* packet) {
+    av_packet_free(&packet);
+    ++m_dropped;
+  }
+
+} // namespace ffmpeg
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+#include "ffmpeg_include.hpp"
+
+namespace ffmpeg {
+
+  /**
+   *  Packets read from the input waiting for the decoder.
+   *
+   *  Reader of live input never waits: when the decoder falls behind, the
+   *  oldest packet is dropped so reading keeps pace with the device and the
+   *  delay stays bounded. Codecs that aren't intra only can't decode past a
+   *  missing packet, so the rest of its group of pictures goes too and new
+   *  packets are dropped until the next keyframe.
+   *
+   *  Input that isn't live (files read as fast as they decode) can wait, so
+   *  a blocking queue makes the reader wait for room instead.
+   *
+   *  nullptr queued marks the end of input, those are never dropped. After
+   *  close, push refuses everything and pop drains what is left before
+   *  returning empty.
+   */
+  class PacketQueue {
+  public:
+    PacketQueue(size_t capacity, bool intraOnly, bool blocking);
+    // Frees the packets still queued
+    ~PacketQueue();
+
+    // Reader thread, takes the packet. Returns false if closed.
+    bool push(AVPacket* packet);
+    // Decoder thread, waits for a packet, empty once closed and drained
+    std::optional<AVPacket*> pop();
+    void close();
+
+    size_t size() const;
+    size_t capacity() const;
+    uint64_t dropped() const;
+
+  private:
+    void dropOldest();
+    void drop(AVPacket* packet);
+
+    const size_t m_capacity;
+    const bool m_intraOnly;
+    const bool m_blocking;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_notEmpty;
+    std::condition_variable m_notFull;
+    std::deque<AVPacket*> m_packets;
+    bool m_closed;
+    // Packets are dropped until a keyframe comes
+    bool m_waitForKeyframe;
+    uint64_t m_dropped;
+  };
+
+} // namespace ffmpeg
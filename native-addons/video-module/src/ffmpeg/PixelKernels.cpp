@@ -0,0 +1,595 @@
+#include "PixelKernels.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define PIXEL_KERNELS_X86
+#include <immintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define PIXEL_KERNELS_NEON
+#include <arm_neon.h>
+#endif
+
+// Instruction set is picked at runtime, so only the functions using it are
+// compiled for it. MSVC takes the intrinsics without flags.
+#if defined(PIXEL_KERNELS_X86) && !defined(_MSC_VER)
+#define TARGET_SSE41 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_SSE41
+#define TARGET_AVX2
+#endif
+
+namespace ffmpeg {
+
+  // Q13 coefficients, applied to samples scaled by 64 with a multiply that
+  // keeps the high 16 bits, so the result has 3 fractional bits. Integer
+  // math is the same in C and in every instruction set.
+  struct YuvCoefficients {
+    int16_t yOffset;
+    int16_t y;
+    int16_t vr;
+    int16_t ug;
+    int16_t vg;
+    int16_t ub;
+  };
+
+  // BT.601
+  static constexpr YuvCoefficients LimitedRange = { 16, 9539, 13075, 3209, 6660, 16525 };
+  static constexpr YuvCoefficients FullRange = { 0, 8192, 11485, 2819, 5850, 14516 };
+
+  // Building blocks the kernels are made of, one set per instruction set
+  struct RowOps {
+    // Packed 4:2:2 row in uyvy or yuyv order to planes
+    void (*splitPacked)(const uint8_t* src, uint8_t* y, uint8_t* u, uint8_t* v, int width, bool uyvy);
+    // Interleaved chroma of nv12 to planes
+    void (*splitChroma)(const uint8_t* src, uint8_t* u, uint8_t* v, int count);
+    // Rounded average of two rows
+    void (*average)(const uint8_t* a, const uint8_t* b, uint8_t* out, int count);
+    // Row with 4:2:2 chroma to rgba or bgra
+    void (*toRgba)(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* rgba, int width,
+                   const YuvCoefficients& k, bool bgra);
+  };
+
+  static void splitPackedC(const uint8_t* src, uint8_t* y, uint8_t* u, uint8_t* v, int width, bool uyvy) {
+    int luma = uyvy ? 1 : 0;
+    int chroma = uyvy ? 0 : 1;
+    for (int i = 0; i + 1 < width; i += 2) {
+      const uint8_t* pair = src + 2 * i;
+      y[i] = pair[luma];
+      y[i + 1] = pair[luma + 2];
+      u[i / 2] = pair[chroma];
+      v[i / 2] = pair[chroma + 2];
+    }
+  }
+
+  static void splitChromaC(const uint8_t* src, uint8_t* u, uint8_t* v, int count) {
+    for (int i = 0; i < count; ++i) {
+      u[i] = src[2 * i];
+      v[i] = src[2 * i + 1];
+    }
+  }
+
+  static void averageC(const uint8_t* a, const uint8_t* b, uint8_t* out, int count) {
+    for (int i = 0; i < count; ++i) {
+      out[i] = static_cast<uint8_t>((a[i] + b[i] + 1) >> 1);
+    }
+  }
+
+  static inline int scaled(int sample, int coefficient) {
+    return (sample * 64 * coefficient) >> 16;
+  }
+
+  static inline uint8_t pixel(int value) {
+    return static_cast<uint8_t>(std::clamp((value + 4) >> 3, 0, 255));
+  }
+
+  static void toRgbaC(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* rgba, int width,
+                      const YuvCoefficients& k, bool bgra) {
+    int red = bgra ? 2 : 0;
+    int blue = bgra ? 0 : 2;
+    for (int i = 0; i < width; ++i) {
+      int cb = u[i / 2] - 128;
+      int cr = v[i / 2] - 128;
+      int luma = scaled(y[i] - k.yOffset, k.y);
+      uint8_t* out = rgba + 4 * i;
+      out[red] = pixel(luma + scaled(cr, k.vr));
+      out[1] = pixel(luma - (scaled(cb, k.ug) + scaled(cr, k.vg)));
+      out[blue] = pixel(luma + scaled(cb, k.ub));
+      out[3] = 255;
+    }
+  }
+
+  static constexpr RowOps ScalarRows = { splitPackedC, splitChromaC, averageC, toRgbaC };
+
+#if defined(PIXEL_KERNELS_X86)
+
+  // SSE4.1, 16 pixels at a time
+
+  TARGET_SSE41 static void splitPackedSse41(const uint8_t* src, uint8_t* y, uint8_t* u, uint8_t* v,
+                                            int width, bool uyvy) {
+    // Luma to the low half, four U and four V to the high half
+    const __m128i gather = uyvy
+      ? _mm_setr_epi8(1, 3, 5, 7, 9, 11, 13, 15, 0, 4, 8, 12, 2, 6, 10, 14)
+      : _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 5, 9, 13, 3, 7, 11, 15);
+    const __m128i chroma = _mm_setr_epi8(0, 1, 2, 3, 8, 9, 10, 11, 4, 5, 6, 7, 12, 13, 14, 15);
+    int i = 0;
+    for (; i + 16 <= width; i += 16) {
+      __m128i a = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * i)), gather);
+      __m128i b = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * i + 16)), gather);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(y + i), _mm_unpacklo_epi64(a, b));
+      __m128i uv = _mm_shuffle_epi8(_mm_unpackhi_epi64(a, b), chroma);
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(u + i / 2), uv);
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(v + i / 2), _mm_srli_si128(uv, 8));
+    }
+    splitPackedC(src + 2 * i, y + i, u + i / 2, v + i / 2, width - i, uyvy);
+  }
+
+  TARGET_SSE41 static void splitChromaSse41(const uint8_t* src, uint8_t* u, uint8_t* v, int count) {
+    const __m128i deinterleave = _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15);
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+      __m128i a = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * i)), deinterleave);
+      __m128i b = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 2 * i + 16)), deinterleave);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(u + i), _mm_unpacklo_epi64(a, b));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(v + i), _mm_unpackhi_epi64(a, b));
+    }
+    splitChromaC(src + 2 * i, u + i, v + i, count - i);
+  }
+
+  TARGET_SSE41 static void averageSse41(const uint8_t* a, const uint8_t* b, uint8_t* out, int count) {
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+      __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+      __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_avg_epu8(x, y));
+    }
+    averageC(a + i, b + i, out + i, count - i);
+  }
+
+  // (luma + chroma + 4) >> 3 of 8 pixels
+  TARGET_SSE41 static inline __m128i channelSse41(__m128i luma, __m128i chroma) {
+    return _mm_srai_epi16(_mm_adds_epi16(_mm_adds_epi16(luma, chroma), _mm_set1_epi16(4)), 3);
+  }
+
+  TARGET_SSE41 static void toRgbaSse41(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* rgba,
+                                       int width, const YuvCoefficients& k, bool bgra) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alpha = _mm_set1_epi8(-1);
+    const __m128i yOffset = _mm_set1_epi16(k.yOffset);
+    const __m128i chromaOffset = _mm_set1_epi16(128);
+    const __m128i cy = _mm_set1_epi16(k.y);
+    const __m128i cvr = _mm_set1_epi16(k.vr);
+    const __m128i cug = _mm_set1_epi16(k.ug);
+    const __m128i cvg = _mm_set1_epi16(k.vg);
+    const __m128i cub = _mm_set1_epi16(k.ub);
+    int i = 0;
+    for (; i + 16 <= width; i += 16) {
+      __m128i cb = _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(u + i / 2)));
+      __m128i cr = _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(v + i / 2)));
+      cb = _mm_slli_epi16(_mm_sub_epi16(cb, chromaOffset), 6);
+      cr = _mm_slli_epi16(_mm_sub_epi16(cr, chromaOffset), 6);
+      __m128i red = _mm_mulhi_epi16(cr, cvr);
+      __m128i green = _mm_add_epi16(_mm_mulhi_epi16(cb, cug), _mm_mulhi_epi16(cr, cvg));
+      __m128i blue = _mm_mulhi_epi16(cb, cub);
+
+      __m128i luma = _mm_loadu_si128(reinterpret_cast<const __m128i*>(y + i));
+      __m128i luma0 = _mm_slli_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(luma, zero), yOffset), 6);
+      __m128i luma1 = _mm_slli_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(luma, zero), yOffset), 6);
+      luma0 = _mm_mulhi_epi16(luma0, cy);
+      luma1 = _mm_mulhi_epi16(luma1, cy);
+
+      // Each chroma sample covers two pixels
+      __m128i r = _mm_packus_epi16(channelSse41(luma0, _mm_unpacklo_epi16(red, red)),
+                                   channelSse41(luma1, _mm_unpackhi_epi16(red, red)));
+      __m128i g = _mm_packus_epi16(channelSse41(luma0, _mm_sub_epi16(zero, _mm_unpacklo_epi16(green, green))),
+                                   channelSse41(luma1, _mm_sub_epi16(zero, _mm_unpackhi_epi16(green, green))));
+      __m128i b = _mm_packus_epi16(channelSse41(luma0, _mm_unpacklo_epi16(blue, blue)),
+                                   channelSse41(luma1, _mm_unpackhi_epi16(blue, blue)));
+      __m128i first = bgra ? b : r;
+      __m128i third = bgra ? r : b;
+
+      __m128i rgLow = _mm_unpacklo_epi8(first, g);
+      __m128i rgHigh = _mm_unpackhi_epi8(first, g);
+      __m128i baLow = _mm_unpacklo_epi8(third, alpha);
+      __m128i baHigh = _mm_unpackhi_epi8(third, alpha);
+      __m128i* out = reinterpret_cast<__m128i*>(rgba + 4 * i);
+      _mm_storeu_si128(out, _mm_unpacklo_epi16(rgLow, baLow));
+      _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(rgLow, baLow));
+      _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(rgHigh, baHigh));
+      _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(rgHigh, baHigh));
+    }
+    toRgbaC(y + i, u + i / 2, v + i / 2, rgba + 4 * i, width - i, k, bgra);
+  }
+
+  static constexpr RowOps Sse41Rows = { splitPackedSse41, splitChromaSse41, averageSse41, toRgbaSse41 };
+
+  // AVX2, 32 pixels at a time. Shuffles and packs work within 128 bit
+  // lanes, so the results are put back in order with permutes.
+
+  TARGET_AVX2 static void splitPackedAvx2(const uint8_t* src, uint8_t* y, uint8_t* u, uint8_t* v,
+                                          int width, bool uyvy) {
+    const __m256i gather = _mm256_broadcastsi128_si256(uyvy
+      ? _mm_setr_epi8(1, 3, 5, 7, 9, 11, 13, 15, 0, 4, 8, 12, 2, 6, 10, 14)
+      : _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 5, 9, 13, 3, 7, 11, 15));
+    const __m256i chroma = _mm256_broadcastsi128_si256(
+      _mm_setr_epi8(0, 1, 2, 3, 8, 9, 10, 11, 4, 5, 6, 7, 12, 13, 14, 15));
+    const __m256i chromaOrder = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    int i = 0;
+    for (; i + 32 <= width; i += 32) {
+      __m256i a = _mm256_shuffle_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 2 * i)), gather);
+      __m256i b = _mm256_shuffle_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 2 * i + 32)), gather);
+      __m256i luma = _mm256_permute4x64_epi64(_mm256_unpacklo_epi64(a, b), 0xD8);
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(y + i), luma);
+      __m256i uv = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(_mm256_unpackhi_epi64(a, b), chroma), chromaOrder);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(u + i / 2), _mm256_castsi256_si128(uv));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(v + i / 2), _mm256_extracti128_si256(uv, 1));
+    }
+    splitPackedC(src + 2 * i, y + i, u + i / 2, v + i / 2, width - i, uyvy);
+  }
+
+  TARGET_AVX2 static void splitChromaAvx2(const uint8_t* src, uint8_t* u, uint8_t* v, int count) {
+    const __m256i deinterleave = _mm256_broadcastsi128_si256(
+      _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15));
+    int i = 0;
+    for (; i + 32 <= count; i += 32) {
+      __m256i a = _mm256_shuffle_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 2 * i)), deinterleave);
+      __m256i b = _mm256_shuffle_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + 2 * i + 32)), deinterleave);
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(u + i),
+                          _mm256_permute4x64_epi64(_mm256_unpacklo_epi64(a, b), 0xD8));
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(v + i),
+                          _mm256_permute4x64_epi64(_mm256_unpackhi_epi64(a, b), 0xD8));
+    }
+    splitChromaC(src + 2 * i, u + i, v + i, count - i);
+  }
+
+  TARGET_AVX2 static void averageAvx2(const uint8_t* a, const uint8_t* b, uint8_t* out, int count) {
+    int i = 0;
+    for (; i + 32 <= count; i += 32) {
+      __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+      __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_avg_epu8(x, y));
+    }
+    averageC(a + i, b + i, out + i, count - i);
+  }
+
+  TARGET_AVX2 static inline __m256i channelAvx2(__m256i luma, __m256i chroma) {
+    return _mm256_srai_epi16(_mm256_adds_epi16(_mm256_adds_epi16(luma, chroma), _mm256_set1_epi16(4)), 3);
+  }
+
+  // Chroma of 16 samples for pixels 0 - 15 (low) and 16 - 31 (high)
+  TARGET_AVX2 static inline void duplicateAvx2(__m256i chroma, __m256i& low, __m256i& high) {
+    __m256i a = _mm256_unpacklo_epi16(chroma, chroma);
+    __m256i b = _mm256_unpackhi_epi16(chroma, chroma);
+    low = _mm256_permute2x128_si256(a, b, 0x20);
+    high = _mm256_permute2x128_si256(a, b, 0x31);
+  }
+
+  TARGET_AVX2 static void toRgbaAvx2(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* rgba,
+                                     int width, const YuvCoefficients& k, bool bgra) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i alpha = _mm256_set1_epi8(-1);
+    const __m256i yOffset = _mm256_set1_epi16(k.yOffset);
+    const __m256i chromaOffset = _mm256_set1_epi16(128);
+    const __m256i cy = _mm256_set1_epi16(k.y);
+    const __m256i cvr = _mm256_set1_epi16(k.vr);
+    const __m256i cug = _mm256_set1_epi16(k.ug);
+    const __m256i cvg = _mm256_set1_epi16(k.vg);
+    const __m256i cub = _mm256_set1_epi16(k.ub);
+    int i = 0;
+    for (; i + 32 <= width; i += 32) {
+      __m256i cb = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(u + i / 2)));
+      __m256i cr = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(v + i / 2)));
+      cb = _mm256_slli_epi16(_mm256_sub_epi16(cb, chromaOffset), 6);
+      cr = _mm256_slli_epi16(_mm256_sub_epi16(cr, chromaOffset), 6);
+      __m256i red0, red1, green0, green1, blue0, blue1;
+      duplicateAvx2(_mm256_mulhi_epi16(cr, cvr), red0, red1);
+      duplicateAvx2(_mm256_sub_epi16(zero, _mm256_add_epi16(_mm256_mulhi_epi16(cb, cug), _mm256_mulhi_epi16(cr, cvg))),
+                    green0, green1);
+      duplicateAvx2(_mm256_mulhi_epi16(cb, cub), blue0, blue1);
+
+      __m256i luma = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(y + i));
+      __m256i luma0 = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(luma));
+      __m256i luma1 = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(luma, 1));
+      luma0 = _mm256_mulhi_epi16(_mm256_slli_epi16(_mm256_sub_epi16(luma0, yOffset), 6), cy);
+      luma1 = _mm256_mulhi_epi16(_mm256_slli_epi16(_mm256_sub_epi16(luma1, yOffset), 6), cy);
+
+      // 8 byte groups end up as pixels 0 - 7, 16 - 23, 8 - 15, 24 - 31
+      __m256i r = _mm256_packus_epi16(channelAvx2(luma0, red0), channelAvx2(luma1, red1));
+      __m256i g = _mm256_packus_epi16(channelAvx2(luma0, green0), channelAvx2(luma1, green1));
+      __m256i b = _mm256_packus_epi16(channelAvx2(luma0, blue0), channelAvx2(luma1, blue1));
+      __m256i first = bgra ? b : r;
+      __m256i third = bgra ? r : b;
+
+      // Lanes hold pixels 0 - 7 and 8 - 15 (low) or 16 - 23 and 24 - 31 (high)
+      __m256i rgLow = _mm256_unpacklo_epi8(first, g);
+      __m256i rgHigh = _mm256_unpackhi_epi8(first, g);
+      __m256i baLow = _mm256_unpacklo_epi8(third, alpha);
+      __m256i baHigh = _mm256_unpackhi_epi8(third, alpha);
+      __m256i p0 = _mm256_unpacklo_epi16(rgLow, baLow);
+      __m256i p1 = _mm256_unpackhi_epi16(rgLow, baLow);
+      __m256i p2 = _mm256_unpacklo_epi16(rgHigh, baHigh);
+      __m256i p3 = _mm256_unpackhi_epi16(rgHigh, baHigh);
+      __m256i* out = reinterpret_cast<__m256i*>(rgba + 4 * i);
+      _mm256_storeu_si256(out, _mm256_permute2x128_si256(p0, p1, 0x20));
+      _mm256_storeu_si256(out + 1, _mm256_permute2x128_si256(p0, p1, 0x31));
+      _mm256_storeu_si256(out + 2, _mm256_permute2x128_si256(p2, p3, 0x20));
+      _mm256_storeu_si256(out + 3, _mm256_permute2x128_si256(p2, p3, 0x31));
+    }
+    toRgbaC(y + i, u + i / 2, v + i / 2, rgba + 4 * i, width - i, k, bgra);
+  }
+
+  static constexpr RowOps Avx2Rows = { splitPackedAvx2, splitChromaAvx2, averageAvx2, toRgbaAvx2 };
+
+#elif defined(PIXEL_KERNELS_NEON)
+
+  // NEON, 16 pixels at a time. Structure loads and stores do the
+  // (de)interleaving.
+
+  static void splitPackedNeon(const uint8_t* src, uint8_t* y, uint8_t* u, uint8_t* v, int width, bool uyvy) {
+    int i = 0;
+    for (; i + 32 <= width; i += 32) {
+      uint8x16x4_t pairs = vld4q_u8(src + 2 * i);
+      uint8x16x2_t luma;
+      if (uyvy) {
+        luma.val[0] = pairs.val[1];
+        luma.val[1] = pairs.val[3];
+        vst1q_u8(u + i / 2, pairs.val[0]);
+        vst1q_u8(v + i / 2, pairs.val[2]);
+      } else {
+        luma.val[0] = pairs.val[0];
+        luma.val[1] = pairs.val[2];
+        vst1q_u8(u + i / 2, pairs.val[1]);
+        vst1q_u8(v + i / 2, pairs.val[3]);
+      }
+      vst2q_u8(y + i, luma);
+    }
+    splitPackedC(src + 2 * i, y + i, u + i / 2, v + i / 2, width - i, uyvy);
+  }
+
+  static void splitChromaNeon(const uint8_t* src, uint8_t* u, uint8_t* v, int count) {
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+      uint8x16x2_t uv = vld2q_u8(src + 2 * i);
+      vst1q_u8(u + i, uv.val[0]);
+      vst1q_u8(v + i, uv.val[1]);
+    }
+    splitChromaC(src + 2 * i, u + i, v + i, count - i);
+  }
+
+  static void averageNeon(const uint8_t* a, const uint8_t* b, uint8_t* out, int count) {
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+      vst1q_u8(out + i, vrhaddq_u8(vld1q_u8(a + i), vld1q_u8(b + i)));
+    }
+    averageC(a + i, b + i, out + i, count - i);
+  }
+
+  // Doubling multiply of samples scaled by 32 equals the high multiply of
+  // samples scaled by 64 used elsewhere
+  static inline int16x8_t scaledNeon(uint8x8_t samples, int16x8_t offset, int16x8_t coefficient) {
+    int16x8_t centered = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(samples)), offset);
+    return vqdmulhq_s16(vshlq_n_s16(centered, 5), coefficient);
+  }
+
+  static inline uint8x8_t channelNeon(int16x8_t luma, int16x8_t chroma) {
+    return vqmovun_s16(vrshrq_n_s16(vqaddq_s16(luma, chroma), 3));
+  }
+
+  static void toRgbaNeon(const uint8_t* y, const uint8_t* u, const uint8_t* v, uint8_t* rgba, int width,
+                         const YuvCoefficients& k, bool bgra) {
+    const int16x8_t zero = vdupq_n_s16(0);
+    const int16x8_t yOffset = vdupq_n_s16(k.yOffset);
+    const int16x8_t chromaOffset = vdupq_n_s16(128);
+    int i = 0;
+    for (; i + 16 <= width; i += 16) {
+      uint8x8_t cb = vld1_u8(u + i / 2);
+      uint8x8_t cr = vld1_u8(v + i / 2);
+      // Each chroma sample covers two pixels
+      int16x8_t redSum = scaledNeon(cr, chromaOffset, vdupq_n_s16(k.vr));
+      int16x8x2_t red = vzipq_s16(redSum, redSum);
+      int16x8_t greenSum = vaddq_s16(scaledNeon(cb, chromaOffset, vdupq_n_s16(k.ug)),
+                                     scaledNeon(cr, chromaOffset, vdupq_n_s16(k.vg)));
+      greenSum = vsubq_s16(zero, greenSum);
+      int16x8x2_t green = vzipq_s16(greenSum, greenSum);
+      int16x8_t blueSum = scaledNeon(cb, chromaOffset, vdupq_n_s16(k.ub));
+      int16x8x2_t blue = vzipq_s16(blueSum, blueSum);
+
+      uint8x16_t luma = vld1q_u8(y + i);
+      int16x8_t luma0 = scaledNeon(vget_low_u8(luma), yOffset, vdupq_n_s16(k.y));
+      int16x8_t luma1 = scaledNeon(vget_high_u8(luma), yOffset, vdupq_n_s16(k.y));
+
+      uint8x16_t r = vcombine_u8(channelNeon(luma0, red.val[0]), channelNeon(luma1, red.val[1]));
+      uint8x16_t g = vcombine_u8(channelNeon(luma0, green.val[0]), channelNeon(luma1, green.val[1]));
+      uint8x16_t b = vcombine_u8(channelNeon(luma0, blue.val[0]), channelNeon(luma1, blue.val[1]));
+      uint8x16x4_t pixels;
+      pixels.val[0] = bgra ? b : r;
+      pixels.val[1] = g;
+      pixels.val[2] = bgra ? r : b;
+      pixels.val[3] = vdupq_n_u8(255);
+      vst4q_u8(rgba + 4 * i, pixels);
+    }
+    toRgbaC(y + i, u + i / 2, v + i / 2, rgba + 4 * i, width - i, k, bgra);
+  }
+
+  static constexpr RowOps NeonRows = { splitPackedNeon, splitChromaNeon, averageNeon, toRgbaNeon };
+
+#endif
+
+  enum class Layout {
+    Uyvy,
+    Yuyv,
+    Nv12,
+    Planar422
+  };
+
+  static inline uint8_t* planeRow(const AVFrame* frame, int plane, int row) {
+    return frame->data[plane] + static_cast<ptrdiff_t>(row) * frame->linesize[plane];
+  }
+
+  template <const RowOps& Rows, Layout layout>
+  static void toI420(const AVFrame* input, AVFrame* output, int firstRow, int lastRow) {
+    int width = input->width;
+    int chromaWidth = width / 2;
+    std::vector<uint8_t> scratch;
+    if constexpr (layout == Layout::Uyvy || layout == Layout::Yuyv) {
+      scratch.resize(static_cast<size_t>(chromaWidth) * 4);
+    } else {
+      for (int row = firstRow; row < lastRow; ++row) {
+        std::memcpy(planeRow(output, 0, row), planeRow(input, 0, row), static_cast<size_t>(width));
+      }
+    }
+    for (int row = firstRow; row < lastRow; row += 2) {
+      // Last row of an odd height is paired with itself
+      int next = row + 1 < lastRow ? row + 1 : row;
+      uint8_t* u = planeRow(output, 1, row / 2);
+      uint8_t* v = planeRow(output, 2, row / 2);
+      if constexpr (layout == Layout::Uyvy || layout == Layout::Yuyv) {
+        uint8_t* u0 = scratch.data();
+        uint8_t* v0 = u0 + chromaWidth;
+        uint8_t* u1 = v0 + chromaWidth;
+        uint8_t* v1 = u1 + chromaWidth;
+        bool uyvy = layout == Layout::Uyvy;
+        Rows.splitPacked(planeRow(input, 0, row), planeRow(output, 0, row), u0, v0, width, uyvy);
+        Rows.splitPacked(planeRow(input, 0, next), planeRow(output, 0, next), u1, v1, width, uyvy);
+        Rows.average(u0, u1, u, chromaWidth);
+        Rows.average(v0, v1, v, chromaWidth);
+      } else if constexpr (layout == Layout::Nv12) {
+        Rows.splitChroma(planeRow(input, 1, row / 2), u, v, chromaWidth);
+      } else {
+        Rows.average(planeRow(input, 1, row), planeRow(input, 1, next), u, chromaWidth);
+        Rows.average(planeRow(input, 2, row), planeRow(input, 2, next), v, chromaWidth);
+      }
+    }
+  }
+
+  template <const RowOps& Rows, Layout layout, bool fullRange, bool bgra>
+  static void toRgba(const AVFrame* input, AVFrame* output, int firstRow, int lastRow) {
+    const YuvCoefficients& k = fullRange ? FullRange : LimitedRange;
+    int width = input->width;
+    int chromaWidth = width / 2;
+    std::vector<uint8_t> scratch;
+    if constexpr (layout != Layout::Planar422) {
+      scratch.resize(static_cast<size_t>(width + chromaWidth * 2));
+    }
+    for (int row = firstRow; row < lastRow; ++row) {
+      const uint8_t* y = planeRow(input, 0, row);
+      const uint8_t* u = nullptr;
+      const uint8_t* v = nullptr;
+      if constexpr (layout == Layout::Uyvy || layout == Layout::Yuyv) {
+        uint8_t* luma = scratch.data();
+        Rows.splitPacked(y, luma, luma + width, luma + width + chromaWidth, width, layout == Layout::Uyvy);
+        y = luma;
+        u = luma + width;
+        v = u + chromaWidth;
+      } else if constexpr (layout == Layout::Nv12) {
+        u = scratch.data();
+        v = u + chromaWidth;
+        // Chroma row is shared by two rows
+        if (row == firstRow || row % 2 == 0) {
+          Rows.splitChroma(planeRow(input, 1, row / 2), scratch.data(), scratch.data() + chromaWidth, chromaWidth);
+        }
+      } else {
+        u = planeRow(input, 1, row);
+        v = planeRow(input, 2, row);
+      }
+      Rows.toRgba(y, u, v, planeRow(output, 0, row), width, k, bgra);
+    }
+  }
+
+  template <const RowOps& Rows, Layout layout, bool fullRange>
+  static PixelKernel outputKernel(AVPixelFormat output) {
+    switch (output) {
+      case AV_PIX_FMT_YUV420P:
+        return fullRange ? nullptr : toI420<Rows, layout>;
+      case AV_PIX_FMT_YUVJ420P:
+        return fullRange ? toI420<Rows, layout> : nullptr;
+      case AV_PIX_FMT_RGBA:
+        return toRgba<Rows, layout, fullRange, false>;
+      case AV_PIX_FMT_BGRA:
+        return toRgba<Rows, layout, fullRange, true>;
+      default:
+        return nullptr;
+    }
+  }
+
+  template <const RowOps& Rows>
+  static PixelKernel kernel(AVPixelFormat input, AVPixelFormat output) {
+    switch (input) {
+      case AV_PIX_FMT_UYVY422:
+        return outputKernel<Rows, Layout::Uyvy, false>(output);
+      case AV_PIX_FMT_YUYV422:
+        return outputKernel<Rows, Layout::Yuyv, false>(output);
+      case AV_PIX_FMT_NV12:
+        return outputKernel<Rows, Layout::Nv12, false>(output);
+      case AV_PIX_FMT_YUV422P:
+        return outputKernel<Rows, Layout::Planar422, false>(output);
+      case AV_PIX_FMT_YUVJ422P:
+        return outputKernel<Rows, Layout::Planar422, true>(output);
+      default:
+        return nullptr;
+    }
+  }
+
+  SimdLevel simdLevel() {
+    static const SimdLevel level = supportedSimdLevels().front();
+    return level;
+  }
+
+  std::vector<SimdLevel> supportedSimdLevels() {
+    std::vector<SimdLevel> levels;
+    // FFmpeg also checks that the OS saves the AVX registers
+    int flags = av_get_cpu_flags();
+#if defined(PIXEL_KERNELS_X86)
+    if (flags & AV_CPU_FLAG_AVX2) {
+      levels.push_back(SimdLevel::Avx2);
+    }
+    if (flags & AV_CPU_FLAG_SSE4) {
+      levels.push_back(SimdLevel::Sse41);
+    }
+#elif defined(PIXEL_KERNELS_NEON)
+    if (flags & AV_CPU_FLAG_NEON) {
+      levels.push_back(SimdLevel::Neon);
+    }
+#else
+    (void)flags;
+#endif
+    levels.push_back(SimdLevel::None);
+    return levels;
+  }
+
+  const char* simdLevelName(SimdLevel level) {
+    switch (level) {
+      case SimdLevel::Sse41:
+        return "sse4.1";
+      case SimdLevel::Avx2:
+        return "avx2";
+      case SimdLevel::Neon:
+        return "neon";
+      default:
+        return "c";
+    }
+  }
+
+  PixelKernel findPixelKernel(AVPixelFormat input, AVPixelFormat output) {
+    return findPixelKernel(input, output, simdLevel());
+  }
+
+  PixelKernel findPixelKernel(AVPixelFormat input, AVPixelFormat output, SimdLevel level) {
+    switch (level) {
+#if defined(PIXEL_KERNELS_X86)
+      case SimdLevel::Avx2:
+        return kernel<Avx2Rows>(input, output);
+      case SimdLevel::Sse41:
+        return kernel<Sse41Rows>(input, output);
+#elif defined(PIXEL_KERNELS_NEON)
+      case SimdLevel::Neon:
+        return kernel<NeonRows>(input, output);
+#endif
+      default:
+        return kernel<ScalarRows>(input, output);
+    }
+  }
+
+} // namespace ffmpeg
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <vector>
+
+#include "ffmpeg_include.hpp"
+
+namespace ffmpeg {
+
+  enum class SimdLevel {
+    None,
+    Sse41,
+    Avx2,
+    Neon
+  };
+
+  // Converts rows [firstRow, lastRow) of input to output of the same size.
+  // firstRow needs to be even, lastRow even or the height of the frame.
+  typedef void (*PixelKernel)(const AVFrame* input, AVFrame* output, int firstRow, int lastRow);
+
+  /**
+   *  Hand written conversions for the formats cameras deliver, used instead
+   *  of swscale when the size stays the same:
+   *
+   *    uyvy422, yuyv422, nv12, yuv422p -> yuv420p, rgba, bgra
+   *    yuvj422p                        -> yuvj420p, rgba, bgra
+   *
+   *  Chroma of two rows is averaged when going from 4:2:2 to 4:2:0 and RGB
+   *  uses BT.601 coefficients (full range for yuvj). Every instruction set
+   *  gives exactly the same result as the plain C version.
+   */
+
+  // Best instruction set of this CPU, checked once
+  SimdLevel simdLevel();
+  // Instruction sets this CPU can run, best first, always ends with None
+  std::vector<SimdLevel> supportedSimdLevels();
+  const char* simdLevelName(SimdLevel level);
+
+  // nullptr when the conversion has no kernel. Width of the frames needs to
+  // be even.
+  PixelKernel findPixelKernel(AVPixelFormat input, AVPixelFormat output);
+  PixelKernel findPixelKernel(AVPixelFormat input, AVPixelFormat output, SimdLevel level);
+
+} // namespace ffmpeg
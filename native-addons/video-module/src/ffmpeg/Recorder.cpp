@@ -0,0 +1,492 @@
+#include "Recorder.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+#include "ffmpeg.hpp"
+
+namespace ffmpeg {
+
+  static constexpr double LatencySmoothing = 0.1;
+  // Frames whose packets haven't come out of the encoder yet. Only bounds
+  // the bookkeeping if encoder swallows frames, real encoders hold far less.
+  static constexpr size_t MaxEncodingFrames = 256;
+
+  void Recorder::StageCounters::done(Clock::time_point queued) {
+    double ms = std::chrono::duration<double, std::milli>(Clock::now() - queued).count();
+    uint64_t count = processed.fetch_add(1, std::memory_order_relaxed);
+    // Only the stage thread writes, plain load + store is enough
+    double previous = latency.load(std::memory_order_relaxed);
+    latency.store(count == 0 ? ms : previous + LatencySmoothing * (ms - previous),
+                  std::memory_order_relaxed);
+  }
+
+  std::variant<std::shared_ptr<Recorder>, std::string> Recorder::start(
+      std::unique_ptr<OutputContext> output,
+      std::unique_ptr<StreamContext>& input) {
+    bool copy = output->options.copy;
+    std::optional<std::string> error = copy ? initCopyOutput(output, input) : initOutput(output, input);
+    if (error) {
+      stopOutput(output);
+      return error.value();
+    }
+    AVRational inputTimeBase = input->formatContext->streams[input->streamIndex]->time_base;
+    auto recorder = std::make_shared<Recorder>(std::move(output), inputTimeBase);
+    if (!copy) {
+      recorder->m_convertThread = std::thread(&Recorder::convertLoop, recorder.get());
+      recorder->m_encodeThread = std::thread(&Recorder::encodeLoop, recorder.get());
+    }
+    recorder->m_muxThread = std::thread(&Recorder::muxLoop, recorder.get());
+    return recorder;
+  }
+
+  Recorder::Recorder(std::unique_ptr<OutputContext> output, AVRational inputTimeBase)
+    : m_output(std::move(output)),
+      m_copy(m_output->options.copy),
+      m_inputTimeBase(inputTimeBase),
+      m_preRollLength(av_rescale_q(std::llround(m_output->options.preRoll * 1000),
+                                   AVRational{1, 1000}, m_output->timeBase)),
+      m_timestamped(false),
+      m_firstTimestamp(0),
+      m_lastPts(0),
+      m_offset(0),
+      m_forceKeyFrame(false),
+      m_segment(0),
+      m_fileStarted(false),
+      m_fileStart(0),
+      m_rollRequested(false),
+      m_frames(m_output->options.queueSize, m_output->options.overflow),
+      m_converted(m_output->options.queueSize, utils::OverflowPolicy::Block),
+      // Capture feeds packets directly when copying
+      m_packets(m_output->options.queueSize,
+                m_copy ? m_output->options.overflow : utils::OverflowPolicy::Block),
+      // Converted frames either wait in the queue or are held by encoder
+      m_freeFrames(m_output->options.queueSize + 2, utils::OverflowPolicy::Drop),
+      m_stopped(false)
+  {
+  }
+
+  Recorder::~Recorder() {
+    stop();
+  }
+
+  bool Recorder::copiesPackets() const {
+    return m_copy;
+  }
+
+  bool Recorder::preRolls() const {
+    return m_preRollLength > 0;
+  }
+
+  bool Recorder::push(const AVPacket& packet) {
+    AVPacket* reference = av_packet_clone(&packet);
+    if (!reference) {
+      return false;
+    }
+    Clock::time_point now = Clock::now();
+    if (!m_packets.push(QueuedPacket{reference, now, now, nullptr})) {
+      av_packet_free(&reference);
+      return false;
+    }
+    return true;
+  }
+
+  bool Recorder::push(const AVFrame* frame) {
+    AVFrame* reference = av_frame_clone(frame);
+    if (!reference) {
+      return false;
+    }
+    if (!m_frames.push(QueuedFrame{reference, Clock::now()})) {
+      av_frame_free(&reference);
+      return false;
+    }
+    return true;
+  }
+
+  void Recorder::open(const RecordingOptions& options, OpenCallback callback) {
+    auto control = std::make_shared<Control>();
+    control->open = options;
+    control->callback = callback;
+    Clock::time_point now = Clock::now();
+    // In order with the packets, but never dropped
+    if (!m_packets.pushAlways(QueuedPacket{nullptr, now, now, control}) && callback) {
+      callback(std::make_optional("Recorder has been stopped"));
+    }
+  }
+
+  void Recorder::close() {
+    Clock::time_point now = Clock::now();
+    m_packets.pushAlways(QueuedPacket{nullptr, now, now, std::make_shared<Control>()});
+  }
+
+  void Recorder::stop() {
+    std::lock_guard<std::mutex> lock(m_stopMutex);
+    if (m_stopped) {
+      return;
+    }
+    m_stopped = true;
+    // Each stage closes the queue after it once its input has been drained
+    m_frames.close();
+    if (m_copy) {
+      m_packets.close();
+    }
+    if (m_convertThread.joinable()) {
+      m_convertThread.join();
+    }
+    if (m_encodeThread.joinable()) {
+      m_encodeThread.join();
+    }
+    if (m_muxThread.joinable()) {
+      m_muxThread.join();
+    }
+    while (std::optional<AVFrame*> frame = m_freeFrames.tryPop()) {
+      av_frame_free(&frame.value());
+    }
+    stopOutput(m_output);
+  }
+
+  std::vector<RecorderStageStats> Recorder::stats() const {
+    auto stage = [](const std::string& name, const auto& queue, const StageCounters& counters) {
+      return RecorderStageStats{
+        name,
+        queue.size(),
+        queue.capacity(),
+        queue.dropped() + counters.dropped.load(std::memory_order_relaxed),
+        counters.processed.load(std::memory_order_relaxed),
+        counters.latency.load(std::memory_order_relaxed)
+      };
+    };
+    if (m_copy) {
+      return { stage("mux", m_packets, m_muxCounters) };
+    }
+    return {
+      stage("convert", m_frames, m_convertCounters),
+      stage("encode", m_converted, m_encodeCounters),
+      stage("mux", m_packets, m_muxCounters)
+    };
+  }
+
+  void Recorder::convertLoop() {
+    while (std::optional<QueuedFrame> item = m_frames.pop()) {
+      AVFrame* frame = item->frame;
+      if (!timestamp(frame, item->queued)) {
+        av_frame_free(&frame);
+        m_convertCounters.dropped.fetch_add(1, std::memory_order_relaxed);
+        continue;
+      }
+      if (m_output->convertFrames) {
+        AVFrame* target = convertTarget();
+        int err = target ? convertFrame(*m_output, frame, target) : outOfMemoryError();
+        if (err < 0) {
+          av_frame_free(&frame);
+          recycle(target);
+          fail("convert", err);
+          continue;
+        }
+        target->pts = frame->pts;
+        av_frame_free(&frame);
+        frame = target;
+      }
+      m_convertCounters.done(item->queued);
+      if (!m_converted.push(QueuedFrame{frame, item->queued})) {
+        recycle(frame);
+      }
+    }
+    m_converted.close();
+  }
+
+  bool Recorder::timestamp(AVFrame* frame, Clock::time_point captured) {
+    AVRational timeBase = m_output->codecContext->time_base;
+    int64_t frameDuration = std::max<int64_t>(
+      av_rescale_q(1, av_inv_q(m_output->codecContext->framerate), timeBase), 1);
+    int64_t pts = 0;
+    if (m_output->options.timestamps == TimestampSource::Wallclock) {
+      if (!m_timestamped) {
+        m_firstCapture = captured;
+      }
+      auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(captured - m_firstCapture);
+      pts = av_rescale_q(elapsed.count(), AVRational{1, 1000000}, timeBase);
+    } else if (hasTimestamp(frame->best_effort_timestamp)) {
+      if (!m_timestamped) {
+        m_firstTimestamp = frame->best_effort_timestamp;
+      }
+      pts = av_rescale_q(frame->best_effort_timestamp - m_firstTimestamp, m_inputTimeBase, timeBase) + m_offset;
+    } else if (m_timestamped) {
+      pts = m_lastPts + frameDuration;
+    }
+    if (m_timestamped && pts <= m_lastPts) {
+      if (m_lastPts - pts < frameDuration) {
+        // Faster than output rate or duplicate
+        return false;
+      }
+      // Input jumped back (looping file), continue right after last frame
+      m_offset += m_lastPts + frameDuration - pts;
+      pts = m_lastPts + frameDuration;
+    }
+    m_timestamped = true;
+    m_lastPts = pts;
+    frame->pts = pts;
+    return true;
+  }
+
+  bool Recorder::copyTimestamps(AVPacket* packet) {
+    if (!m_timestamped && !(packet->flags & AV_PKT_FLAG_KEY)) {
+      // Nothing can be decoded before the first key frame
+      return false;
+    }
+    int64_t dts = hasTimestamp(packet->dts) ? packet->dts : packet->pts;
+    int64_t duration = std::max<int64_t>(packet->duration, 1);
+    if (!m_timestamped) {
+      m_firstTimestamp = hasTimestamp(dts) ? dts : 0;
+    }
+    int64_t shift = m_offset - m_firstTimestamp;
+    int64_t outputDts = hasTimestamp(dts) ? dts + shift : m_lastPts + duration;
+    if (m_timestamped && outputDts <= m_lastPts) {
+      // Input jumped back (looping file), continue right after last packet
+      m_offset += m_lastPts + duration - outputDts;
+      shift = m_offset - m_firstTimestamp;
+      outputDts = m_lastPts + duration;
+    }
+    packet->pts = hasTimestamp(packet->pts) ? packet->pts + shift : outputDts;
+    packet->dts = outputDts;
+    m_timestamped = true;
+    m_lastPts = outputDts;
+    return true;
+  }
+
+  void Recorder::encodeLoop() {
+    while (std::optional<QueuedFrame> item = m_converted.pop()) {
+      encode(item->frame, item->queued);
+      recycle(item->frame);
+    }
+    // Flush the frames encoder is still holding on to
+    encode(nullptr, Clock::now());
+    m_packets.close();
+  }
+
+  void Recorder::encode(AVFrame* frame, Clock::time_point queued) {
+    if (frame) {
+      // Picture types of the source mean nothing to the encoder
+      frame->pict_type = m_forceKeyFrame.exchange(false) ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+      m_encoding.emplace_back(frame->pts, queued);
+      if (m_encoding.size() > MaxEncodingFrames) {
+        m_encoding.pop_front();
+      }
+    }
+    std::vector<AVPacket*> packets;
+    int err = encodeFrame(*m_output, frame, packets);
+    if (err < 0) {
+      fail("encode", err);
+    }
+    if (frame) {
+      m_encodeCounters.done(queued);
+    }
+    Clock::time_point now = Clock::now();
+    for (AVPacket* packet : packets) {
+      // Encoder delays and reorders, find the frame the packet came from
+      Clock::time_point captured = queued;
+      auto it = std::find_if(m_encoding.begin(), m_encoding.end(),
+                             [packet](const auto& entry) { return entry.first == packet->pts; });
+      if (it != m_encoding.end()) {
+        captured = it->second;
+        m_encoding.erase(it);
+      }
+      if (!m_packets.push(QueuedPacket{packet, now, captured, nullptr})) {
+        av_packet_free(&packet);
+      }
+    }
+  }
+
+  void Recorder::muxLoop() {
+    while (std::optional<QueuedPacket> item = m_packets.pop()) {
+      if (item->control) {
+        control(*item->control, item->queued);
+        continue;
+      }
+      AVPacket* packet = item->packet;
+      if (m_copy && !copyTimestamps(packet)) {
+        av_packet_free(&packet);
+        m_muxCounters.dropped.fetch_add(1, std::memory_order_relaxed);
+        continue;
+      }
+      if (m_closeAfter && item->captured > m_closeAfter.value()) {
+        closeFile();
+      }
+      if (m_file) {
+        writeToFile(packet);
+      }
+      m_muxCounters.done(item->queued);
+      keepForPreRoll(packet);
+    }
+    closeFile();
+    for (AVPacket* packet : m_preRoll) {
+      av_packet_free(&packet);
+    }
+    m_preRoll.clear();
+  }
+
+  void Recorder::control(const Control& control, Clock::time_point queued) {
+    if (!control.open) {
+      if (m_file) {
+        m_closeAfter = queued;
+      }
+      return;
+    }
+    closeFile();
+    m_file = control.open;
+    m_fileCallback = control.callback;
+    m_segment = 0;
+    m_fileStarted = false;
+    m_rollRequested = false;
+    std::optional<std::string> error = openSegment();
+    if (error) {
+      m_file.reset();
+    }
+    if (m_fileCallback) {
+      m_fileCallback(error);
+    }
+    if (!m_file) {
+      return;
+    }
+    for (AVPacket* packet : m_preRoll) {
+      writeToFile(packet);
+    }
+    if (!m_fileStarted && !m_copy) {
+      // Don't wait for the encoder to get to the next key frame on its own
+      m_forceKeyFrame = true;
+    }
+  }
+
+  void Recorder::writeToFile(const AVPacket* packet) {
+    bool keyFrame = packet->flags & AV_PKT_FLAG_KEY;
+    if (!m_fileStarted) {
+      if (!keyFrame) {
+        return;
+      }
+      m_fileStarted = true;
+      m_fileStart = packet->dts;
+    } else if (segmentFull(packet)) {
+      if (!keyFrame) {
+        if (!m_copy && !m_rollRequested) {
+          m_forceKeyFrame = true;
+          m_rollRequested = true;
+        }
+        // Segment runs over until the next key frame
+      } else {
+        closeOutputFile(*m_output);
+        ++m_segment;
+        m_rollRequested = false;
+        std::optional<std::string> error = openSegment();
+        if (error) {
+          std::cout << "Recording " << m_file->outputPath << " failed to start segment "
+                    << m_segment << ": " << error.value() << std::endl;
+          if (m_fileCallback) {
+            m_fileCallback(error);
+          }
+          closeFile();
+          return;
+        }
+        m_fileStart = packet->dts;
+      }
+    }
+    AVPacket* copy = av_packet_clone(packet);
+    if (!copy) {
+      fail("mux", outOfMemoryError());
+      return;
+    }
+    // Each file starts from zero
+    if (hasTimestamp(copy->pts)) {
+      copy->pts -= m_fileStart;
+    }
+    if (hasTimestamp(copy->dts)) {
+      copy->dts -= m_fileStart;
+    }
+    int err = writePacket(*m_output, copy);
+    av_packet_free(&copy);
+    if (err < 0) {
+      fail("mux", err);
+    }
+  }
+
+  bool Recorder::segmentFull(const AVPacket* packet) const {
+    const RecordingOptions& file = m_file.value();
+    if (file.segmentDuration > 0 &&
+        av_compare_ts(packet->dts - m_fileStart, m_output->timeBase,
+                      std::llround(file.segmentDuration * 1000), AVRational{1, 1000}) >= 0) {
+      return true;
+    }
+    AVIOContext* io = m_output->formatContext->pb;
+    return file.segmentSize > 0 && io && avio_tell(io) >= file.segmentSize;
+  }
+
+  std::optional<std::string> Recorder::openSegment() {
+    const RecordingOptions& file = m_file.value();
+    bool segmented = file.segmentDuration > 0 || file.segmentSize > 0;
+    return openOutputFile(*m_output, segmented ? numberedPath(file.outputPath, m_segment) : file.outputPath,
+                          file);
+  }
+
+  void Recorder::closeFile() {
+    closeOutputFile(*m_output);
+    m_file.reset();
+    m_fileCallback = nullptr;
+    m_closeAfter.reset();
+  }
+
+  void Recorder::keepForPreRoll(AVPacket* packet) {
+    if (m_preRollLength <= 0) {
+      av_packet_free(&packet);
+      return;
+    }
+    m_preRoll.push_back(packet);
+    int64_t cut = packet->dts - m_preRollLength;
+    auto release = [this](size_t count) {
+      for (size_t i = 0; i < count; ++i) {
+        av_packet_free(&m_preRoll.front());
+        m_preRoll.pop_front();
+      }
+    };
+    // Packets before the first key frame can't be decoded anyway
+    size_t undecodable = 0;
+    while (undecodable < m_preRoll.size() && m_preRoll[undecodable]->dts <= cut &&
+           !(m_preRoll[undecodable]->flags & AV_PKT_FLAG_KEY)) {
+      ++undecodable;
+    }
+    release(undecodable);
+    // Start from the last key frame that still covers the whole pre-roll
+    size_t keyFrame = 0;
+    for (size_t i = 0; i < m_preRoll.size() && m_preRoll[i]->dts <= cut; ++i) {
+      if (m_preRoll[i]->flags & AV_PKT_FLAG_KEY) {
+        keyFrame = i;
+      }
+    }
+    release(keyFrame);
+  }
+
+  AVFrame* Recorder::convertTarget() {
+    std::optional<AVFrame*> frame = m_freeFrames.tryPop();
+    return frame ? frame.value() : av_frame_alloc();
+  }
+
+  void Recorder::recycle(AVFrame* frame) {
+    if (!frame) {
+      return;
+    }
+    if (!m_output->convertFrames) {
+      // Reference to the captured frame
+      av_frame_free(&frame);
+      return;
+    }
+    // Keep the buffers, convertFrame makes them writable before reuse
+    if (!m_freeFrames.push(frame)) {
+      av_frame_free(&frame);
+    }
+  }
+
+  void Recorder::fail(const std::string& stage, int error) {
+    std::cout << "Recording " << m_output->outputPath << " failed to " << stage
+              << " frame: " << errorString(error) << std::endl;
+  }
+
+} // namespace ffmpeg
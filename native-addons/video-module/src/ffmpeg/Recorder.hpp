@@ -0,0 +1,192 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "../utils/BoundedQueue.hpp"
+#include "OutputContext.hpp"
+#include "StreamContext.hpp"
+
+namespace ffmpeg {
+
+  struct RecorderStageStats {
+    std::string name;
+    size_t queueDepth;
+    size_t queueCapacity;
+    uint64_t dropped;
+    uint64_t processed;
+    // Moving average of time from entering the queue until done, in ms
+    double latency;
+  };
+
+  /**
+   *  Records captured frames on threads of its own.
+   *
+   *  capture -> [frames] -> convert -> [converted] -> encode -> [packets] -> mux
+   *
+   *  Capture thread only takes a new reference to the decoded frame and
+   *  queues it, so slow encoders or disks never stall decoding. The frame
+   *  queue follows the overflow policy of the recording options, the queues
+   *  after it always block: once a frame has been accepted it ends up in the
+   *  output.
+   *
+   *  Frames keep their capture timing: timestamps of the input (or the time
+   *  of capture) are rescaled to the time base of the encoder. Frames
+   *  arriving faster than a fixed rate encoder can take are dropped.
+   *
+   *  Converted frames are recycled so the buffers of the encoder pixel
+   *  format are allocated only a couple of times per recording.
+   *
+   *  When copying, packets read from the input skip decoding and encoding:
+   *
+   *  capture -> [packets] -> mux
+   *
+   *  Packet timestamps are only shifted to start from zero.
+   *
+   *  Encoder runs as long as the recorder, files come and go: mux thread
+   *  writes the packets to the file that is open, if any, and keeps the last
+   *  preRoll seconds of them in memory. Opening a file writes the pre-roll
+   *  first. Each file (and segment) starts from a key frame.
+   */
+  class Recorder {
+  public:
+    // Called from the mux thread with the error, if any, once file is open
+    typedef std::function<void(std::optional<std::string>)> OpenCallback;
+
+    static std::variant<std::shared_ptr<Recorder>, std::string> start(
+      std::unique_ptr<OutputContext> output,
+      std::unique_ptr<StreamContext>& input);
+
+    Recorder(std::unique_ptr<OutputContext> output, AVRational inputTimeBase);
+    ~Recorder();
+
+    // Called from the capture thread. Returns false if frame was dropped.
+    bool push(const AVFrame* frame);
+    // Same for the packets when copying
+    bool push(const AVPacket& packet);
+
+    // Starts writing to options.outputPath, pre-roll included. Only path,
+    // format options and segmenting are taken from the options.
+    void open(const RecordingOptions& options, OpenCallback callback);
+    // Finishes the file after the frames captured before this call. Encoder
+    // and pre-roll keep running.
+    void close();
+    // Finishes queued frames, flushes the encoder and closes the file
+    void stop();
+
+    bool copiesPackets() const;
+    bool preRolls() const;
+    std::vector<RecorderStageStats> stats() const;
+
+  private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct QueuedFrame {
+      AVFrame* frame;
+      Clock::time_point queued;
+    };
+
+    // Opens a file when options are given, closes the current one otherwise
+    struct Control {
+      std::optional<RecordingOptions> open;
+      OpenCallback callback;
+    };
+
+    struct QueuedPacket {
+      // Either packet or control is set
+      AVPacket* packet;
+      Clock::time_point queued;
+      // Capture time of the frame of the packet
+      Clock::time_point captured;
+      std::shared_ptr<Control> control;
+    };
+
+    struct StageCounters {
+      std::atomic<uint64_t> processed{0};
+      // Frames the stage chose not to pass on
+      std::atomic<uint64_t> dropped{0};
+      std::atomic<double> latency{0.0};
+
+      void done(Clock::time_point queued);
+    };
+
+    void convertLoop();
+    void encodeLoop();
+    void muxLoop();
+
+    bool timestamp(AVFrame* frame, Clock::time_point captured);
+    bool copyTimestamps(AVPacket* packet);
+    void encode(AVFrame* frame, Clock::time_point queued);
+    AVFrame* convertTarget();
+    void recycle(AVFrame* frame);
+    void fail(const std::string& stage, int error);
+
+    // Mux thread
+    void control(const Control& control, Clock::time_point queued);
+    void writeToFile(const AVPacket* packet);
+    bool segmentFull(const AVPacket* packet) const;
+    std::optional<std::string> openSegment();
+    void closeFile();
+    void keepForPreRoll(AVPacket* packet);
+
+    // Released when stopped
+    std::unique_ptr<OutputContext> m_output;
+    const bool m_copy;
+    const AVRational m_inputTimeBase;
+    // Pre-roll length in the time base of the packets
+    const int64_t m_preRollLength;
+
+    // Timestamp state, only used by the convert thread (mux when copying)
+    bool m_timestamped;
+    int64_t m_firstTimestamp;
+    Clock::time_point m_firstCapture;
+    int64_t m_lastPts;
+    // Added to timestamps after the input has jumped backwards
+    int64_t m_offset;
+
+    // Capture times of frames in the encoder by pts, only used by the
+    // encode thread
+    std::deque<std::pair<int64_t, Clock::time_point>> m_encoding;
+    // Next frame is encoded as a key frame
+    std::atomic<bool> m_forceKeyFrame;
+
+    // File state, only used by the mux thread
+    std::deque<AVPacket*> m_preRoll;
+    std::optional<RecordingOptions> m_file;
+    OpenCallback m_fileCallback;
+    int m_segment;
+    bool m_fileStarted;
+    int64_t m_fileStart;
+    // Segment is full, key frame has been asked for
+    bool m_rollRequested;
+    // Frames captured after this are left out of the file
+    std::optional<Clock::time_point> m_closeAfter;
+
+    utils::BoundedQueue<QueuedFrame> m_frames;
+    utils::BoundedQueue<QueuedFrame> m_converted;
+    utils::BoundedQueue<QueuedPacket> m_packets;
+    utils::BoundedQueue<AVFrame*> m_freeFrames;
+
+    StageCounters m_convertCounters;
+    StageCounters m_encodeCounters;
+    StageCounters m_muxCounters;
+
+    std::thread m_convertThread;
+    std::thread m_encodeThread;
+    std::thread m_muxThread;
+
+    std::mutex m_stopMutex;
+    bool m_stopped;
+  };
+
+} // namespace ffmpeg
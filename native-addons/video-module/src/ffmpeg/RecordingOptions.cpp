@@ -0,0 +1,28 @@
+#include "RecordingOptions.hpp"
+
+namespace ffmpeg {
+
+  AVDictionary* RecordingOptions::codecDictionary() const {
+    AVDictionary* options = nullptr;
+    for (const auto& option : codecOptions) {
+      av_dict_set(&options, option.first.c_str(), option.second.c_str(), 0);
+    }
+    // Explicit fields win over the generic options
+    if (crf >= 0) {
+      av_dict_set_int(&options, "crf", crf, 0);
+    }
+    if (!preset.empty()) {
+      av_dict_set(&options, "preset", preset.c_str(), 0);
+    }
+    return options;
+  }
+
+  AVDictionary* RecordingOptions::formatDictionary() const {
+    AVDictionary* options = nullptr;
+    for (const auto& option : formatOptions) {
+      av_dict_set(&options, option.first.c_str(), option.second.c_str(), 0);
+    }
+    return options;
+  }
+
+} // namespace ffmpeg
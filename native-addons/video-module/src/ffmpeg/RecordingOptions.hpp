@@ -0,0 +1,66 @@
+#pragma once
+
+#include "../utils/BoundedQueue.hpp"
+#include "ffmpeg_include.hpp"
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+namespace ffmpeg {
+
+  enum class TimestampSource {
+    // Timestamps of the decoded frames
+    Input,
+    // Time the frames were captured
+    Wallclock
+  };
+
+  struct RecordingOptions {
+    static constexpr size_t DefaultQueueSize = 8;
+    static constexpr int DefaultGop = 12;
+
+    // Encoder options and AVOptions of the encoder (crf and preset included)
+    AVDictionary* codecDictionary() const;
+    // AVOptions of the muxer
+    AVDictionary* formatDictionary() const;
+
+    std::string outputPath = "";
+    // Container format name (e.g. "mp4"), empty guesses from outputPath
+    std::string format = "";
+    // Captured frames that can wait for the recorder
+    size_t queueSize = DefaultQueueSize;
+    // What capture does when the recorder has fallen queueSize frames behind
+    utils::OverflowPolicy overflow = utils::OverflowPolicy::Drop;
+    TimestampSource timestamps = TimestampSource::Input;
+    // Store the compressed packets of the input instead of re-encoding.
+    // Encoder options have no effect.
+    bool copy = false;
+    // Start a new file every segmentDuration seconds or segmentSize bytes,
+    // at the next key frame. 0 disables.
+    double segmentDuration = 0;
+    int64_t segmentSize = 0;
+    // Seconds of packets kept in memory before recording starts
+    double preRoll = 0;
+
+    // Encoder name (e.g. "libx264"), empty uses the default of the container
+    std::string codec = "";
+    // Target bitrate in bits/s, 0 leaves it to the encoder
+    int64_t bitrate = 0;
+    // Constant rate factor, -1 leaves it to the encoder
+    int crf = -1;
+    // Encoder speed preset (e.g. "veryfast"), empty leaves it to the encoder
+    std::string preset = "";
+    // Frames between key frames
+    int gop = DefaultGop;
+    // Pixel format name (e.g. "yuv420p"), empty picks one the encoder supports
+    std::string pixelFormat = "";
+    // Encoder threads, 0 lets FFmpeg pick based on the core count
+    int threads = 0;
+    // Nominal frame rate of the output, 0 takes it from the input
+    int fps = 0;
+    std::map<std::string, std::string> codecOptions;
+    std::map<std::string, std::string> formatOptions;
+  };
+
+} // namespace ffmpeg
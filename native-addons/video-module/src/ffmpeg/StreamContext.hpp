@@ -2,11 +2,47 @@
 
 #include "ffmpeg_include.hpp"
 
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
 #include <string>
 
+#include "InputWatchdog.hpp"
+
 namespace ffmpeg {
 
+  // What the stream reads from. Capture devices are looked up by name with
+  // the platform capture format, anything else is handed to FFmpeg as is.
+  struct InputSource {
+    // Device name or file / URL / lavfi graph
+    std::string url = "";
+    // Forced input format (e.g. "lavfi"), empty lets FFmpeg probe
+    std::string format = "";
+    bool device = true;
+    // Deliver frames at the rate of their timestamps instead of as fast as
+    // they can be decoded. Only affects non-device inputs.
+    bool realtime = true;
+    // Start over from the beginning at the end of input
+    bool loop = false;
+  };
+
+  // Time spent in each phase of start
+  struct StartTimings {
+    // Closing the input of the previous context
+    std::chrono::steady_clock::duration close{0};
+    std::chrono::steady_clock::duration open{0};
+    std::chrono::steady_clock::duration streamInfo{0};
+    std::chrono::steady_clock::duration decoder{0};
+    // Parameters of a mode opened before were used instead of probing
+    bool streamInfoSkipped = false;
+    // Decoder of the previous context was kept
+    bool decoderReused = false;
+  };
+
   struct StreamContext {
+    typedef std::function<void(const AVPacket&)> PacketCallback;
+
     AVFormatContext* formatContext = nullptr;
     AVCodec* codec = nullptr;
     AVCodecContext* codecContext = nullptr;
@@ -15,10 +51,33 @@ namespace ffmpeg {
     int streamIndex = -1;
     bool open = false;
 
+    // Decoder threads asked for, reusing the decoder needs the same
+    int threads = 0;
+    int threadType = 0;
+    StartTimings timings;
+
     int frameNumber = 0;
     bool profile = false;
     std::string name = "";
 
+    InputSource source;
+    // Decoder has been sent the end of input and returns buffered frames
+    bool draining = false;
+    // Timestamp and time of the first frame for pacing realtime input
+    bool paced = false;
+    int64_t firstPts = 0;
+    std::chrono::steady_clock::time_point firstPtsTime;
+    // Called on the reader thread with every video packet before it is
+    // queued for decoding, see setPacketCallback
+    PacketCallback onPacket;
+    std::mutex onPacketMutex;
+    // Stalls and timeouts of reading, may be null
+    std::shared_ptr<InputWatchdog> watchdog;
+    // Time of the last packet and expected time between them (0 if the
+    // input doesn't tell) for waiting on input that doesn't block
+    std::chrono::steady_clock::time_point lastPacketTime;
+    std::chrono::steady_clock::duration frameInterval{0};
+
     ~StreamContext();
   };
 
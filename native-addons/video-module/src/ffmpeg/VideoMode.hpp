@@ -6,12 +6,39 @@
 
 namespace ffmpeg {
 
+  // Pixel format and size of the frames delivered by the stream
+  struct FrameConversion {
+    // AV_PIX_FMT_NONE keeps the format of the input
+    AVPixelFormat pixelFormat = AV_PIX_FMT_NONE;
+    // 0 keeps the size of the input (or the aspect ratio if the other one is
+    // given)
+    int width = 0;
+    int height = 0;
+    // SWS_* scaling algorithm
+    int algorithm = SWS_BILINEAR;
+    // Conversion threads, 0 picks based on the core count
+    int threads = 0;
+
+    inline bool enabled() const {
+      return pixelFormat != AV_PIX_FMT_NONE || width > 0 || height > 0;
+    }
+  };
+
   struct VideoMode {
   public:
-    VideoMode(): w(0), h(0), fps(0), profile(false) {}
+    static constexpr int DefaultThreads = 4;
+    static constexpr int DefaultStallTimeout = 500;
+    static constexpr int DefaultInputTimeout = 10000;
+    static constexpr int DefaultPacketQueueDepth = 4;
+
+    VideoMode(): w(0), h(0), fps(0), profile(false), queueDepth(0), framePoolSize(0),
+                 threads(DefaultThreads), threadType(0), stallTimeout(DefaultStallTimeout),
+                 inputTimeout(DefaultInputTimeout), packetQueueDepth(DefaultPacketQueueDepth) {}
 
     VideoMode(int x, int y, int _fps, bool _profile)
-      : w(x), h(y), fps(_fps), profile(_profile) {}
+      : w(x), h(y), fps(_fps), profile(_profile), queueDepth(0), framePoolSize(0),
+        threads(DefaultThreads), threadType(0), stallTimeout(DefaultStallTimeout),
+        inputTimeout(DefaultInputTimeout), packetQueueDepth(DefaultPacketQueueDepth) {}
 
     inline bool isValid() const {
       return w * h * fps > 0;
@@ -26,6 +53,23 @@ namespace ffmpeg {
     int fps;
     // Stats are recorded always, if this is true they are also saved to file
     bool profile;
+    // Amount of frames that can wait for JS callbacks, 0 keeps the current
+    int queueDepth;
+    // Amount of recycled frames kept by the stream, 0 keeps the current
+    int framePoolSize;
+    // Decoder threads, 0 lets FFmpeg pick based on the core count
+    int threads;
+    // FF_THREAD_FRAME and/or FF_THREAD_SLICE, 0 keeps FFmpeg's default
+    int threadType;
+    // Milliseconds without a frame before the input counts as stalled and
+    // before the stream gives up, 0 disables
+    int stallTimeout;
+    int inputTimeout;
+    // Packets read ahead of the decoder, the oldest are dropped when it
+    // falls further behind
+    int packetQueueDepth;
+    // Decoded frames are delivered as they are unless enabled
+    FrameConversion conversion;
   };
 
 } //namespace ffmpeg
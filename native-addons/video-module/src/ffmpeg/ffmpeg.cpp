@@ -1,9 +1,15 @@
 #include "ffmpeg.hpp"
 
 #include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
+#include <map>
+#include <mutex>
 #include <set>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "../utils/PerfLogger.hpp"
@@ -213,19 +219,133 @@ namespace ffmpeg {
     return parseVideoModes(data);
   }
 
+  // Stream parameters and frame rate of device modes opened before, so
+  // opening the same mode again can skip avformat_find_stream_info
+  struct KnownStream {
+    std::shared_ptr<AVCodecParameters> parameters;
+    AVRational frameRate;
+  };
+  static std::mutex knownStreamsMutex;
+  static std::map<std::string, KnownStream> knownStreams;
+
+  static std::string knownStreamKey(const InputSource& source, const VideoMode& mode) {
+    if (!source.device || !mode.isValid()) {
+      return "";
+    }
+    return source.url + " " + std::to_string(mode.w) + "x" + std::to_string(mode.h) + "@" + std::to_string(mode.fps);
+  }
+
+  // Fills in the stream from a previous open of the mode if the header of
+  // the input agrees with it
+  static bool useKnownStream(const std::string& key, AVFormatContext* formatContext) {
+    if (key.empty() || formatContext->nb_streams != 1) {
+      return false;
+    }
+    std::lock_guard<std::mutex> lock(knownStreamsMutex);
+    auto it = knownStreams.find(key);
+    if (it == knownStreams.end()) {
+      return false;
+    }
+    AVStream* stream = formatContext->streams[0];
+    const AVCodecParameters* known = it->second.parameters.get();
+    if (stream->codecpar->codec_id != known->codec_id || stream->codecpar->width != known->width
+        || stream->codecpar->height != known->height) {
+      return false;
+    }
+    if (avcodec_parameters_copy(stream->codecpar, known) < 0) {
+      return false;
+    }
+    if (stream->avg_frame_rate.num == 0) {
+      stream->avg_frame_rate = it->second.frameRate;
+    }
+    return true;
+  }
+
+  static void addKnownStream(const std::string& key, AVFormatContext* formatContext, int streamIndex) {
+    if (key.empty()) {
+      return;
+    }
+    AVStream* stream = formatContext->streams[streamIndex];
+    std::shared_ptr<AVCodecParameters> parameters(avcodec_parameters_alloc(),
+                                                  [](AVCodecParameters* p) { avcodec_parameters_free(&p); });
+    if (!parameters || avcodec_parameters_copy(parameters.get(), stream->codecpar) < 0) {
+      return;
+    }
+    std::lock_guard<std::mutex> lock(knownStreamsMutex);
+    knownStreams[key] = KnownStream{parameters, av_guess_frame_rate(formatContext, stream, nullptr)};
+  }
+
+  static void freeCodecContext(AVCodecContext* codecContext) {
+    avcodec_free_context(&codecContext);
+  }
+
+  // Open decoder can't be changed, it is only reused for the same stream
+  // parameters. MJPEG tells its pixel format only once decoding.
+  static bool canReuseDecoder(const AVCodecContext* decoder, const AVCodec* codec,
+                              const AVCodecParameters* parameters) {
+    return decoder->codec_id == codec->id
+        && decoder->width == parameters->width
+        && decoder->height == parameters->height
+        && (parameters->format == AV_PIX_FMT_NONE || parameters->format == decoder->pix_fmt)
+        && decoder->extradata_size == parameters->extradata_size
+        && (parameters->extradata_size == 0
+            || std::memcmp(decoder->extradata, parameters->extradata,
+                           static_cast<size_t>(parameters->extradata_size)) == 0);
+  }
+
   std::unique_ptr<StreamContext>
-  start(const std::string& deviceName, VideoMode mode)
+  start(const InputSource& source, VideoMode mode, std::shared_ptr<InputWatchdog> watchdog,
+        std::unique_ptr<StreamContext> previous)
   {
+    auto phaseStart = std::chrono::steady_clock::now();
+    // Time since the previous phase ended
+    auto phase = [&phaseStart] {
+      auto now = std::chrono::steady_clock::now();
+      auto duration = now - phaseStart;
+      phaseStart = now;
+      return duration;
+    };
+
     std::unique_ptr<StreamContext> ctx = std::make_unique<StreamContext>();
+    std::unique_ptr<AVCodecContext, void (*)(AVCodecContext*)> previousDecoder(nullptr, freeCodecContext);
+    if (previous) {
+      if (previous->threads == mode.threads && previous->threadType == mode.threadType) {
+        previousDecoder.reset(previous->codecContext);
+        previous->codecContext = nullptr;
+      }
+      // Device needs to be let go before it can be opened again
+      previous.reset();
+      ctx->timings.close = phase();
+    }
     ctx->profile = mode.profile;
-    ctx->name = deviceName;
+    ctx->name = source.url;
+    ctx->source = source;
+    ctx->threads = mode.threads;
+    ctx->threadType = mode.threadType;
     ctx->formatContext = avformat_alloc_context();
+    ctx->watchdog = watchdog;
+    if (watchdog) {
+      // Reads block in the capture format or protocol, never with NONBLOCK
+      ctx->formatContext->interrupt_callback.callback = InputWatchdog::interruptCallback;
+      ctx->formatContext->interrupt_callback.opaque = watchdog.get();
+    }
 
-    AVInputFormat* iformat = getInputFormat();
-    std::string id = getFFmpegIdentifier(deviceName);
-
-    AVDictionary *options = mode.toOptions();
-    // pixelformat?
+    AVInputFormat* iformat = nullptr;
+    std::string id = source.url;
+    AVDictionary *options = nullptr;
+    if (source.device) {
+      iformat = getInputFormat();
+      id = getFFmpegIdentifier(source.url);
+      // pixelformat?
+      options = mode.toOptions();
+    } else if (!source.format.empty()) {
+      // Files and URLs are probed, generated input (lavfi) needs the format
+      iformat = av_find_input_format(source.format.c_str());
+      if (!iformat) {
+        std::cout << "Unknown input format " << source.format << std::endl;
+        return nullptr;
+      }
+    }
     int err = avformat_open_input(&ctx->formatContext, id.c_str(), iformat, &options);
     freeOptionsAfterUse(&options);
 
@@ -234,11 +354,18 @@ namespace ffmpeg {
       return nullptr;
     }
     ctx->open = true;
-    err = avformat_find_stream_info(ctx->formatContext, nullptr);
-    if (err < 0) {
-      std::cout << "Failed to find stream info" << std::endl;
-      return nullptr;
+    ctx->timings.open = phase();
+    // Probing decodes several frames, skipped for modes opened before
+    std::string knownKey = knownStreamKey(source, mode);
+    ctx->timings.streamInfoSkipped = useKnownStream(knownKey, ctx->formatContext);
+    if (!ctx->timings.streamInfoSkipped) {
+      err = avformat_find_stream_info(ctx->formatContext, nullptr);
+      if (err < 0) {
+        std::cout << "Failed to find stream info" << std::endl;
+        return nullptr;
+      }
     }
+    ctx->timings.streamInfo = phase();
 
     // Note now we are selecting codec automatically, see if it is worth
     // of manual fiddle
@@ -249,26 +376,50 @@ namespace ffmpeg {
       std::cout << "ERROR " << std::endl;
       return nullptr;
     }
-    ctx->codecContext = avcodec_alloc_context3(nullptr);
-    avcodec_parameters_to_context(
-      ctx->codecContext, ctx->formatContext->streams[ctx->streamIndex]->codecpar);
-    ctx->codecContext->codec_id = ctx->codec->id;
-    //ctx->codecContext->opaque = ctx.get(); TODO: is this needed
-    ctx->codecContext->thread_count = 4; // threads, could also try setting automatically
-
+    if (!ctx->timings.streamInfoSkipped) {
+      addKnownStream(knownKey, ctx->formatContext, ctx->streamIndex);
+    }
+    const AVCodecParameters* parameters = ctx->formatContext->streams[ctx->streamIndex]->codecpar;
+    if (previousDecoder && canReuseDecoder(previousDecoder.get(), ctx->codec, parameters)) {
+      ctx->codecContext = previousDecoder.release();
+      // Drops what was buffered for the previous mode
+      avcodec_flush_buffers(ctx->codecContext);
+      ctx->timings.decoderReused = true;
+    } else {
+      ctx->codecContext = avcodec_alloc_context3(nullptr);
+      avcodec_parameters_to_context(ctx->codecContext, parameters);
+      ctx->codecContext->codec_id = ctx->codec->id;
+      //ctx->codecContext->opaque = ctx.get(); TODO: is this needed
+      ctx->codecContext->thread_count = mode.threads; // 0 = automatic
+      if (mode.threadType != 0) {
+        ctx->codecContext->thread_type = mode.threadType;
+      }
 
-    // Open codecs
-    // video options for avcodec_open2 ??
-    err = avcodec_open2(ctx->codecContext, ctx->codec, &options);
-    freeOptionsAfterUse(&options);
-    if (err < 0) {
-      std::cout << "Couldn't open codec" << std::endl;
-      return nullptr;
+      // Open codecs
+      // video options for avcodec_open2 ??
+      err = avcodec_open2(ctx->codecContext, ctx->codec, &options);
+      freeOptionsAfterUse(&options);
+      if (err < 0) {
+        std::cout << "Couldn't open codec" << std::endl;
+        return nullptr;
+      }
     }
-    std::cout << "Opened stream " << deviceName << " with resolution "
+    ctx->timings.decoder = phase();
+    std::cout << "Opened stream " << source.url << " with resolution "
               << ctx->codecContext->width << "x" << ctx->codecContext->height
+              << ", " << ctx->codecContext->thread_count << " decoder threads ("
+              << threadTypeName(ctx->codecContext->active_thread_type) << ")"
               << std::endl;
     ctx->frame = av_frame_alloc();
+    AVRational rate = av_guess_frame_rate(ctx->formatContext, ctx->formatContext->streams[ctx->streamIndex], nullptr);
+    if (rate.num > 0 && rate.den > 0) {
+      ctx->frameInterval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(av_q2d(av_inv_q(rate))));
+    }
+    ctx->lastPacketTime = std::chrono::steady_clock::now();
+    if (watchdog) {
+      watchdog->begin();
+    }
     return ctx;
   }
 
@@ -288,6 +439,39 @@ namespace ffmpeg {
     return frame;
   }
 
+  std::string threadTypeName(int threadType) {
+    if (threadType & FF_THREAD_FRAME) {
+      return "frame";
+    } else if (threadType & FF_THREAD_SLICE) {
+      return "slice";
+    }
+    return "none";
+  }
+
+  std::string errorString(int errorCode) {
+    char buffer[AV_ERROR_MAX_STRING_SIZE] = {0};
+    av_strerror(errorCode, buffer, sizeof(buffer));
+    return buffer;
+  }
+
+  std::string numberedPath(const std::string& path, int number) {
+    if (path.find('%') != std::string::npos) {
+      char buffer[1024];
+      if (av_get_frame_filename2(buffer, sizeof(buffer), path.c_str(), number,
+                                 AV_FRAME_FILENAME_FLAGS_MULTIPLE) == 0) {
+        return buffer;
+      }
+    }
+    char suffix[16];
+    std::snprintf(suffix, sizeof(suffix), "-%03d", number);
+    size_t dot = path.find_last_of('.');
+    size_t separator = path.find_last_of("/\\");
+    if (dot == std::string::npos || (separator != std::string::npos && dot < separator)) {
+      return path + suffix;
+    }
+    return path.substr(0, dot) + suffix + path.substr(dot);
+  }
+
   void showFormats() {
     void *opaque = nullptr;
     while (const AVOutputFormat* format = av_muxer_iterate(&opaque)) {
@@ -300,62 +484,134 @@ namespace ffmpeg {
     }
   }
 
-  std::optional<std::string> initOutput(std::unique_ptr<OutputContext>& ctx, std::unique_ptr<StreamContext>& input) {
+  // Requested format if given, otherwise the old defaults unless the encoder
+  // can't take them
+  static AVPixelFormat outputPixelFormat(const OutputContext& ctx, AVPixelFormat inputFormat) {
+    const AVPixelFormat* supported = ctx.codec->pix_fmts;
+    auto isSupported = [supported](AVPixelFormat format) {
+      if (!supported) {
+        // Encoder doesn't tell, trust the caller
+        return true;
+      }
+      for (const AVPixelFormat* it = supported; *it != AV_PIX_FMT_NONE; ++it) {
+        if (*it == format) {
+          return true;
+        }
+      }
+      return false;
+    };
+    if (!ctx.options.pixelFormat.empty()) {
+      AVPixelFormat format = av_get_pix_fmt(ctx.options.pixelFormat.c_str());
+      return format != AV_PIX_FMT_NONE && isSupported(format) ? format : AV_PIX_FMT_NONE;
+    }
+    if (isSupported(AV_PIX_FMT_YUV420P)) {
+      return AV_PIX_FMT_YUV420P;
+    }
+    // Closest to the input to keep the conversion cheap
+    return avcodec_find_best_pix_fmt_of_list(supported, inputFormat, 0, nullptr);
+  }
 
-    avformat_alloc_output_context2(&ctx->formatContext, nullptr, nullptr, ctx->outputPath.c_str());
-    if (!ctx->formatContext) {
-      // Could not deduce output format from file extension -> mpeg
-      std::string format = ctx->isSnapshot ? "jpg" : "mpeg";
-      avformat_alloc_output_context2(&ctx->formatContext, nullptr, format.c_str(), ctx->outputPath.c_str());
+  static AVRational outputFrameRate(const RecordingOptions& options, const StreamContext& input) {
+    if (options.fps > 0) {
+      return AVRational{options.fps, 1};
     }
-    if (!ctx->formatContext) {
-      return std::make_optional("Couldn't allocate format context");
+    AVStream* stream = input.formatContext->streams[input.streamIndex];
+    if (stream->avg_frame_rate.num > 0 && stream->avg_frame_rate.den > 0) {
+      return stream->avg_frame_rate;
+    }
+    if (stream->r_frame_rate.num > 0 && stream->r_frame_rate.den > 0) {
+      return stream->r_frame_rate;
+    }
+    return AVRational{DefaultOutputFps, 1};
+  }
+
+  // Time base of the encoder. Frame timestamps are rescaled to it.
+  static AVRational outputTimeBase(const OutputContext& ctx, const StreamContext& input) {
+    if (ctx.codec->supported_framerates) {
+      return av_inv_q(ctx.codecContext->framerate);
+    }
+    AVRational timeBase = input.formatContext->streams[input.streamIndex]->time_base;
+    // Capture devices use microseconds which encoders with 16 bit time base
+    // fields (MPEG-4 part 2) refuse
+    if (ctx.options.timestamps == TimestampSource::Wallclock ||
+        timeBase.num <= 0 || timeBase.den > MaxOutputTimeBaseDen) {
+      return AVRational{1, MaxOutputTimeBaseDen};
+    }
+    return timeBase;
+  }
+
+  static AVOutputFormat* guessOutputFormat(const RecordingOptions& options, const char* fallback) {
+    if (!options.format.empty()) {
+      return av_guess_format(options.format.c_str(), nullptr, nullptr);
+    }
+    AVOutputFormat* format = av_guess_format(nullptr, options.outputPath.c_str(), nullptr);
+    return format ? format : av_guess_format(fallback, nullptr, nullptr);
+  }
+
+  std::optional<std::string> initOutput(std::unique_ptr<OutputContext>& ctx, std::unique_ptr<StreamContext>& input) {
+    const RecordingOptions& recording = ctx->options;
+    // Could not deduce output format from file extension -> mpeg
+    ctx->outputFormat = guessOutputFormat(recording, "mpeg");
+    if (!ctx->outputFormat) {
+      return "Unknown output format " + recording.format;
     }
 
-    ctx->outputFormat = ctx->formatContext->oformat;
     // Assume video
-    ctx->codec = avcodec_find_encoder(ctx->formatContext->oformat->video_codec);
+    if (!recording.codec.empty()) {
+      ctx->codec = avcodec_find_encoder_by_name(recording.codec.c_str());
+      if (!ctx->codec) {
+        return "Unknown encoder " + recording.codec;
+      }
+      if (ctx->codec->type != AVMEDIA_TYPE_VIDEO) {
+        return recording.codec + " is not a video encoder";
+      }
+    } else {
+      ctx->codec = avcodec_find_encoder(ctx->outputFormat->video_codec);
+    }
     if (!(ctx->codec)) {
       return std::make_optional("Couldn't find encoder codec");
     }
-
-    ctx->stream = avformat_new_stream(ctx->formatContext, ctx->codec /* nullptr */);
-    if (!ctx->stream) {
-      return std::make_optional("Couldn't create stream");
+    AVPixelFormat pixelFormat = outputPixelFormat(*ctx, input->codecContext->pix_fmt);
+    if (pixelFormat == AV_PIX_FMT_NONE) {
+      return "Unknown or unsupported pixel format " + recording.pixelFormat;
     }
-    ctx->stream->id = static_cast<int>(ctx->formatContext->nb_streams - 1);
 
     ctx->codecContext = avcodec_alloc_context3(ctx->codec);
     if (!ctx->codecContext) {
       return std::make_optional("Couldn't allocate codec context");
     }
-    ctx->codecContext->codec_id = ctx->formatContext->oformat->video_codec;
-    ctx->codecContext->bit_rate = input->codecContext->bit_rate;
+    ctx->codecContext->codec_id = ctx->codec->id;
+    ctx->codecContext->bit_rate = recording.bitrate > 0 ? recording.bitrate : input->codecContext->bit_rate;
     ctx->codecContext->width = input->codecContext->width;
     ctx->codecContext->height = input->codecContext->height;
-    // TODO: FPS from input?
-    ctx->codecContext->time_base = ctx->stream->time_base = AVRational{1, 25 /* fps */};
-    ctx->codecContext->gop_size = 12; // intra frame at most every 12 frames
-    ctx->codecContext->pix_fmt = ctx->isSnapshot ? AV_PIX_FMT_YUVJ420P : AV_PIX_FMT_YUV420P;
-    if (ctx->formatContext->oformat->flags & AVFMT_GLOBALHEADER) {
+    AVRational frameRate = outputFrameRate(recording, *input);
+    if (ctx->codec->supported_framerates) {
+      // Encoder only takes some rates (MPEG-1/2), timestamps are rounded to frames
+      frameRate = ctx->codec->supported_framerates[
+        av_find_nearest_q_idx(frameRate, ctx->codec->supported_framerates)];
+    }
+    ctx->codecContext->framerate = frameRate;
+    ctx->codecContext->time_base = ctx->timeBase = outputTimeBase(*ctx, *input);
+    ctx->codecContext->gop_size = recording.gop; // intra frame at most every gop frames
+    ctx->codecContext->thread_count = recording.threads;
+    ctx->codecContext->pix_fmt = pixelFormat;
+    if (ctx->outputFormat->flags & AVFMT_GLOBALHEADER) {
       ctx->codecContext->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
     }
 
-    AVDictionary* options = nullptr;
-    // TODO: optionsiin directly from JS-options?
+    AVDictionary* options = recording.codecDictionary();
     int ret = avcodec_open2(ctx->codecContext, ctx->codec, &options);
-    av_dict_free(&options);
+    freeOptionsAfterUse(&options);
     if (ret < 0) {
-      return std::make_optional("Couldn't open codec");
-    }
-    // Need frame if input format is not yuv420p
-    if (input->codecContext->pix_fmt != ctx->codecContext->pix_fmt) {
-      ctx->encodingFrames = true;
-      ctx->frame = initFrame(ctx->codecContext->pix_fmt, ctx->codecContext->width,
-                             ctx->codecContext->height);
-      if (!ctx->frame) {
-        return std::make_optional("Couldn't init frame");
-      }
+      return "Couldn't open codec: " + errorString(ret);
+    }
+    // Need conversion if input format is not yuv420p
+    ctx->convertFrames = input->codecContext->pix_fmt != ctx->codecContext->pix_fmt;
+    ctx->kernel = nullptr;
+    if (ctx->convertFrames && input->codecContext->width % 2 == 0) {
+      ctx->kernel = findPixelKernel(input->codecContext->pix_fmt, ctx->codecContext->pix_fmt);
+    }
+    if (ctx->convertFrames && !ctx->kernel) {
       ctx->swsContext = sws_getContext(
         input->codecContext->width,
         input->codecContext->height,
@@ -368,117 +624,257 @@ namespace ffmpeg {
       if (!ctx->swsContext) {
         return std::make_optional("Couldn't allocate pix_fmt transform");
       }
-    } else {
-      ctx->encodingFrames = false;
-    };
-    ret = avcodec_parameters_from_context(ctx->stream->codecpar, ctx->codecContext);
+    }
+    ctx->parameters = avcodec_parameters_alloc();
+    ret = ctx->parameters ? avcodec_parameters_from_context(ctx->parameters, ctx->codecContext) : -1;
     if (ret < 0) {
       return std::make_optional("Couldn't copy parameters to codec");
     }
-    av_dump_format(ctx->formatContext, 0, ctx->outputPath.c_str(), 1);
-    if (!(ctx->outputFormat->flags & AVFMT_NOFILE)) {
-      ret = avio_open(&ctx->formatContext->pb, ctx->outputPath.c_str(), AVIO_FLAG_WRITE);
+    return std::optional<std::string>();
+  }
+
+  std::optional<std::string> initCopyOutput(std::unique_ptr<OutputContext>& ctx, std::unique_ptr<StreamContext>& input) {
+    // Matroska can hold about any codec the camera delivers
+    ctx->outputFormat = guessOutputFormat(ctx->options, "matroska");
+    if (!ctx->outputFormat) {
+      return "Unknown output format " + ctx->options.format;
+    }
+
+    AVStream* inputStream = input->formatContext->streams[input->streamIndex];
+    AVCodecID codecId = inputStream->codecpar->codec_id;
+    if (avformat_query_codec(ctx->outputFormat, codecId, FF_COMPLIANCE_NORMAL) == 0) {
+      return std::string(ctx->outputFormat->name) + " can't hold " + avcodec_get_name(codecId) +
+        " without re-encoding";
+    }
+    ctx->parameters = avcodec_parameters_alloc();
+    int ret = ctx->parameters ? avcodec_parameters_copy(ctx->parameters, inputStream->codecpar) : -1;
+    if (ret < 0) {
+      return std::make_optional("Couldn't copy parameters to codec");
+    }
+    // Tag of the input container may mean something else in the output
+    ctx->parameters->codec_tag = 0;
+    ctx->timeBase = inputStream->time_base;
+    return std::optional<std::string>();
+  }
+
+  std::optional<std::string> openOutputFile(OutputContext& ctx, const std::string& path,
+                                            const RecordingOptions& file) {
+    avformat_alloc_output_context2(&ctx.formatContext, ctx.outputFormat, nullptr, path.c_str());
+    if (!ctx.formatContext) {
+      return std::make_optional("Couldn't allocate format context");
+    }
+    ctx.stream = avformat_new_stream(ctx.formatContext, nullptr);
+    int ret = ctx.stream ? avcodec_parameters_copy(ctx.stream->codecpar, ctx.parameters) : -1;
+    if (ret < 0) {
+      closeOutputFile(ctx);
+      return std::make_optional("Couldn't create stream");
+    }
+    ctx.stream->id = static_cast<int>(ctx.formatContext->nb_streams - 1);
+    // Only a hint, muxer picks the final one when writing the header
+    ctx.stream->time_base = ctx.timeBase;
+    av_dump_format(ctx.formatContext, 0, path.c_str(), 1);
+    if (!(ctx.outputFormat->flags & AVFMT_NOFILE)) {
+      ret = avio_open(&ctx.formatContext->pb, path.c_str(), AVIO_FLAG_WRITE);
       if (ret < 0) {
-        return std::make_optional("Couldn't open output");
+        closeOutputFile(ctx);
+        return "Couldn't open output " + path;
       }
     }
-    // TODO: Options again?
-    options = nullptr;
-    ret = avformat_write_header(ctx->formatContext, &options);
-    av_dict_free(&options);
+    AVDictionary* options = file.formatDictionary();
+    ret = avformat_write_header(ctx.formatContext, &options);
+    freeOptionsAfterUse(&options);
     if (ret < 0) {
-      return std::make_optional("Couldn't write header");
+      closeOutputFile(ctx);
+      return "Couldn't write header: " + errorString(ret);
     }
+    ctx.headerWritten = true;
     return std::optional<std::string>();
   }
 
-  void currentFrameForOutput(
-    std::unique_ptr<StreamContext>& input,
-    std::unique_ptr<OutputContext>& output)
-  {
-    if (!output->encodingFrames) {
-      av_frame_ref(output->frame, input->frame);
-    }  else {
-      // Need to do conversion
-      int ok = av_frame_make_writable(output->frame);
-      if (ok < 0) {
-        // Fail
-      }
-      sws_scale(output->swsContext, reinterpret_cast<const uint8_t * const *>(input->frame->data), input->frame->linesize,
-        0, output->codecContext->height, output->frame->data, output->frame->linesize);
+  void closeOutputFile(OutputContext& ctx) {
+    if (!ctx.formatContext) {
+      return;
+    }
+    if (ctx.headerWritten) {
+      av_write_trailer(ctx.formatContext);
+      ctx.headerWritten = false;
+    }
+    if (!(ctx.outputFormat->flags & AVFMT_NOFILE)) {
+      avio_closep(&ctx.formatContext->pb);
     }
-    output->frame->pts = output->nextPts++;
+    avformat_free_context(ctx.formatContext);
+    ctx.formatContext = nullptr;
+    ctx.stream = nullptr;
   }
 
-  void addFrameToOutput(std::unique_ptr<OutputContext>& output) {
-    int ret = avcodec_send_frame(output->codecContext, output->frame);
+  int convertFrame(OutputContext& output, const AVFrame* input, AVFrame* target) {
+    int ret = 0;
+    if (!target->buf[0]) {
+      target->format = output.codecContext->pix_fmt;
+      target->width = output.codecContext->width;
+      target->height = output.codecContext->height;
+      ret = av_frame_get_buffer(target, 0);
+    } else {
+      // Encoder may still hold on to the previous data
+      ret = av_frame_make_writable(target);
+    }
     if (ret < 0) {
-      // Fail
+      return ret;
     }
-    while (ret >= 0) {
-      AVPacket pkt = { nullptr };
-      ret = avcodec_receive_packet(output->codecContext, &pkt);
-      if(tryagain(ret)) {
-        break;
-      } else if (ret < 0) {
-        // Fatal fail
-      }
-      av_packet_rescale_ts(&pkt, output->codecContext->time_base, output->stream->time_base);
-      pkt.stream_index = output->stream->index;
+    if (output.kernel) {
+      output.kernel(input, target, 0, input->height);
+      return 0;
+    }
+    sws_scale(output.swsContext, reinterpret_cast<const uint8_t * const *>(input->data), input->linesize,
+      0, input->height, target->data, target->linesize);
+    return 0;
+  }
 
-      // Write
-      ret = av_interleaved_write_frame(output->formatContext, &pkt);
-      av_packet_unref(&pkt);
+  int encodeFrame(OutputContext& output, AVFrame* frame, std::vector<AVPacket*>& packets) {
+    int ret = avcodec_send_frame(output.codecContext, frame);
+    if (ret < 0) {
+      return ret;
+    }
+    while (ret >= 0) {
+      AVPacket* packet = av_packet_alloc();
+      ret = avcodec_receive_packet(output.codecContext, packet);
       if (ret < 0) {
-        // Fail
+        av_packet_free(&packet);
+        return tryagain(ret) ? 0 : ret;
       }
+      packets.push_back(packet);
     }
+    return ret;
   }
 
-  void releaseFrameData(std::unique_ptr<OutputContext>& output) {
-    if (!output->encodingFrames) {
-      av_frame_unref(output->frame);
-    }
+  int writePacket(OutputContext& output, AVPacket* packet) {
+    av_packet_rescale_ts(packet, output.timeBase, output.stream->time_base);
+    packet->stream_index = output.stream->index;
+    packet->pos = -1;
+    // Takes the reference of the packet
+    return av_interleaved_write_frame(output.formatContext, packet);
   }
 
   void stopOutput(std::unique_ptr<OutputContext>& output) {
-    av_write_trailer(output->formatContext);
+    closeOutputFile(*output);
     avcodec_free_context(&output->codecContext);
-    if (output->encodingFrames) {
-      av_frame_free(&output->frame);
-    }
     sws_freeContext(output->swsContext);
+    avcodec_parameters_free(&output->parameters);
+    output.reset();
+  }
 
-    if (!(output->outputFormat->flags & AVFMT_NOFILE)) {
-      avio_closep(&output->formatContext->pb);
+  // Holds back packets of realtime file input until they are due, as if
+  // they had arrived from a capture device
+  static void pacePacket(StreamContext& ctx, const AVPacket& packet) {
+    if (ctx.source.device || !ctx.source.realtime) {
+      return;
     }
-    avformat_free_context(output->formatContext);
-    output.reset();
+    // Decode order timestamps grow monotonically also with B-frames
+    int64_t timestamp = hasTimestamp(packet.dts) ? packet.dts : packet.pts;
+    if (!hasTimestamp(timestamp)) {
+      return;
+    }
+    if (!ctx.paced) {
+      ctx.paced = true;
+      ctx.firstPts = timestamp;
+      ctx.firstPtsTime = std::chrono::steady_clock::now();
+      return;
+    }
+    AVRational timeBase = ctx.formatContext->streams[ctx.streamIndex]->time_base;
+    std::chrono::duration<double> offset(static_cast<double>(timestamp - ctx.firstPts) * av_q2d(timeBase));
+    std::this_thread::sleep_until(
+      ctx.firstPtsTime + std::chrono::duration_cast<std::chrono::steady_clock::duration>(offset));
   }
 
-  int prepareFrame(StreamContext& ctx) {
-    AVPacket packet;
-    int err = av_read_frame(ctx.formatContext, &packet);
+  int readPacket(StreamContext& ctx, AVPacket* packet) {
+    int err = av_read_frame(ctx.formatContext, packet);
+    // Files can contain other streams too, skip to the next video packet
+    while (err >= 0 && packet->stream_index != ctx.streamIndex) {
+      av_packet_unref(packet);
+      err = av_read_frame(ctx.formatContext, packet);
+    }
     if (err < 0) {
       return err;
     }
-    utils::PerfLogger::logEntry(ctx.name, utils::Key::Received, ctx.frameNumber, ctx.profile);
+    pacePacket(ctx, *packet);
+    ctx.lastPacketTime = std::chrono::steady_clock::now();
+    if (ctx.watchdog) {
+      ctx.watchdog->packetReceived();
+    }
+    std::lock_guard<std::mutex> lock(ctx.onPacketMutex);
+    if (ctx.onPacket) {
+      ctx.onPacket(*packet);
+    }
+    return 0;
+  }
 
-    err = avcodec_send_packet(ctx.codecContext, &packet);
-    if(err < 0) {
+  int sendPacket(StreamContext& ctx, const AVPacket* packet) {
+    if (!packet) {
+      // Let the decoder return the frames it still has buffered, after
+      // those receiveFrame returns AVERROR_EOF
+      ctx.draining = true;
+      return avcodec_send_packet(ctx.codecContext, nullptr);
+    }
+    utils::PerfLogger::logEntry(ctx.name, utils::Key::Received, ctx.frameNumber, ctx.profile);
+    int err = avcodec_send_packet(ctx.codecContext, packet);
+    if (err < 0) {
       std::cout << "Error in avcodec_send_packet" << std::endl;
-      av_packet_unref(&packet);
-      return err;
     }
-
-    av_packet_unref(&packet);
     return err;
   }
 
+  void setPacketCallback(StreamContext& ctx, StreamContext::PacketCallback callback) {
+    std::lock_guard<std::mutex> lock(ctx.onPacketMutex);
+    ctx.onPacket = std::move(callback);
+  }
+
+  bool intraOnly(const StreamContext& ctx) {
+    const AVCodecDescriptor* descriptor = avcodec_descriptor_get(ctx.codecContext->codec_id);
+    return descriptor && (descriptor->props & AV_CODEC_PROP_INTRA_ONLY);
+  }
+
+  // Polling close to the time the frame is due keeps the delay low, late
+  // input is checked less often
+  static constexpr std::chrono::microseconds InputPollInterval(250);
+  static constexpr std::chrono::milliseconds LateInputPollInterval(5);
+
+  void waitForInput(const StreamContext& ctx) {
+    auto now = std::chrono::steady_clock::now();
+    auto due = ctx.lastPacketTime + ctx.frameInterval;
+    if (now + InputPollInterval < due) {
+      std::this_thread::sleep_until(due - InputPollInterval);
+    } else if (now - due < std::max<std::chrono::steady_clock::duration>(ctx.frameInterval, LateInputPollInterval)) {
+      std::this_thread::sleep_for(InputPollInterval);
+    } else {
+      std::this_thread::sleep_for(LateInputPollInterval);
+    }
+  }
+
   int receiveFrame(StreamContext& ctx) {
     return avcodec_receive_frame(ctx.codecContext, ctx.frame);
   }
 
+  bool rewind(StreamContext& ctx) {
+    if (ctx.source.device) {
+      return false;
+    }
+    int64_t startTime = ctx.formatContext->start_time;
+    int err = av_seek_frame(ctx.formatContext, -1, hasTimestamp(startTime) ? startTime : 0,
+                            AVSEEK_FLAG_BACKWARD);
+    if (err < 0) {
+      std::cout << "Failed to seek to the beginning of " << ctx.name << std::endl;
+      return false;
+    }
+    // Timestamps start over, so does pacing
+    ctx.paced = false;
+    return true;
+  }
+
+  void restartDecoder(StreamContext& ctx) {
+    avcodec_flush_buffers(ctx.codecContext);
+    ctx.draining = false;
+  }
+
   void stop(StreamContext& ctx) {
     av_frame_unref(ctx.frame);
     avcodec_send_packet(ctx.codecContext, nullptr);
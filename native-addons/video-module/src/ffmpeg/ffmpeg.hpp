@@ -16,25 +16,89 @@ namespace ffmpeg {
 
   std::vector<VideoMode> getVideoModes(const std::string& deviceName);
 
-  std::unique_ptr<StreamContext> start(const std::string& deviceName, VideoMode mode);
+  // Watchdog, when given, can abort opening and reading of the input.
+  // Previous is the context of the run being replaced: its input is closed
+  // first and its decoder is kept if the stream parameters and threads stay
+  // the same.
+  std::unique_ptr<StreamContext> start(const InputSource& source, VideoMode mode,
+                                       std::shared_ptr<InputWatchdog> watchdog = nullptr,
+                                       std::unique_ptr<StreamContext> previous = nullptr);
+  // Frame rate of recordings when neither options nor input tell it
+  constexpr int DefaultOutputFps = 25;
+  // Finest time base used for recordings
+  constexpr int MaxOutputTimeBaseDen = 65535;
+  // Sets up the encoder, files are opened separately
   std::optional<std::string> initOutput(std::unique_ptr<OutputContext>& ctx, std::unique_ptr<StreamContext>& input);
+  // Output that stores packets of the input as they are
+  std::optional<std::string> initCopyOutput(std::unique_ptr<OutputContext>& ctx, std::unique_ptr<StreamContext>& input);
+  // Starts a file with the stream parameters of the output and the format
+  // options of file. Only one file is open at a time.
+  std::optional<std::string> openOutputFile(OutputContext& ctx, const std::string& path,
+                                            const RecordingOptions& file);
+  void closeOutputFile(OutputContext& ctx);
   AVFrame* initFrame(AVPixelFormat pixFmt, int width, int height);
-  void currentFrameForOutput(std::unique_ptr<StreamContext>& input, std::unique_ptr<OutputContext>& output);
 
-  void addFrameToOutput(std::unique_ptr<OutputContext>& output);
-  void releaseFrameData(std::unique_ptr<OutputContext>& output);
+  // Converts input to the pixel format of the encoder. Buffers of target
+  // are allocated on first use and reused after that.
+  int convertFrame(OutputContext& output, const AVFrame* input, AVFrame* target);
+  // Sends frame (nullptr flushes) to the encoder and appends the resulting
+  // packets, timestamps in OutputContext::timeBase
+  int encodeFrame(OutputContext& output, AVFrame* frame, std::vector<AVPacket*>& packets);
+  // Packet timestamps in OutputContext::timeBase, file has to be open
+  int writePacket(OutputContext& output, AVPacket* packet);
   void stopOutput(std::unique_ptr<OutputContext>& output);
 
-  int prepareFrame(StreamContext& ctx);
+  // Reader thread: next video packet of the input, paced for realtime
+  // input. Returns AVERROR code, AVERROR_EOF at the end of non-device input.
+  int readPacket(StreamContext& ctx, AVPacket* packet);
+  // Decoder thread: nullptr sends the end of input and starts draining
+  int sendPacket(StreamContext& ctx, const AVPacket* packet);
+  // Callback is called on the reader thread, so it's swapped under a lock
+  void setPacketCallback(StreamContext& ctx, StreamContext::PacketCallback callback);
+  // Every packet of the codec is a keyframe (MJPEG, raw video)
+  bool intraOnly(const StreamContext& ctx);
+  // For input that returns EAGAIN instead of blocking until a packet is
+  // ready (avfoundation). Sleeps until the next frame is due.
+  void waitForInput(const StreamContext& ctx);
   int receiveFrame(StreamContext& ctx);
+  // Reader thread: seeks back to the beginning of non-device input
+  bool rewind(StreamContext& ctx);
+  // Decoder thread: ready for packets again after draining
+  void restartDecoder(StreamContext& ctx);
   void stop(StreamContext& ctx);
 
   void showFormats();
+  // Name of FF_THREAD_* flags of AVCodecContext::active_thread_type
+  std::string threadTypeName(int threadType);
+  std::string errorString(int errorCode);
+  // Path of the n:th file of a series: pattern with %d as for the image2
+  // and segment muxers, or -<n> added before the extension
+  std::string numberedPath(const std::string& path, int number);
 
 #include "../disable_warnings_begin.hpp"
   inline bool tryagain(int errorCode) {
     return errorCode == AVERROR(EAGAIN) || errorCode == AVERROR_EOF;
   }
+
+  inline int endOfInputError() {
+    return AVERROR_EOF;
+  }
+
+  inline int outOfMemoryError() {
+    return AVERROR(ENOMEM);
+  }
+
+  inline int invalidArgumentError() {
+    return AVERROR(EINVAL);
+  }
+
+  inline bool endOfInput(int errorCode) {
+    return errorCode == AVERROR_EOF;
+  }
+
+  inline bool hasTimestamp(int64_t timestamp) {
+    return timestamp != AV_NOPTS_VALUE;
+  }
 #include "../disable_warnings_end.hpp"
 
 
@@ -0,0 +1,177 @@
+#include "Benchmark.hpp"
+
+#include "Utils.hpp"
+#include "VideoMode.hpp"
+
+#include "../ffmpeg/ConversionBenchmark.hpp"
+#include "../ffmpeg/DecodeBenchmark.hpp"
+#include "../ffmpeg/ffmpeg.hpp"
+
+namespace video {
+
+  // Runs in libuv thread pool so that the benchmark doesn't block JS
+  class DecodeBenchmarkWorker : public Napi::AsyncWorker {
+  public:
+    DecodeBenchmarkWorker(Napi::Env env, const ffmpeg::DecodeBenchmarkOptions& options)
+      : Napi::AsyncWorker(env),
+        m_deferred(Napi::Promise::Deferred::New(env)),
+        m_options(options)
+    {}
+
+    Napi::Promise promise() const {
+      return m_deferred.Promise();
+    }
+
+  protected:
+    void Execute() override {
+      auto result = ffmpeg::benchmarkDecode(m_options);
+      if (std::holds_alternative<std::string>(result)) {
+        SetError(std::get<std::string>(result));
+      } else {
+        m_results = std::get<std::vector<ffmpeg::DecodeBenchmarkResult>>(result);
+      }
+    }
+
+    void OnOK() override {
+      Napi::Env env = Env();
+      Napi::Array array = Napi::Array::New(env);
+      for (size_t i = 0; i < m_results.size(); ++i) {
+        const ffmpeg::DecodeBenchmarkResult& r = m_results[i];
+        Napi::Object obj = Napi::Object::New(env);
+        obj.Set("requestedThreads", r.requestedThreads);
+        obj.Set("threads", r.threads);
+        obj.Set("threadType", ffmpeg::threadTypeName(r.threadType));
+        obj.Set("frames", r.frames);
+        obj.Set("seconds", r.seconds);
+        obj.Set("fps", r.seconds > 0 ? r.frames / r.seconds : 0.0);
+        array.Set(uint32_t(i), obj);
+      }
+      m_deferred.Resolve(array);
+    }
+
+    void OnError(const Napi::Error& error) override {
+      m_deferred.Reject(error.Value());
+    }
+
+  private:
+    Napi::Promise::Deferred m_deferred;
+    ffmpeg::DecodeBenchmarkOptions m_options;
+    std::vector<ffmpeg::DecodeBenchmarkResult> m_results;
+  };
+
+  Napi::Value benchmarkDecode(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (info.Length() < 1 || !info[0].IsObject()) {
+      throw Napi::TypeError::New(env, "Expected first argument to be object");
+    }
+    Napi::Object obj = info[0].As<Napi::Object>();
+    ffmpeg::DecodeBenchmarkOptions options;
+    options.url = getString(obj, "url", "");
+    if (options.url.empty()) {
+      throw Napi::TypeError::New(env, "url needs to be string");
+    }
+    options.format = getString(obj, "format", "");
+    options.packets = getInt(obj, "packets", options.packets);
+    // Validated like the mode of a stream
+    options.threadType = VideoMode::convertThreadType(obj);
+
+    if (obj.Has("threads") && obj.Get("threads").IsArray()) {
+      Napi::Array threads = obj.Get("threads").As<Napi::Array>();
+      for (uint32_t i = 0; i < threads.Length(); ++i) {
+        options.threads.push_back(VideoMode::convertThreads(threads.Get(i)));
+      }
+    } else {
+      options.threads = { 1, 2, 4, 8, 0 };
+    }
+
+    auto worker = new DecodeBenchmarkWorker(env, options);
+    Napi::Promise promise = worker->promise();
+    worker->Queue();
+    return promise;
+  }
+
+  class ConversionBenchmarkWorker : public Napi::AsyncWorker {
+  public:
+    ConversionBenchmarkWorker(Napi::Env env, const ffmpeg::ConversionBenchmarkOptions& options)
+      : Napi::AsyncWorker(env),
+        m_deferred(Napi::Promise::Deferred::New(env)),
+        m_options(options)
+    {}
+
+    Napi::Promise promise() const {
+      return m_deferred.Promise();
+    }
+
+  protected:
+    void Execute() override {
+      auto result = ffmpeg::benchmarkConversion(m_options);
+      if (std::holds_alternative<std::string>(result)) {
+        SetError(std::get<std::string>(result));
+      } else {
+        m_results = std::get<std::vector<ffmpeg::ConversionBenchmarkResult>>(result);
+      }
+    }
+
+    void OnOK() override {
+      Napi::Env env = Env();
+      Napi::Array array = Napi::Array::New(env);
+      for (size_t i = 0; i < m_results.size(); ++i) {
+        const ffmpeg::ConversionBenchmarkResult& r = m_results[i];
+        Napi::Object obj = Napi::Object::New(env);
+        obj.Set("inputFormat", av_get_pix_fmt_name(r.inputFormat));
+        obj.Set("outputFormat", av_get_pix_fmt_name(r.outputFormat));
+        obj.Set("implementation", r.implementation);
+        obj.Set("milliseconds", r.milliseconds);
+        obj.Set("exact", r.exact);
+        array.Set(uint32_t(i), obj);
+      }
+      m_deferred.Resolve(array);
+    }
+
+    void OnError(const Napi::Error& error) override {
+      m_deferred.Reject(error.Value());
+    }
+
+  private:
+    Napi::Promise::Deferred m_deferred;
+    ffmpeg::ConversionBenchmarkOptions m_options;
+    std::vector<ffmpeg::ConversionBenchmarkResult> m_results;
+  };
+
+  static AVPixelFormat pixelFormat(const Napi::Object& obj, const char* key) {
+    std::string name = getString(obj, key, "");
+    AVPixelFormat format = av_get_pix_fmt(name.c_str());
+    if (format == AV_PIX_FMT_NONE) {
+      throw Napi::TypeError::New(obj.Env(), "Unknown pixel format " + name);
+    }
+    return format;
+  }
+
+  Napi::Value benchmarkConversion(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    ffmpeg::ConversionBenchmarkOptions options;
+    if (info.Length() > 0 && info[0].IsObject()) {
+      Napi::Object obj = info[0].As<Napi::Object>();
+      options.width = getInt(obj, "width", options.width);
+      options.height = getInt(obj, "height", options.height);
+      options.frames = getInt(obj, "frames", options.frames);
+      if (obj.Has("conversions") && obj.Get("conversions").IsArray()) {
+        Napi::Array conversions = obj.Get("conversions").As<Napi::Array>();
+        for (uint32_t i = 0; i < conversions.Length(); ++i) {
+          Napi::Value v = conversions.Get(i);
+          if (!v.IsObject()) {
+            throw Napi::TypeError::New(env, "Expected conversions to be objects");
+          }
+          Napi::Object conversion = v.As<Napi::Object>();
+          options.conversions.emplace_back(pixelFormat(conversion, "input"), pixelFormat(conversion, "output"));
+        }
+      }
+    }
+
+    auto worker = new ConversionBenchmarkWorker(env, options);
+    Napi::Promise promise = worker->promise();
+    worker->Queue();
+    return promise;
+  }
+
+} // namespace video
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "../common.hpp"
+
+namespace video {
+
+  // benchmarkDecode({ url, format, packets, threads, threadType })
+  // Returns promise of array of results, one per thread count
+  Napi::Value benchmarkDecode(const Napi::CallbackInfo& info);
+
+  // benchmarkConversion({ width, height, frames, conversions })
+  // Returns promise of array of results, one per conversion and implementation
+  Napi::Value benchmarkConversion(const Napi::CallbackInfo& info);
+
+} // namespace video
@@ -0,0 +1,181 @@
+#include "Devices.hpp"
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "DummyStream.hpp"
+#include "FFmpegStream.hpp"
+#include "Utils.hpp"
+#include "VideoMode.hpp"
+
+#include "../ffmpeg/DeviceRegistry.hpp"
+
+namespace video {
+
+  static Napi::Array streamsArray(Napi::Env env, const std::vector<ffmpeg::DeviceInfo>& devices) {
+    Napi::Array result = Napi::Array::New(env);
+    result.Set(uint32_t(0), DummyStream::create(env));
+    for (size_t i = 0; i < devices.size(); ++i) {
+      result.Set(uint32_t(i + 1), FFmpegStream::create(env, devices[i].name));
+    }
+    return result;
+  }
+
+  // Probes in libuv thread pool so that enumeration doesn't block JS
+  class ListStreamsWorker : public Napi::AsyncWorker {
+  public:
+    ListStreamsWorker(Napi::Env env, bool refresh)
+      : Napi::AsyncWorker(env),
+        m_deferred(Napi::Promise::Deferred::New(env)),
+        m_refresh(refresh)
+    {}
+
+    Napi::Promise promise() const {
+      return m_deferred.Promise();
+    }
+
+  protected:
+    void Execute() override {
+      m_devices = ffmpeg::DeviceRegistry::shared().devices(m_refresh);
+    }
+
+    void OnOK() override {
+      m_deferred.Resolve(streamsArray(Env(), m_devices));
+    }
+
+    void OnError(const Napi::Error& error) override {
+      m_deferred.Reject(error.Value());
+    }
+
+  private:
+    Napi::Promise::Deferred m_deferred;
+    const bool m_refresh;
+    std::vector<ffmpeg::DeviceInfo> m_devices;
+  };
+
+  class VideoModesWorker : public Napi::AsyncWorker {
+  public:
+    VideoModesWorker(Napi::Env env, const std::string& deviceName, bool refresh)
+      : Napi::AsyncWorker(env),
+        m_deferred(Napi::Promise::Deferred::New(env)),
+        m_deviceName(deviceName),
+        m_refresh(refresh)
+    {}
+
+    Napi::Promise promise() const {
+      return m_deferred.Promise();
+    }
+
+  protected:
+    void Execute() override {
+      m_modes = ffmpeg::DeviceRegistry::shared().videoModes(m_deviceName, m_refresh);
+    }
+
+    void OnOK() override {
+      Napi::Env env = Env();
+      Napi::Array result = Napi::Array::New(env, m_modes.size());
+      for (size_t i = 0; i < m_modes.size(); ++i) {
+        result.Set(uint32_t(i), VideoMode::create(env, m_modes[i]));
+      }
+      m_deferred.Resolve(result);
+    }
+
+    void OnError(const Napi::Error& error) override {
+      m_deferred.Reject(error.Value());
+    }
+
+  private:
+    Napi::Promise::Deferred m_deferred;
+    const std::string m_deviceName;
+    const bool m_refresh;
+    std::vector<ffmpeg::VideoMode> m_modes;
+  };
+
+  Napi::Value listStreamsAsync(const Napi::CallbackInfo& info) {
+    bool refresh = info.Length() > 0 && info[0].IsObject() && getBool(info[0].As<Napi::Object>(), "refresh", false);
+    auto worker = new ListStreamsWorker(info.Env(), refresh);
+    Napi::Promise promise = worker->promise();
+    worker->Queue();
+    return promise;
+  }
+
+  Napi::Promise videoModesAsync(Napi::Env env, const std::string& deviceName, bool refresh) {
+    auto worker = new VideoModesWorker(env, deviceName, refresh);
+    Napi::Promise promise = worker->promise();
+    worker->Queue();
+    return promise;
+  }
+
+  // Stopping the watcher waits for a probe in progress, not on the JS thread
+  class StopWatcherWorker : public Napi::AsyncWorker {
+  public:
+    StopWatcherWorker(Napi::Env env, std::unique_ptr<utils::DeviceWatcher> watcher)
+      : Napi::AsyncWorker(env),
+        m_watcher(std::move(watcher))
+    {}
+
+  protected:
+    void Execute() override {
+      m_watcher.reset();
+    }
+
+  private:
+    std::unique_ptr<utils::DeviceWatcher> m_watcher;
+  };
+
+  void callDeviceChangeCB(Napi::Env env, Napi::Function function, std::nullptr_t*,
+                          std::vector<ffmpeg::DeviceInfo>* devices) {
+    std::unique_ptr<std::vector<ffmpeg::DeviceInfo>> owned(devices);
+    if (env != nullptr && function != nullptr) {
+      function.Call({ streamsArray(env, *owned) });
+    }
+  }
+
+  using DeviceChangeCB = Napi::TypedThreadSafeFunction<std::nullptr_t, std::vector<ffmpeg::DeviceInfo>,
+                                                       callDeviceChangeCB>;
+
+  // Only one listener at a time, registry is process wide
+  static std::mutex s_listenerMutex;
+  static DeviceChangeCB s_listener;
+
+  Napi::Value setDeviceChangeListener(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (info.Length() < 1 || !info[0].IsFunction()) {
+      throw Napi::TypeError::New(env, "Expected first argument to be function");
+    }
+    removeDeviceChangeListener(info);
+
+    std::lock_guard<std::mutex> lock(s_listenerMutex);
+    s_listener = DeviceChangeCB::New(
+      env,
+      info[0].As<Napi::Function>(),
+      "Device change callback",
+      0,
+      1);
+    // Listening alone doesn't keep the process running
+    s_listener.Unref(env);
+    DeviceChangeCB listener = s_listener;
+    bool watching = ffmpeg::DeviceRegistry::shared().setChangeCallback(
+      [listener](const std::vector<ffmpeg::DeviceInfo>& devices) mutable {
+        auto copy = new std::vector<ffmpeg::DeviceInfo>(devices);
+        if (listener.NonBlockingCall(copy) != napi_ok) {
+          delete copy;
+        }
+      });
+    return Napi::Boolean::New(env, watching);
+  }
+
+  void removeDeviceChangeListener(const Napi::CallbackInfo& info) {
+    if (std::unique_ptr<utils::DeviceWatcher> watcher = ffmpeg::DeviceRegistry::shared().stopWatching()) {
+      auto worker = new StopWatcherWorker(info.Env(), std::move(watcher));
+      worker->Queue();
+    }
+    std::lock_guard<std::mutex> lock(s_listenerMutex);
+    if (s_listener != nullptr) {
+      s_listener.Release();
+      s_listener = DeviceChangeCB();
+    }
+  }
+
+} // namespace video
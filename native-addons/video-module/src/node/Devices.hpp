@@ -0,0 +1,23 @@
+#pragma once
+
+#include "../common.hpp"
+
+#include <string>
+
+namespace video {
+
+  // listStreamsAsync({ refresh })
+  // Returns promise of the streams of listStreams. Devices and their modes
+  // are probed in the background and cached, refresh probes them again.
+  Napi::Value listStreamsAsync(const Napi::CallbackInfo& info);
+
+  // Promise of the modes of a device, cached after the first probe
+  Napi::Promise videoModesAsync(Napi::Env env, const std::string& deviceName, bool refresh);
+
+  // setDeviceChangeListener(callback)
+  // Callback gets the streams of all devices after one is plugged in or
+  // removed. Returns false if changes can't be watched on this platform.
+  Napi::Value setDeviceChangeListener(const Napi::CallbackInfo& info);
+  void removeDeviceChangeListener(const Napi::CallbackInfo& info);
+
+} // namespace video
@@ -18,6 +18,8 @@ namespace video {
       InstanceMethod<&DummyStream::name>("name"),
       InstanceMethod<&DummyStream::addFrameCallback>("addFrameCallback"),
       InstanceMethod<&DummyStream::clearFrameCallbacks>("clearFrameCallbacks"),
+      InstanceMethod<&DummyStream::addTap>("addTap"),
+      InstanceMethod<&DummyStream::removeTap>("removeTap"),
       InstanceMethod<&DummyStream::start>("start"),
       InstanceMethod<&DummyStream::stop>("stop"),
       InstanceMethod<&DummyStream::videoModes>("videoModes"),
@@ -40,7 +42,11 @@ namespace video {
   }
 
   Napi::Value DummyStream::create(const Napi::CallbackInfo& info) {
-    ConstructorMap& ctors = info.Env().GetInstanceData<InstanceData>()->constructors;
+    return create(info.Env());
+  }
+
+  Napi::Value DummyStream::create(Napi::Env env) {
+    ConstructorMap& ctors = env.GetInstanceData<InstanceData>()->constructors;
     auto& ctor = ctors[DUMMY_CTOR];
     return ctor->New({});
   }
@@ -90,6 +96,9 @@ namespace video {
       m_workerThread->join();
       m_workerThread.reset();
     }
+    if (mode.queueDepth > 0 && !m_base.setFrameQueueDepth(static_cast<size_t>(mode.queueDepth))) {
+      std::cout << "Frames still in flight, keeping previous queue depth" << std::endl;
+    }
 
     m_running = true;
     auto work = [this, mode] {
@@ -108,7 +117,7 @@ namespace video {
           auto data = FrameData::createTestTexture(phase, mode.w, mode.h, frames);
           utils::PerfLogger::logEntry(m_base.cppName(), utils::Key::Decoded, frames, mode.profile);
           ++frames;
-          m_base.frameProduced({ data }, mode.profile);
+          m_base.frameProduced(data, mode.profile);
           iterations = 0;
         }
       }
@@ -139,6 +148,14 @@ namespace video {
     m_base.clearFrameCallbacks(info);
   }
 
+  void DummyStream::addTap(const Napi::CallbackInfo& info) {
+    m_base.addTap(info);
+  }
+
+  void DummyStream::removeTap(const Napi::CallbackInfo& info) {
+    m_base.removeTap(info);
+  }
+
   void DummyStream::setEventListener(const Napi::CallbackInfo& info) {
     m_base.setEventListener(info);
   }
@@ -17,6 +17,7 @@ namespace video {
       Napi::Object exports,
       ConstructorMap& ctors);
     static Napi::Value create(const Napi::CallbackInfo& info);
+    static Napi::Value create(Napi::Env env);
 
     DummyStream(const Napi::CallbackInfo& info);
     ~DummyStream();
@@ -31,6 +32,8 @@ namespace video {
 
     void addFrameCallback(const Napi::CallbackInfo& info);
     void clearFrameCallbacks(const Napi::CallbackInfo&);
+    void addTap(const Napi::CallbackInfo& info);
+    void removeTap(const Napi::CallbackInfo& info);
 
     Napi::Value enableRemoteStream(const Napi::CallbackInfo& info);
     void disableRemoteStream(const Napi::CallbackInfo& info);
@@ -1,10 +1,18 @@
 #include "FFmpegStream.hpp"
 #include "../ffmpeg/ffmpeg.hpp"
 #include "../ffmpeg/AVFrameData.hpp"
+#include "../ffmpeg/DeviceRegistry.hpp"
+#include "../ffmpeg/FrameConverter.hpp"
+#include "../ffmpeg/FramePool.hpp"
+#include "../ffmpeg/PacketQueue.hpp"
+#include "../ffmpeg/Recorder.hpp"
 
 #include "../utils/PerfLogger.hpp"
 
+#include "Devices.hpp"
 #include "Utils.hpp"
+#include "ImageOptions.hpp"
+#include "RecordingOptions.hpp"
 #include "VideoMode.hpp"
 
 #include <iostream>
@@ -21,9 +29,13 @@ namespace video {
       InstanceMethod<&FFmpegStream::name>("name"),
       InstanceMethod<&FFmpegStream::addFrameCallback>("addFrameCallback"),
       InstanceMethod<&FFmpegStream::clearFrameCallbacks>("clearFrameCallbacks"),
+      InstanceMethod<&FFmpegStream::addTap>("addTap"),
+      InstanceMethod<&FFmpegStream::removeTap>("removeTap"),
       InstanceMethod<&FFmpegStream::start>("start"),
       InstanceMethod<&FFmpegStream::stop>("stop"),
+      InstanceMethod<&FFmpegStream::switchMode>("switchMode"),
       InstanceMethod<&FFmpegStream::videoModes>("videoModes"),
+      InstanceMethod<&FFmpegStream::videoModesAsync>("videoModesAsync"),
       InstanceMethod<&FFmpegStream::format>("format"),
       InstanceMethod<&FFmpegStream::enableRemoteStream>("enableRemoteStream"),
       InstanceMethod<&FFmpegStream::disableRemoteStream>("disableRemoteStream"),
@@ -34,6 +46,8 @@ namespace video {
       InstanceMethod<&FFmpegStream::isRecording>("isRecording"),
       InstanceMethod<&FFmpegStream::startRecording>("startRecording"),
       InstanceMethod<&FFmpegStream::stopRecording>("stopRecording"),
+      InstanceMethod<&FFmpegStream::enablePreRoll>("enablePreRoll"),
+      InstanceMethod<&FFmpegStream::disablePreRoll>("disablePreRoll"),
       InstanceMethod<&FFmpegStream::takeSnapshot>("takeSnapshot"),
     });
 
@@ -51,7 +65,8 @@ namespace video {
   std::vector<Napi::Value>
   FFmpegStream::listDevices(const Napi::CallbackInfo& info) {
     std::vector<Napi::Value> result;
-    auto deviceNames = ffmpeg::inputVideoDevices();
+    // Always probed, also refreshes the names cached for the async API
+    auto deviceNames = ffmpeg::DeviceRegistry::shared().deviceNames(true);
     for(const std::string& deviceName : deviceNames) {
       result.push_back(FFmpegStream::create(info, deviceName));
     }
@@ -62,18 +77,50 @@ namespace video {
     const Napi::CallbackInfo& info,
     const std::string& name)
   {
-    ConstructorMap& ctors = info.Env().GetInstanceData<InstanceData>()->constructors;
+    return create(info.Env(), name);
+  }
+
+  Napi::Value FFmpegStream::create(Napi::Env env, const std::string& name) {
+    ConstructorMap& ctors = env.GetInstanceData<InstanceData>()->constructors;
     auto& ctor = ctors[FFMPEG_CTOR];
-    return ctor->New({ Napi::String::New(info.Env(), name) });
+    return ctor->New({ Napi::String::New(env, name) });
   }
 
-  FFmpegStream::FFmpegStream(const Napi::CallbackInfo& info)
-    : Napi::ObjectWrap<FFmpegStream>(info),
-      m_ctx(nullptr),
-      m_workerThread(nullptr),
+  Napi::Value FFmpegStream::createFileStream(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (info.Length() == 0 || !info[0].IsString()) {
+      throw Napi::TypeError::New(env, "Expected first argument to be url of the input");
+    }
+    std::string url = info[0].As<Napi::String>();
+    Napi::Object stream = create(info, url).As<Napi::Object>();
+    FFmpegStream* wrapped = FFmpegStream::Unwrap(stream);
+    ffmpeg::InputSource& source = wrapped->m_core->m_source;
+    source.device = false;
+    if (info.Length() > 1 && info[1].IsObject()) {
+      Napi::Object options = info[1].As<Napi::Object>();
+      source.format = getString(options, "format", "");
+      source.realtime = getBool(options, "realtime", true);
+      source.loop = getBool(options, "loop", false);
+    }
+    return stream;
+  }
+
+  FFmpegStream::Core::Core()
+    : m_ctx(nullptr),
       m_running(false),
+      m_handoverRun(nullptr),
       m_recording(false),
-      m_recordingContext(nullptr)
+      m_recordingGeneration(0),
+      m_framePool(ffmpeg::FramePool::create()),
+      m_framesDropped(0),
+      m_snapshotsPending(false),
+      m_stopAfterSnapshots(false)
+  {}
+
+  FFmpegStream::FFmpegStream(const Napi::CallbackInfo& info)
+    : Napi::ObjectWrap<FFmpegStream>(info),
+      m_core(std::make_shared<Core>()),
+      m_outputFormat(AV_PIX_FMT_NONE)
   {
     if (info.Length() == 0 || !info[0].IsString()) {
       Napi::Env env = info.Env();
@@ -81,42 +128,58 @@ namespace video {
         .ThrowAsJavaScriptException();
     }
 
-    m_base.setName(info[0].As<Napi::String>());
+    m_core->m_base.setName(info[0].As<Napi::String>());
+    m_core->m_source.url = m_core->m_base.cppName();
   }
 
   FFmpegStream::FFmpegStream(
     const Napi::CallbackInfo& info,
     const std::string& name)
     : Napi::ObjectWrap<FFmpegStream>(info),
-      m_base(name),
-      m_recording(false),
-      m_recordingContext(nullptr)
+      m_core(std::make_shared<Core>()),
+      m_outputFormat(AV_PIX_FMT_NONE)
   {
+    m_core->m_base.setName(name);
+    m_core->m_source.url = name;
   }
 
   FFmpegStream::~FFmpegStream() {
     stop();
+    if (m_workerThread.joinable()) {
+      // Worker is stuck in a driver. It holds on to the core and finishes
+      // whenever the driver lets go, nobody is left to hear from it.
+      m_workerThread.detach();
+      m_core->m_base.removeEventListener();
+    }
   }
 
   Napi::Value FFmpegStream::name(const Napi::CallbackInfo& info) {
-    return m_base.name(info);
+    return m_core->m_base.name(info);
   }
 
   Napi::Value FFmpegStream::format(const Napi::CallbackInfo& info) {
+    if (m_outputFormat != AV_PIX_FMT_NONE) {
+      // Frames are converted to the format asked for in start
+      return Napi::String::New(info.Env(), av_get_pix_fmt_name(m_outputFormat));
+    }
     // See libavutil/pixfmt.h
-    if (m_ctx && m_ctx->codecContext->pix_fmt == AV_PIX_FMT_UYVY422) {
+    if (m_core->m_ctx && m_core->m_ctx->codecContext->pix_fmt == AV_PIX_FMT_UYVY422) {
       return Napi::String::New(info.Env(), "uyvu422");
-    } else if (m_ctx && m_ctx->codecContext->pix_fmt == AV_PIX_FMT_YUVJ422P) {
+    } else if (m_core->m_ctx && m_core->m_ctx->codecContext->pix_fmt == AV_PIX_FMT_YUVJ422P) {
       return Napi::String::New(info.Env(), "yuvj422p");
     } else {
-      return Napi::Number::New(info.Env(), m_ctx->codecContext->pix_fmt);
+      return Napi::Number::New(info.Env(), m_core->m_ctx->codecContext->pix_fmt);
     }
   }
 
   Napi::Value FFmpegStream::videoModes(const Napi::CallbackInfo& info) {
     Napi::Array result = Napi::Array::New(info.Env());
+    if (!m_core->m_source.device) {
+      // Files and generated input have only the mode they were made with
+      return result;
+    }
 
-    auto modes = ffmpeg::getVideoModes(m_base.cppName());
+    auto modes = ffmpeg::DeviceRegistry::shared().videoModes(m_core->m_base.cppName(), false);
     for(size_t i = 0; i < modes.size(); ++i) {
       result.Set(uint32_t(i), VideoMode::create(info, modes[i]));
     }
@@ -124,196 +187,558 @@ namespace video {
     return result;
   }
 
+  Napi::Value FFmpegStream::videoModesAsync(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (!m_core->m_source.device) {
+      Napi::Promise::Deferred deferred = Napi::Promise::Deferred::New(env);
+      deferred.Resolve(Napi::Array::New(env));
+      return deferred.Promise();
+    }
+    bool refresh = info.Length() > 0 && info[0].IsObject() && getBool(info[0].As<Napi::Object>(), "refresh", false);
+    return video::videoModesAsync(env, m_core->m_base.cppName(), refresh);
+  }
+
   void FFmpegStream::stop(const Napi::CallbackInfo&) {
     stop();
   }
 
   void FFmpegStream::stop() {
-    if (m_running) {
-      m_base.emitStreamStopRequested();
-      m_running = false;
+    if (m_core->m_running) {
+      m_core->m_base.emitStreamStopRequested();
+      m_core->m_running = false;
     }
+    m_core->interruptRun();
     // Ensure clean up is always executed
-    m_base.stop(false);
-    if (m_workerThread) {
-      m_workerThread->detach();
-      m_workerThread.reset();
+    m_core->m_base.stop(false);
+    joinWorker(StopTimeout);
+  }
+
+  void FFmpegStream::switchMode(const Napi::CallbackInfo& info) {
+    auto begin = std::chrono::steady_clock::now();
+    ffmpeg::VideoMode mode = requestedMode(info);
+    if (m_core->m_running) {
+      // Current run hands its context over instead of closing it, callbacks
+      // and snapshots stay for the next one
+      m_core->m_handoverRun = std::atomic_load(&m_core->m_watchdog).get();
+      m_core->m_running = false;
+      m_core->interruptRun();
+    }
+    m_core->m_stopAfterSnapshots = false;
+    start(mode, begin);
+  }
+
+  void FFmpegStream::Core::interruptRun() {
+    if (std::shared_ptr<ffmpeg::InputWatchdog> watchdog = std::atomic_load(&m_watchdog)) {
+      // Aborts opening and reading, FFmpeg checks it while it waits
+      watchdog->interrupt();
+    }
+    if (std::shared_ptr<ffmpeg::PacketQueue> packets = std::atomic_load(&m_packets)) {
+      // Worker may be waiting for a packet
+      packets->close();
+    }
+  }
+
+  bool FFmpegStream::joinWorker(std::chrono::milliseconds timeout) {
+    if (!m_workerThread.joinable()) {
+      return true;
+    }
+    if (m_workerDone.wait_for(timeout) != std::future_status::ready) {
+      // Stuck in a driver that doesn't check for interrupts, next start
+      // waits for it to let go of the device
+      std::cout << "Worker of " << cppName() << " still stopping after " << timeout.count()
+                << " ms" << std::endl;
+      return false;
+    }
+    m_workerThread.join();
+    return true;
+  }
+
+  bool FFmpegStream::Core::endRun(ffmpeg::InputWatchdog& watchdog, bool fatal) {
+    // Only the first reason to stop counts
+    if (!watchdog.interrupt()) {
+      return false;
+    }
+    // Run being shut down doesn't touch the state of the one after it
+    if (std::atomic_load(&m_watchdog).get() == &watchdog) {
+      m_running = false;
+    }
+    if (fatal) {
+      m_base.emitStreamFatalError();
+    }
+    return true;
+  }
+
+  void FFmpegStream::Core::inputTimedOut(ffmpeg::InputWatchdog& watchdog, int inputTimeout) {
+    if (endRun(watchdog, true)) {
+      std::cout << "No input from " << cppName() << " for " << inputTimeout
+                << " ms, giving up" << std::endl;
     }
   }
 
   const std::string& FFmpegStream::cppName() const {
+    return m_core->cppName();
+  }
+
+  const std::string& FFmpegStream::Core::cppName() const {
     return m_base.cppName();
   }
 
-  void FFmpegStream::takeSnapshot(const Napi::CallbackInfo& info) {
-    if (m_running) {
-      return;
+  Napi::Value FFmpegStream::takeSnapshot(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    bool hasOptions = info.Length() > 0 && info[0].IsObject();
+    Napi::Object params = hasOptions ? info[0].As<Napi::Object>() : Napi::Object::New(env);
+    ffmpeg::ImageOptions options = ImageOptions::convert(params);
+    int count = getInt(params, "count", 1);
+    if (count < 1) {
+      throw Napi::TypeError::New(env, "count needs to be positive");
     }
 
-    if (info.Length() == 1 && info[0].IsObject()) {
-      ffmpeg::VideoMode mode = m_base.videoMode(info);
-      Napi::Object params = info[0].As<Napi::Object>();
-      std::string target = getString(params, "outputPath", "test.jpg");
-      startRecording(target, true);
-      start(mode);
-      return;
+    auto request = std::make_unique<SnapshotRequest>(env, options, static_cast<size_t>(count));
+    Napi::Promise promise = request->promise();
+    {
+      std::lock_guard<std::mutex> lock(m_core->m_snapshotMutex);
+      m_core->m_snapshots.push_back(std::move(request));
+      m_core->m_snapshotsPending = true;
     }
-    m_base.emitStreamStartFailed();
+    if (!m_core->m_running) {
+      m_core->m_stopAfterSnapshots = true;
+      start(requestedMode(info));
+    }
+    return promise;
+  }
+
+  ffmpeg::VideoMode FFmpegStream::requestedMode(const Napi::CallbackInfo& info) {
+    if (!m_core->m_source.device) {
+      // Resolution and rate come from the input, mode only tunes decoding
+      bool hasMode = info.Length() > 0 && info[0].IsObject();
+      return hasMode ? VideoMode::convert(info[0].As<Napi::Object>()) : ffmpeg::VideoMode();
+    }
+    return m_core->m_base.videoMode(info);
   }
 
   void FFmpegStream::start(const Napi::CallbackInfo& info) {
-    ffmpeg::VideoMode mode = m_base.videoMode(info);
-    start(mode);
+    m_core->m_stopAfterSnapshots = false;
+    start(requestedMode(info));
   }
 
-  void FFmpegStream::start(const ffmpeg::VideoMode& mode) {
-    if (m_running) {
+  void FFmpegStream::start(const ffmpeg::VideoMode& mode,
+                           std::optional<std::chrono::steady_clock::time_point> switchBegin) {
+    if (m_core->m_running) {
       return;
     }
-    if (m_workerThread) {
-      m_workerThread->detach();
-      m_workerThread.reset();
+    if (mode.queueDepth > 0 && !m_core->m_base.setFrameQueueDepth(static_cast<size_t>(mode.queueDepth))) {
+      std::cout << "Frames still in flight, keeping previous queue depth" << std::endl;
+    }
+    if (mode.framePoolSize > 0) {
+      m_core->m_framePool->setCapacity(static_cast<size_t>(mode.framePoolSize));
     }
 
-    m_running = true;
+    m_outputFormat = mode.conversion.pixelFormat;
+    m_core->m_running = true;
+    // Core owns the watchdog, so the callbacks don't outlive it
+    auto watchdog = std::make_shared<ffmpeg::InputWatchdog>(
+      std::chrono::milliseconds(mode.stallTimeout),
+      std::chrono::milliseconds(mode.inputTimeout),
+      [core = m_core.get()](bool stalled, ffmpeg::InputWatchdog::Duration withoutInput, uint64_t stalls) {
+        if (stalled) {
+          core->m_base.emitStreamInputStalled(withoutInput.count(), stalls);
+        } else {
+          core->m_base.emitStreamInputRecovered(withoutInput.count());
+        }
+      },
+      [core = m_core.get(), inputTimeout = mode.inputTimeout](ffmpeg::InputWatchdog& watchdog) {
+        // Reader may be blocked in the driver for good, so the run ends
+        // without it
+        core->inputTimedOut(watchdog, inputTimeout);
+      });
+    std::atomic_store(&m_core->m_watchdog, watchdog);
+
+    std::promise<void> done;
+    m_workerDone = done.get_future();
+    // Run that didn't stop in time is waited for first, so the device is
+    // only opened once it has been closed
+    std::thread previous = std::move(m_workerThread);
+    m_workerThread = std::thread([core = m_core, mode, watchdog, switchBegin, previous = std::move(previous),
+                                  done = std::move(done)]() mutable {
+      if (previous.joinable()) {
+        previous.join();
+      }
+      core->run(mode, std::move(watchdog), switchBegin);
+      done.set_value();
+    });
+  }
 
-    auto work = [this, mode] {
-      m_ctx = ffmpeg::start(m_base.cppName(), mode);
-      if (!m_ctx) {
-        m_running = false;
-        m_base.emitStreamStartFailed();
-        return;
+  void FFmpegStream::Core::run(const ffmpeg::VideoMode& mode,
+                               std::shared_ptr<ffmpeg::InputWatchdog> watchdog,
+                               std::optional<std::chrono::steady_clock::time_point> switchBegin) {
+    // Previous run has finished
+    auto stopped = std::chrono::steady_clock::now();
+    m_ctx = ffmpeg::start(m_source, mode, watchdog, std::move(m_handover));
+    if (!m_ctx) {
+      endRun(*watchdog, false);
+      failSnapshots("Couldn't start stream");
+      m_base.emitStreamStartFailed();
+      return;
+    }
+    m_base.emitStreamStarted();
+    m_base.emitStreamDecoderConfigured(
+      m_ctx->codecContext->thread_count,
+      ffmpeg::threadTypeName(m_ctx->codecContext->active_thread_type),
+      m_ctx->codec->name);
+    unsigned frameCount = static_cast<unsigned>(m_ctx->frameNumber);
+    // Frames are delivered converted when asked for, recorder and
+    // snapshots get them as decoded
+    std::unique_ptr<ffmpeg::FrameConverter> converter;
+    AVFrame* converted = nullptr;
+    if (mode.conversion.enabled()) {
+      converter = std::make_unique<ffmpeg::FrameConverter>(mode.conversion);
+      converted = av_frame_alloc();
+    }
+    // Live input keeps being read while the decoder is busy, files can
+    // wait for it unless they are paced
+    bool live = m_source.device || m_source.realtime;
+    auto packets = std::make_shared<ffmpeg::PacketQueue>(
+      static_cast<size_t>(mode.packetQueueDepth), ffmpeg::intraOnly(*m_ctx), !live);
+    std::atomic_store(&m_packets, packets);
+    std::thread reader(&Core::readPackets, this, std::ref(*packets), std::ref(*watchdog),
+                       mode.inputTimeout);
+    std::shared_ptr<ffmpeg::Recorder> recorder;
+    // Recording whose file the recorder has open
+    std::optional<uint64_t> writing;
+    while (!watchdog->interrupted()) {
+      updateRecorder(recorder, writing);
+
+      av_frame_unref(m_ctx->frame);
+      std::optional<AVPacket*> packet = packets->pop();
+      if (!packet) {
+        // Reader has stopped at the end of input or on an error
+        break;
+      }
+      int err = ffmpeg::sendPacket(*m_ctx, *packet);
+      av_packet_free(&*packet);
+      if (err < 0) {
+        endRun(*watchdog, true);
+        break;
       }
-      m_base.emitStreamStarted();
-      unsigned frameCount = static_cast<unsigned>(m_ctx->frameNumber);
-      bool isRecording = false;
-      std::unique_ptr<ffmpeg::OutputContext> recordingContext;
-      while (m_running) {
-        if (isRecording != m_recording) {
-          if (isRecording) {
-            ffmpeg::stopOutput(recordingContext);
-            isRecording = false;
-            m_base.emitStreamStoppedRecording();
-          } else {
-            isRecording = true;
-            recordingContext = std::move(m_recordingContext);
-            std::optional<std::string> error = ffmpeg::initOutput(recordingContext, m_ctx);
-            if (error) {
-              m_recording = isRecording = false;
-              m_base.emitStreamFailedRecording(error.value());
-            } else if (!recordingContext->isSnapshot) {
-              m_base.emitStreamStartedRecording();
-            }
-          }
-        }
 
-        av_frame_unref(m_ctx->frame);
-        int err = ffmpeg::prepareFrame(*m_ctx);
-        int tries = 1;
-        while(ffmpeg::tryagain(err)) {
-          if (tries > 500) {
+      while(err >= 0) {
+        err = ffmpeg::receiveFrame(*m_ctx);
+        if (ffmpeg::tryagain(err)) {
+          break;
+        } else if (err != 0) {
+          endRun(*watchdog, true);
+          break;
+        }
+        utils::PerfLogger::logEntry(m_ctx->name, utils::Key::Decoded, m_ctx->frameNumber, m_ctx->profile);
+        m_ctx->frameNumber = static_cast<int>(frameCount) + 1;
+        AVFrame* delivered = m_ctx->frame;
+        if (converter) {
+          av_frame_unref(converted);
+          err = converter->convert(m_ctx->frame, converted);
+          if (err < 0) {
+            std::cout << "Couldn't convert frame: " << ffmpeg::errorString(err) << std::endl;
+            endRun(*watchdog, true);
             break;
           }
-          std::this_thread::sleep_for(std::chrono::milliseconds(1));
-          err = ffmpeg::prepareFrame(*m_ctx);
-          ++tries;
+          delivered = converted;
         }
-        if (err != 0) {
-          m_running = false;
-          m_base.emitStreamFatalError();
+        // Single pooled frame keeps reference to all the planes of AVFrame
+        std::shared_ptr<FrameData> data = m_framePool->acquire(delivered, frameCount);
+        ++frameCount;
+        if (data) {
+          m_base.frameProduced(data, m_ctx->profile);
+        } else {
+          m_framesDropped.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (switchBegin) {
+          emitModeSwitched(*switchBegin, stopped);
+          switchBegin.reset();
+        }
+        if (recorder && !recorder->copiesPackets()) {
+          recorder->push(m_ctx->frame);
+        }
+        if (serveSnapshots(m_ctx->frame) && m_stopAfterSnapshots) {
+          m_base.emitStreamSnapShotTaken();
+          endRun(*watchdog, false);
           break;
         }
+      }
+      if (m_ctx->draining) {
+        // All frames of the input have been delivered, reader has either
+        // started over or stopped
+        ffmpeg::restartDecoder(*m_ctx);
+      }
+    }
+    // End of input unless stopped already
+    endRun(*watchdog, false);
+    packets->close();
+    reader.join();
+    if (recorder) {
+      // Failure of a pending open is known once the mux thread is done
+      stopRecorder(recorder);
+      std::optional<uint64_t> openFailed;
+      {
+        std::lock_guard<std::mutex> lock(m_recordingMutex);
+        std::swap(openFailed, m_openFailed);
+      }
+      if (writing && openFailed != writing) {
+        m_base.emitStreamStoppedRecording();
+      }
+    }
+    av_frame_free(&converted);
+    converter.reset();
+    ffmpeg::stop(*m_ctx);
+    ffmpeg::InputWatchdog* run = watchdog.get();
+    if (m_handoverRun.compare_exchange_strong(run, nullptr)) {
+      // Next run closes the input and may keep the decoder
+      m_handover = std::move(m_ctx);
+      return;
+    }
+    failSnapshots("Stream stopped before snapshot was taken");
+    m_ctx.reset();
+    m_base.emitStreamStopped();
+  }
 
-        while(err >= 0) {
-          err = ffmpeg::receiveFrame(*m_ctx);
-          if (ffmpeg::tryagain(err)) {
-            break;
-          } else if (err != 0) {
-            m_running = false;
-            m_base.emitStreamFatalError();
-            break;
-          }
-          utils::PerfLogger::logEntry(m_ctx->name, utils::Key::Decoded, m_ctx->frameNumber, m_ctx->profile);
-          m_ctx->frameNumber = static_cast<int>(frameCount) + 1;
-          std::vector<std::shared_ptr<video::FrameData>> data;
-          for (size_t i = 0; i < 8; ++i) {
-            int lineSize = m_ctx->frame->linesize[i];
-            if (lineSize != 0) {
-              // First plane is "master plane" that keeps reference to FFmpeg data
-              // alive. Rest of the planes are just forward references to original
-              // AVFrame plane data
-              auto frameData = std::make_shared<ffmpeg::AVFrameData>(data.empty());
-              frameData->refFrame(m_ctx->frame, i);
-              frameData->setFrameNumber(frameCount);
-              data.push_back(frameData);
-            }
-          }
-          ++frameCount;
-          m_base.frameProduced(data, m_ctx->profile);
-          if (isRecording) {
-            ffmpeg::currentFrameForOutput(m_ctx, recordingContext);
-            ffmpeg::addFrameToOutput(recordingContext);
-            ffmpeg::releaseFrameData(recordingContext);
-            if (recordingContext->isSnapshot) {
-              m_base.emitStreamSnapShotTaken();
-              m_running = false;
+  static double milliseconds(std::chrono::steady_clock::duration duration) {
+    return std::chrono::duration<double, std::milli>(duration).count();
+  }
+
+  void FFmpegStream::Core::emitModeSwitched(std::chrono::steady_clock::time_point begin,
+                                            std::chrono::steady_clock::time_point stopped) {
+    const ffmpeg::StartTimings& timings = m_ctx->timings;
+    auto now = std::chrono::steady_clock::now();
+    auto started = stopped + timings.close + timings.open + timings.streamInfo + timings.decoder;
+    m_base.emitStreamModeSwitched({
+      { "stop", milliseconds(stopped - begin) },
+      { "close", milliseconds(timings.close) },
+      { "open", milliseconds(timings.open) },
+      { "streamInfo", milliseconds(timings.streamInfo) },
+      { "decoder", milliseconds(timings.decoder) },
+      { "firstFrame", milliseconds(now - started) },
+      { "total", milliseconds(now - begin) },
+    }, timings.streamInfoSkipped, timings.decoderReused);
+  }
+
+  void FFmpegStream::Core::readPackets(ffmpeg::PacketQueue& packets, ffmpeg::InputWatchdog& watchdog,
+                                       int inputTimeout) {
+    while (!watchdog.interrupted()) {
+      AVPacket* packet = av_packet_alloc();
+      int err = packet ? ffmpeg::readPacket(*m_ctx, packet) : ffmpeg::outOfMemoryError();
+      if (ffmpeg::endOfInput(err) && !m_ctx->source.device) {
+        av_packet_free(&packet);
+        // Decoder delivers the frames it has buffered when it gets here
+        packets.push(nullptr);
+        if (m_ctx->source.loop && ffmpeg::rewind(*m_ctx)) {
+          continue;
+        }
+        break;
+      }
+      while (ffmpeg::tryagain(err) && !watchdog.expired()) {
+        ffmpeg::waitForInput(*m_ctx);
+        err = ffmpeg::readPacket(*m_ctx, packet);
+      }
+      if (err != 0) {
+        av_packet_free(&packet);
+        if (!watchdog.interrupted() && watchdog.expired()) {
+          inputTimedOut(watchdog, inputTimeout);
+        } else {
+          endRun(watchdog, true);
+        }
+        break;
+      }
+      if (!packets.push(packet)) {
+        // Decoder has stopped
+        break;
+      }
+    }
+    packets.close();
+  }
+
+  void FFmpegStream::Core::updateRecorder(std::shared_ptr<ffmpeg::Recorder>& recorder,
+                                          std::optional<uint64_t>& writing) {
+    std::optional<ffmpeg::RecordingOptions> recording;
+    std::optional<ffmpeg::RecordingOptions> preRoll;
+    uint64_t generation;
+    std::optional<uint64_t> openFailed;
+    {
+      std::lock_guard<std::mutex> lock(m_recordingMutex);
+      if (m_recording) {
+        recording = m_recordingOptions;
+      }
+      preRoll = m_preRollOptions;
+      generation = m_recordingGeneration;
+      std::swap(openFailed, m_openFailed);
+    }
+
+    if (writing && openFailed == writing) {
+      // No file was opened, so there is nothing to report stopped
+      writing.reset();
+    }
+    if (writing && !recording) {
+      writing.reset();
+      if (preRoll && recorder->preRolls()) {
+        recorder->close();
+      } else {
+        // Flushes the encoder before the file is closed
+        stopRecorder(recorder);
+      }
+      m_base.emitStreamStoppedRecording();
+    }
+    if (recorder && !writing && !(preRoll && recorder->preRolls())) {
+      // Pre-roll was disabled
+      stopRecorder(recorder);
+    }
+
+    if (!recorder && (recording || preRoll)) {
+      // Encoder follows the pre-roll options, recording only picks the file
+      const ffmpeg::RecordingOptions& encoding = preRoll ? *preRoll : *recording;
+      auto result = ffmpeg::Recorder::start(std::make_unique<ffmpeg::OutputContext>(encoding), m_ctx);
+      if (std::holds_alternative<std::string>(result)) {
+        {
+          std::lock_guard<std::mutex> lock(m_recordingMutex);
+          m_recording = false;
+          m_preRollOptions.reset();
+        }
+        m_base.emitStreamFailedRecording(std::get<std::string>(result));
+        return;
+      }
+      recorder = std::get<std::shared_ptr<ffmpeg::Recorder>>(result);
+      std::atomic_store(&m_recorder, recorder);
+      if (recorder->copiesPackets()) {
+        ffmpeg::Recorder* copying = recorder.get();
+        ffmpeg::setPacketCallback(*m_ctx, [copying](const AVPacket& packet) { copying->push(packet); });
+      }
+    }
+
+    if (recorder && recording && !writing) {
+      writing = generation;
+      recorder->open(*recording, [this, generation](std::optional<std::string> error) {
+        if (error) {
+          {
+            std::lock_guard<std::mutex> lock(m_recordingMutex);
+            m_openFailed = generation;
+            // Newer startRecording has options of its own to try
+            if (m_recordingGeneration == generation) {
               m_recording = false;
-              break;
             }
           }
+          m_base.emitStreamFailedRecording(*error);
+        } else {
+          m_base.emitStreamStartedRecording();
         }
+      });
+    }
+  }
+
+  bool FFmpegStream::Core::serveSnapshots(const AVFrame* frame) {
+    if (!m_snapshotsPending) {
+      return false;
+    }
+    std::lock_guard<std::mutex> lock(m_snapshotMutex);
+    for (auto it = m_snapshots.begin(); it != m_snapshots.end();) {
+      if ((*it)->add(frame)) {
+        SnapshotRequest::finish(std::move(*it));
+        it = m_snapshots.erase(it);
+      } else {
+        ++it;
       }
-      if (isRecording) {
-        bool snapshot = recordingContext->isSnapshot;
-        ffmpeg::stopOutput(recordingContext);
-        if (!snapshot) {
-          m_base.emitStreamStoppedRecording();
-        }
-        recordingContext.reset();
-      }
-      ffmpeg::stop(*m_ctx);
-      m_ctx.reset();
-      m_base.emitStreamStopped();
-    };
-    m_workerThread = std::make_unique<std::thread>(work);
+    }
+    m_snapshotsPending = !m_snapshots.empty();
+    return m_snapshots.empty();
+  }
+
+  void FFmpegStream::Core::failSnapshots(const std::string& error) {
+    std::lock_guard<std::mutex> lock(m_snapshotMutex);
+    for (std::unique_ptr<SnapshotRequest>& request : m_snapshots) {
+      SnapshotRequest::finish(std::move(request), error);
+    }
+    m_snapshots.clear();
+    m_snapshotsPending = false;
+  }
+
+  void FFmpegStream::Core::stopRecorder(std::shared_ptr<ffmpeg::Recorder>& recorder) {
+    ffmpeg::setPacketCallback(*m_ctx, nullptr);
+    std::atomic_store(&m_recorder, std::shared_ptr<ffmpeg::Recorder>());
+    // Waits for the queued frames to be written
+    recorder->stop();
+    recorder.reset();
   }
 
   // Couldn't get real polymorphism to work so need to do this by hand +
   // copy pasting..
   void FFmpegStream::addFrameCallback(const Napi::CallbackInfo& info) {
-    m_base.addFrameCallback(info);
+    m_core->m_base.addFrameCallback(info);
   }
 
   void FFmpegStream::clearFrameCallbacks(const Napi::CallbackInfo& info) {
-    m_base.clearFrameCallbacks(info);
+    m_core->m_base.clearFrameCallbacks(info);
+  }
+
+  void FFmpegStream::addTap(const Napi::CallbackInfo& info) {
+    m_core->m_base.addTap(info);
+  }
+
+  void FFmpegStream::removeTap(const Napi::CallbackInfo& info) {
+    m_core->m_base.removeTap(info);
   }
 
   void FFmpegStream::setEventListener(const Napi::CallbackInfo& info) {
-    m_base.setEventListener(info);
+    m_core->m_base.setEventListener(info);
   }
 
   void FFmpegStream::removeEventListener(const Napi::CallbackInfo&) {
-    m_base.removeEventListener();
+    m_core->m_base.removeEventListener();
   }
 
   Napi::Value FFmpegStream::enableRemoteStream(const Napi::CallbackInfo& info) {
-    return m_base.enableRemoteStream(info);
+    return m_core->m_base.enableRemoteStream(info);
   }
 
   void FFmpegStream::disableRemoteStream(const Napi::CallbackInfo& info) {
-    m_base.disableRemoteStream(info);
+    m_core->m_base.disableRemoteStream(info);
   }
 
   Napi::Value FFmpegStream::isActive(const Napi::CallbackInfo& info) {
-    return Napi::Boolean::New(info.Env(), m_running);
+    return Napi::Boolean::New(info.Env(), m_core->m_running);
   }
 
   Napi::Value FFmpegStream::latestFrameStats(const Napi::CallbackInfo& info) {
-    return m_base.latestFrameStats(info);
+    Napi::Object stats = m_core->m_base.latestFrameStats(info).As<Napi::Object>();
+    stats.Set("poolHits", m_core->m_framePool->hits());
+    stats.Set("poolMisses", m_core->m_framePool->misses());
+    stats.Set("poolAvailable", m_core->m_framePool->available());
+    stats.Set("framesDropped", m_core->m_framesDropped.load(std::memory_order_relaxed));
+    if (std::shared_ptr<ffmpeg::InputWatchdog> watchdog = std::atomic_load(&m_core->m_watchdog)) {
+      stats.Set("inputStalls", watchdog->stalls());
+      stats.Set("inputStalled", watchdog->stalled());
+    }
+    if (std::shared_ptr<ffmpeg::PacketQueue> packets = std::atomic_load(&m_core->m_packets)) {
+      stats.Set("packetQueueDepth", packets->size());
+      stats.Set("packetQueueCapacity", packets->capacity());
+      stats.Set("packetsDropped", packets->dropped());
+    }
+    if (std::shared_ptr<ffmpeg::Recorder> recorder = std::atomic_load(&m_core->m_recorder)) {
+      Napi::Env env = info.Env();
+      std::vector<ffmpeg::RecorderStageStats> stages = recorder->stats();
+      Napi::Array recordingStages = Napi::Array::New(env, stages.size());
+      for (uint32_t i = 0; i < stages.size(); ++i) {
+        Napi::Object stage = Napi::Object::New(env);
+        stage.Set("name", stages[i].name);
+        stage.Set("queueDepth", stages[i].queueDepth);
+        stage.Set("queueCapacity", stages[i].queueCapacity);
+        stage.Set("dropped", stages[i].dropped);
+        stage.Set("processed", stages[i].processed);
+        stage.Set("latency", stages[i].latency);
+        recordingStages[i] = stage;
+      }
+      stats.Set("recordingStages", recordingStages);
+    }
+    return stats;
   }
 
   Napi::Value FFmpegStream::isRecording(const Napi::CallbackInfo& info) {
-    return Napi::Boolean::New(info.Env(), m_recording);
+    std::lock_guard<std::mutex> lock(m_core->m_recordingMutex);
+    return Napi::Boolean::New(info.Env(), m_core->m_recording);
   }
 
   void FFmpegStream::startRecording(const Napi::CallbackInfo& info) {
@@ -321,23 +746,43 @@ namespace video {
     if (info.Length() == 0 || !info[0].IsObject()) {
       Napi::TypeError::New(env, "Requires RecordingOptions as parameter")
               .ThrowAsJavaScriptException();
+      return;
     }
-    Napi::Object options = info[0].As<Napi::Object>();
-    Napi::Value target = options["outputPath"];
-    if (!target.IsString()) {
-      Napi::TypeError::New(env, "outputPath needs to be string")
-              .ThrowAsJavaScriptException();
-    }
-    startRecording(target.As<Napi::String>(), false);
+    startRecording(RecordingOptions::convert(info[0].As<Napi::Object>()));
   }
 
-  void FFmpegStream::startRecording(const std::string& outputPath, bool snapshot) {
-    m_recordingContext = std::make_unique<ffmpeg::OutputContext>(outputPath, snapshot);
-    m_recording = true;
+  void FFmpegStream::startRecording(const ffmpeg::RecordingOptions& options) {
+    std::lock_guard<std::mutex> lock(m_core->m_recordingMutex);
+    m_core->m_recordingOptions = options;
+    m_core->m_recording = true;
+    ++m_core->m_recordingGeneration;
   }
 
   void FFmpegStream::stopRecording(const Napi::CallbackInfo&) {
-    m_recording = false;
+    std::lock_guard<std::mutex> lock(m_core->m_recordingMutex);
+    m_core->m_recording = false;
+  }
+
+  void FFmpegStream::enablePreRoll(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (info.Length() == 0 || !info[0].IsObject()) {
+      Napi::TypeError::New(env, "Requires RecordingOptions as parameter")
+              .ThrowAsJavaScriptException();
+      return;
+    }
+    ffmpeg::RecordingOptions options = RecordingOptions::convert(info[0].As<Napi::Object>(), false);
+    if (options.preRoll <= 0) {
+      Napi::TypeError::New(env, "preRoll needs to be positive")
+              .ThrowAsJavaScriptException();
+      return;
+    }
+    std::lock_guard<std::mutex> lock(m_core->m_recordingMutex);
+    m_core->m_preRollOptions = options;
+  }
+
+  void FFmpegStream::disablePreRoll(const Napi::CallbackInfo&) {
+    std::lock_guard<std::mutex> lock(m_core->m_recordingMutex);
+    m_core->m_preRollOptions.reset();
   }
 
 } // namespace video
@@ -2,16 +2,30 @@
 
 #include "napi_include.hpp"
 
+#include <atomic>
+#include <chrono>
+#include <future>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "../common.hpp"
 
+#include "Snapshot.hpp"
 #include "Stream.hpp"
 
+#include "../ffmpeg/FramePool.hpp"
 #include "../ffmpeg/StreamContext.hpp"
 #include "../ffmpeg/OutputContext.hpp"
+#include "../ffmpeg/RecordingOptions.hpp"
+
+namespace ffmpeg {
+  class PacketQueue;
+  class Recorder;
+}
 
 namespace video {
 
@@ -27,6 +41,10 @@ namespace video {
     static Napi::Value create(
       const Napi::CallbackInfo& info,
       const std::string& name);
+    static Napi::Value create(Napi::Env env, const std::string& name);
+
+    // Stream reading a file, URL or lavfi graph instead of a capture device
+    static Napi::Value createFileStream(const Napi::CallbackInfo& info);
 
 
     FFmpegStream(const Napi::CallbackInfo& info);
@@ -34,20 +52,33 @@ namespace video {
     ~FFmpegStream();
 
     Napi::Value name(const Napi::CallbackInfo& info);
+    // Cached after the first probe, see ffmpeg::DeviceRegistry
     Napi::Value videoModes(const Napi::CallbackInfo& info);
+    Napi::Value videoModesAsync(const Napi::CallbackInfo& info);
     Napi::Value format(const Napi::CallbackInfo& info);
 
     const std::string& cppName() const;
 
-    void takeSnapshot(const Napi::CallbackInfo&);
+    // Encodes the next frame(s) of a running stream in the background. Stream
+    // that isn't running is started for the snapshot and stopped after it.
+    Napi::Value takeSnapshot(const Napi::CallbackInfo& info);
 
     void start(const Napi::CallbackInfo&);
-    void start(const ffmpeg::VideoMode& mode);
+    // Switch begins at the time given, the first frame of the new mode
+    // emits mode-switched with the time spent in each phase
+    void start(const ffmpeg::VideoMode& mode,
+               std::optional<std::chrono::steady_clock::time_point> switchBegin = std::nullopt);
     void stop(const Napi::CallbackInfo&);
     void stop();
+    // Restarts a running stream in another mode, keeping the frame
+    // callbacks, pending snapshots and the decoder when the stream only
+    // changes its frame rate
+    void switchMode(const Napi::CallbackInfo& info);
 
     void addFrameCallback(const Napi::CallbackInfo& info);
     void clearFrameCallbacks(const Napi::CallbackInfo&);
+    void addTap(const Napi::CallbackInfo& info);
+    void removeTap(const Napi::CallbackInfo& info);
 
     void setEventListener(const Napi::CallbackInfo& info);
     void removeEventListener(const Napi::CallbackInfo& info);
@@ -61,16 +92,105 @@ namespace video {
 
     Napi::Value isRecording(const Napi::CallbackInfo& info);
     void startRecording(const Napi::CallbackInfo& info);
-    void startRecording(const std::string& outputPath, bool snapshot);
+    void startRecording(const ffmpeg::RecordingOptions& options);
     void stopRecording(const Napi::CallbackInfo& info);
 
+    // Keeps encoding the last preRoll seconds while not recording, so
+    // startRecording can include what happened before it was called
+    void enablePreRoll(const Napi::CallbackInfo& info);
+    void disablePreRoll(const Napi::CallbackInfo& info);
+
   private:
-    Stream m_base;
-    std::unique_ptr<ffmpeg::StreamContext> m_ctx;
-    std::unique_ptr<std::thread> m_workerThread;
-    bool m_running;
-    bool m_recording;
-    std::unique_ptr<ffmpeg::OutputContext> m_recordingContext; // only use in main thread when creating
+    // How long stop waits for the worker to finish
+    static constexpr std::chrono::milliseconds StopTimeout{2000};
+
+    /**
+     *  State of the stream used by the threads of its runs. Workers keep
+     *  their own reference, so a stream collected while its worker is stuck
+     *  in a driver leaves the worker behind instead of waiting for it.
+     */
+    class Core {
+    public:
+      Core();
+
+      const std::string& cppName() const;
+
+      // Any thread: makes the threads of the current run finish
+      void interruptRun();
+      // Worker thread: opens the input and decodes it until the run of
+      // watchdog ends
+      void run(const ffmpeg::VideoMode& mode, std::shared_ptr<ffmpeg::InputWatchdog> watchdog,
+               std::optional<std::chrono::steady_clock::time_point> switchBegin);
+      // Worker, reader and watchdog threads: stops the run of watchdog, fatal
+      // errors are emitted unless it was stopped already. Returns false if it
+      // was.
+      bool endRun(ffmpeg::InputWatchdog& watchdog, bool fatal);
+      // Reader and watchdog threads: ends the run whose input has timed out
+      void inputTimedOut(ffmpeg::InputWatchdog& watchdog, int inputTimeout);
+      // Reader thread: queues the packets of the input for the worker until
+      // the end of input, an error or stop
+      void readPackets(ffmpeg::PacketQueue& packets, ffmpeg::InputWatchdog& watchdog, int inputTimeout);
+      // Worker thread: starts, opens, closes and stops the recorder to match
+      // the recording and pre-roll requested
+      void updateRecorder(std::shared_ptr<ffmpeg::Recorder>& recorder,
+                          std::optional<uint64_t>& writing);
+      void stopRecorder(std::shared_ptr<ffmpeg::Recorder>& recorder);
+      // Worker thread: gives frame to the waiting snapshots. Returns true if
+      // snapshots were taken and none are left.
+      bool serveSnapshots(const AVFrame* frame);
+      void failSnapshots(const std::string& error);
+      // Worker thread: on the first frame of a switched mode
+      void emitModeSwitched(std::chrono::steady_clock::time_point begin,
+                            std::chrono::steady_clock::time_point stopped);
+
+      Stream m_base;
+      ffmpeg::InputSource m_source;
+      std::unique_ptr<ffmpeg::StreamContext> m_ctx;
+      // Stream was started and hasn't been stopped, threads of a run check
+      // its watchdog instead
+      std::atomic<bool> m_running;
+      // Watches the input of the current run, replaced on each start
+      std::shared_ptr<ffmpeg::InputWatchdog> m_watchdog;
+      // Packets between the reader and the worker of the current run, kept
+      // for stats
+      std::shared_ptr<ffmpeg::PacketQueue> m_packets;
+      // Run (by its watchdog) being replaced by switchMode, it leaves its
+      // context for the next worker
+      std::atomic<ffmpeg::InputWatchdog*> m_handoverRun;
+      std::unique_ptr<ffmpeg::StreamContext> m_handover;
+      bool m_recording;
+      // Set from the main thread, picked up by the worker
+      std::mutex m_recordingMutex;
+      ffmpeg::RecordingOptions m_recordingOptions;
+      // Counts startRecording calls so a late failure only ends its own
+      uint64_t m_recordingGeneration;
+      // Recording whose file failed to open, for the worker to pick up
+      std::optional<uint64_t> m_openFailed;
+      std::optional<ffmpeg::RecordingOptions> m_preRollOptions;
+      // Owned by the worker thread, shared for stats
+      std::shared_ptr<ffmpeg::Recorder> m_recorder;
+      std::shared_ptr<ffmpeg::FramePool> m_framePool;
+      // Decoded frames that couldn't be handed to the callbacks
+      std::atomic<uint64_t> m_framesDropped;
+      std::mutex m_snapshotMutex;
+      std::vector<std::unique_ptr<SnapshotRequest>> m_snapshots;
+      // Lets the worker skip locking when no snapshots are waiting
+      std::atomic<bool> m_snapshotsPending;
+      // Stream was started only for the snapshots
+      bool m_stopAfterSnapshots;
+    };
+
+    ffmpeg::VideoMode requestedMode(const Napi::CallbackInfo& info);
+    // Returns false if the worker didn't finish in time, it's then joined
+    // by the next worker or left behind by the destructor
+    bool joinWorker(std::chrono::milliseconds timeout);
+
+    std::shared_ptr<Core> m_core;
+    // Worker of the latest run, set once it has finished
+    std::thread m_workerThread;
+    std::future<void> m_workerDone;
+    // Pixel format frames are converted to, if any
+    AVPixelFormat m_outputFormat;
   };
 
 } // namespace video
@@ -1,6 +1,7 @@
 #include "napi_include.hpp"
 
 #include "Frame.hpp"
+#include "ImageOptions.hpp"
 
 #include <iostream>
 
@@ -45,46 +46,65 @@ namespace video {
   }
 
   FrameData::FrameData()
-    : m_data(nullptr),
-      m_length(0),
-      m_width(0),
-      m_height(0),
+    : m_planeCount(0),
       m_frameNumber(0)
   {
   }
 
   FrameData::FrameData(uint8_t* data, unsigned length, unsigned width, unsigned height, unsigned frame)
-    : m_data(data),
-      m_length(length),
-      m_width(width),
-      m_height(height),
-      m_frameNumber(frame)
+    : m_planeCount(0),
+      m_frameNumber(frame),
+      m_buffer(data)
+  {
+    addPlane(data, length, width, height);
+  }
+
+  FrameData::FrameData(std::unique_ptr<uint8_t[]> buffer, unsigned frame)
+    : m_planeCount(0),
+      m_frameNumber(frame),
+      m_buffer(std::move(buffer))
   {
   }
 
   FrameData::~FrameData() {
-    if (m_data)
-      delete m_data;
   }
 
-  unsigned FrameData::width() const {
-    return m_width;
+  void FrameData::addPlane(uint8_t* data, unsigned length, unsigned width, unsigned height) {
+    if (m_planeCount < MaxPlanes) {
+      m_planes[m_planeCount++] = Plane{data, length, width, height};
+    }
+  }
+
+  void FrameData::clearPlanes() {
+    m_planeCount = 0;
+  }
+
+  size_t FrameData::planes() const {
+    return m_planeCount;
+  }
+
+  unsigned FrameData::width(size_t plane) const {
+    return m_planes[plane].width;
   }
 
-  unsigned FrameData::height() const {
-    return m_height;
+  unsigned FrameData::height(size_t plane) const {
+    return m_planes[plane].height;
   }
 
-  unsigned FrameData::length() const {
-    return m_length;
+  unsigned FrameData::length(size_t plane) const {
+    return m_planes[plane].length;
   }
 
   unsigned FrameData::frameNumber() const {
     return m_frameNumber;
   }
 
-  uint8_t* FrameData::data() {
-    return m_data;
+  uint8_t* FrameData::data(size_t plane) {
+    return m_planes[plane].data;
+  }
+
+  const AVFrame* FrameData::avFrame() const {
+    return nullptr;
   }
 
   Napi::Object Frame::Init(
@@ -98,6 +118,7 @@ namespace video {
       InstanceMethod<&Frame::height>("height"),
       InstanceMethod<&Frame::frameNumber>("frameNumber"),
       InstanceMethod<&Frame::planes>("planes"),
+      InstanceMethod<&Frame::encode>("encode"),
     });
 
     exports.Set("Frame", func);
@@ -109,9 +130,9 @@ namespace video {
     return exports;
   }
 
-  Napi::Value Frame::create(Napi::Env env, std::vector<std::shared_ptr<FrameData>> data)
+  Napi::Value Frame::create(Napi::Env env, std::shared_ptr<FrameData> data)
   {
-    if (data.empty())
+    if (!data || data->planes() == 0)
       return env.Null();
     ConstructorMap& ctors = env.GetInstanceData<InstanceData>()->constructors;
     auto& ctor = ctors[FRAME_CTOR];
@@ -125,48 +146,125 @@ namespace video {
   {}
 
   Frame::~Frame() {
+    m_textures.Reset();
   }
 
-  std::shared_ptr<FrameData> Frame::getPlane(const Napi::CallbackInfo& info) const {
+  size_t Frame::getPlane(const Napi::CallbackInfo& info) const {
     size_t plane = 0;
     if (info.Length() > 0 && info[0].IsNumber()) {
       plane = info[0].As<Napi::Number>().Uint32Value();
     }
-    return m_data[plane];
+    if (plane >= m_data->planes()) {
+      throw Napi::RangeError::New(info.Env(), "Plane index out of range");
+    }
+    return plane;
   }
 
   Napi::Value Frame::width(const Napi::CallbackInfo& info) {
-    return Napi::Number::New(info.Env(), getPlane(info)->width());
+    return Napi::Number::New(info.Env(), m_data->width(getPlane(info)));
   }
 
   Napi::Value Frame::height(const Napi::CallbackInfo& info) {
-    return Napi::Number::New(info.Env(), getPlane(info)->height());
+    return Napi::Number::New(info.Env(), m_data->height(getPlane(info)));
   }
 
   Napi::Value Frame::planes(const Napi::CallbackInfo& info) {
-    return Napi::Number::New(info.Env(), m_data.size());
+    return Napi::Number::New(info.Env(), m_data->planes());
   }
 
   Napi::Value Frame::getTextures(const Napi::CallbackInfo& info) {
+    if (!m_textures.IsEmpty()) {
+      return m_textures.Value();
+    }
     Napi::Array result = Napi::Array::New(info.Env());
 
-    for(size_t i = 0; i < m_data.size(); ++i) {
-      std::shared_ptr<FrameData> data = m_data[i];
+    for(size_t i = 0; i < m_data->planes(); ++i) {
+      // External buffer without copy, finalizer drops the reference to frame
       auto buffer = Napi::Buffer<uint8_t>::New(
         info.Env(),
-        data->data(),
-        data->length());
+        m_data->data(i),
+        m_data->length(i),
+        [](Napi::Env, uint8_t*, std::shared_ptr<FrameData>* frame) {
+          delete frame;
+        },
+        new std::shared_ptr<FrameData>(m_data));
       result.Set(uint32_t(i), buffer);
     }
+    m_textures = Napi::Persistent(result);
     return result;
   }
 
   Napi::Value Frame::frameNumber(const Napi::CallbackInfo& info) {
-    return Napi::Number::New(info.Env(), m_data[0]->frameNumber());
+    return Napi::Number::New(info.Env(), m_data->frameNumber());
   }
 
   unsigned Frame::frameNumberRaw() const {
-    return m_data[0]->frameNumber();
+    return m_data->frameNumber();
+  }
+
+  // Encodes in libuv thread pool, frame is kept alive until done
+  class FrameEncodeWorker : public Napi::AsyncWorker {
+  public:
+    FrameEncodeWorker(
+      Napi::Env env,
+      std::shared_ptr<FrameData> data,
+      const ffmpeg::ImageOptions& options)
+      : Napi::AsyncWorker(env),
+        m_deferred(Napi::Promise::Deferred::New(env)),
+        m_data(std::move(data)),
+        m_options(options),
+        m_image(nullptr)
+    {}
+
+    ~FrameEncodeWorker() {
+      av_packet_free(&m_image);
+    }
+
+    Napi::Promise promise() const {
+      return m_deferred.Promise();
+    }
+
+  protected:
+    void Execute() override {
+      const AVFrame* frame = m_data->avFrame();
+      if (!frame) {
+        SetError("Frame has no known pixel format to encode from");
+        return;
+      }
+      auto image = ffmpeg::ImageEncoder::shared().encode(frame, m_options);
+      if (std::holds_alternative<std::string>(image)) {
+        SetError(std::get<std::string>(image));
+      } else {
+        m_image = std::get<AVPacket*>(image);
+      }
+    }
+
+    void OnOK() override {
+      AVPacket* image = m_image;
+      m_image = nullptr;
+      m_deferred.Resolve(imageBuffer(Env(), image));
+    }
+
+    void OnError(const Napi::Error& error) override {
+      m_deferred.Reject(error.Value());
+    }
+
+  private:
+    Napi::Promise::Deferred m_deferred;
+    std::shared_ptr<FrameData> m_data;
+    ffmpeg::ImageOptions m_options;
+    AVPacket* m_image;
+  };
+
+  Napi::Value Frame::encode(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    bool hasOptions = info.Length() > 0 && info[0].IsObject();
+    ffmpeg::ImageOptions options = ImageOptions::convert(
+      hasOptions ? info[0].As<Napi::Object>() : Napi::Object::New(env));
+    auto worker = new FrameEncodeWorker(env, m_data, options);
+    Napi::Promise promise = worker->promise();
+    worker->Queue();
+    return promise;
   }
 
 } // namespace video
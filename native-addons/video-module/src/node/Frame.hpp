@@ -1,15 +1,16 @@
 #pragma once
 
 #include "napi_include.hpp"
+#include <array>
 #include <memory>
 
 #include "../common.hpp"
 
+struct AVFrame;
+
 namespace video {
 
   // TODO:
-  // - Should the raw data be stored within the stream and allocated
-  //   deallocated using Circular buffer or similar
   // - If need for shared memory should the implementation lie in Frame or
   //   Stream?
 
@@ -19,29 +20,53 @@ namespace video {
    *  FrameData is only usable from the C++. The approach to Frame & FrameData
    *  needs to be two-tiered (FrameData & Frame) because there is a need to
    *  separate the management of the resources from the Node-interface.
+   *
+   *  Single FrameData holds all the planes of the frame. Width of the plane is
+   *  the width of the frame, height is the amount of rows in the plane and
+   *  length is height * line size.
    */
   class FrameData {
   public:
+    static constexpr size_t MaxPlanes = 8;
+
     static std::shared_ptr<FrameData> createTestTexture(int phase, int w, int h, int frameNumber);
 
     FrameData();
+    // Single plane frame, takes ownership of data allocated with new[]
     FrameData(uint8_t* data, unsigned length, unsigned width, unsigned height, unsigned frame);
+    // Planes are added with addPlane and point into owned buffer
+    FrameData(std::unique_ptr<uint8_t[]> buffer, unsigned frame);
     virtual ~FrameData();
 
-    unsigned width() const;
-    unsigned height() const;
+    void addPlane(uint8_t* data, unsigned length, unsigned width, unsigned height);
+
+    size_t planes() const;
+    unsigned width(size_t plane = 0) const;
+    unsigned height(size_t plane = 0) const;
+    unsigned length(size_t plane = 0) const;
+    uint8_t* data(size_t plane = 0);
 
-    unsigned length() const;
     unsigned frameNumber() const;
 
-    uint8_t* data();
+    // Decoded FFmpeg frame behind the planes, if any
+    virtual const AVFrame* avFrame() const;
 
   protected:
-    uint8_t* m_data;
-    unsigned m_length;
-    unsigned m_width;
-    unsigned m_height;
+    struct Plane {
+      uint8_t* data;
+      unsigned length;
+      unsigned width;
+      unsigned height;
+    };
+
+    void clearPlanes();
+
+    std::array<Plane, MaxPlanes> m_planes;
+    size_t m_planeCount;
     unsigned m_frameNumber;
+
+  private:
+    std::unique_ptr<uint8_t[]> m_buffer;
   };
 
   /**
@@ -58,7 +83,7 @@ namespace video {
       Napi::Object exports,
       ConstructorMap& ctors);
 
-    static Napi::Value create(Napi::Env env, std::vector<std::shared_ptr<FrameData>> data);
+    static Napi::Value create(Napi::Env env, std::shared_ptr<FrameData> data);
 
     Frame(const Napi::CallbackInfo& info);
     ~Frame();
@@ -72,10 +97,17 @@ namespace video {
     Napi::Value frameNumber(const Napi::CallbackInfo& info);
     unsigned frameNumberRaw() const;
 
+    // Encodes the frame as still image in the libuv thread pool, returns
+    // Promise of Buffer
+    Napi::Value encode(const Napi::CallbackInfo& info);
+
   private:
-    std::shared_ptr<FrameData> getPlane(const Napi::CallbackInfo& info) const;
+    size_t getPlane(const Napi::CallbackInfo& info) const;
 
-    std::vector<std::shared_ptr<FrameData>> m_data;
+    std::shared_ptr<FrameData> m_data;
+    // Array of Buffers returned by getTextures. Each Buffer keeps the frame
+    // data alive, so the Buffers stay valid even after Frame is collected.
+    Napi::ObjectReference m_textures;
   };
 
 } // namespace video
@@ -0,0 +1,83 @@
+#include "FrameRing.hpp"
+#include "Stream.hpp"
+
+#include <algorithm>
+
+namespace video {
+
+  FrameRing::FrameRing(size_t depth)
+    : m_slots(new Slot[std::max<size_t>(depth, 1)]),
+      m_depth(std::max<size_t>(depth, 1)),
+      m_writeIndex(0),
+      m_dropped(0)
+  {
+    for (size_t i = 0; i < m_depth; ++i) {
+      m_slots[i].key = static_cast<SlotKey>(i);
+    }
+  }
+
+  size_t FrameRing::depth() const {
+    return m_depth;
+  }
+
+  FrameRing::SlotKey* FrameRing::publish(const std::shared_ptr<FrameData>& data, int references) {
+    // Normally the slot at write index is free because callbacks are executed
+    // in order. Scan the rest of the ring in case some consumer still holds
+    // on to an older frame.
+    for (size_t i = 0; i < m_depth; ++i) {
+      Slot& slot = m_slots[(m_writeIndex + i) % m_depth];
+      if (!slot.free.load(std::memory_order_acquire)) {
+        continue;
+      }
+      slot.data = data;
+      slot.references.store(references, std::memory_order_relaxed);
+      slot.free.store(false, std::memory_order_release);
+      m_writeIndex = (m_writeIndex + i + 1) % m_depth;
+      return &slot.key;
+    }
+    m_dropped.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+  }
+
+  std::shared_ptr<FrameData> FrameRing::peek(SlotKey key) const {
+    return m_slots[static_cast<size_t>(key)].data;
+  }
+
+  void FrameRing::release(SlotKey key) {
+    Slot& slot = m_slots[static_cast<size_t>(key)];
+    if (slot.references.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      // Last reference, clear data before handing slot back to producer
+      slot.data.reset();
+      slot.free.store(true, std::memory_order_release);
+    }
+  }
+
+  bool FrameRing::idle() const {
+    for (size_t i = 0; i < m_depth; ++i) {
+      if (!m_slots[i].free.load(std::memory_order_acquire)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool FrameRing::deliver(const std::shared_ptr<FrameData>& data,
+                          const std::vector<std::shared_ptr<FrameConsumer>>& consumers) {
+    // One reference per consumer + one held by us until all calls are made
+    int references = static_cast<int>(consumers.size()) + 1;
+    SlotKey* keyPtr = publish(data, references);
+    if (!keyPtr) {
+      return false;
+    }
+    for (const std::shared_ptr<FrameConsumer>& consumer : consumers) {
+      consumer->deliver(keyPtr);
+    }
+    release(*keyPtr);
+    return true;
+  }
+
+  uint64_t FrameRing::dropped() const {
+    return m_dropped.load(std::memory_order_relaxed);
+  }
+
+} // namespace video
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "Frame.hpp"
+
+namespace video {
+
+  class FrameConsumer;
+
+  /**
+   *  Fixed-capacity ring of reference counted frame slots.
+   *
+   *  Getting FrameData out of the arbitrary worker thread for the Frame-
+   *  object tied to JS runtime requires some technical plumbing. Because
+   *  frameProduced can be called from arbitrary thread the callbacks
+   *  executed in Node runtime's main thread are not immediately executed.
+   *  The passed FrameData needs to be kept alive at least as long before the
+   *  callbacks have been executed, so it is parked into a slot and the key of
+   *  the slot is handed to the thread-safe function.
+   *
+   *  There is exactly one producer (the stream worker thread) that publishes
+   *  frames. Slots are released from the main thread by the callbacks (and by
+   *  the producer itself for calls that failed). No locks are taken:
+   *  - the producer only touches slots that are marked free
+   *  - the slot is marked free only after the last reference has been
+   *    released and the data has been cleared
+   *
+   *  When the ring is full (the main thread has fallen `depth` frames behind)
+   *  the newly produced frame is dropped and counted. This keeps the worker
+   *  thread from ever waiting on the main thread and bounds the memory used
+   *  for frames waiting for delivery.
+   */
+  class FrameRing {
+  public:
+    typedef int SlotKey;
+    static constexpr size_t DefaultDepth = 4;
+
+    FrameRing(size_t depth);
+
+    size_t depth() const;
+
+    // Producer side. Stores data with given amount of references and returns
+    // pointer to key of the slot or nullptr if the ring is full. Pointer stays
+    // valid as long as the ring is alive.
+    SlotKey* publish(const std::shared_ptr<FrameData>& data, int references);
+    // Producer side. Publishes data with a reference for each consumer and
+    // hands the slot to them. Returns false if the ring is full.
+    bool deliver(const std::shared_ptr<FrameData>& data,
+                 const std::vector<std::shared_ptr<FrameConsumer>>& consumers);
+
+    // Returns data of the slot. Caller needs to own a reference to the slot
+    std::shared_ptr<FrameData> peek(SlotKey key) const;
+    void release(SlotKey key);
+
+    // True if no slot is in use
+    bool idle() const;
+    uint64_t dropped() const;
+
+  private:
+    struct Slot {
+      std::shared_ptr<FrameData> data;
+      SlotKey key = 0;
+      std::atomic<int> references{0};
+      std::atomic<bool> free{true};
+    };
+
+    std::unique_ptr<Slot[]> m_slots;
+    const size_t m_depth;
+    // Only accessed by the producer
+    size_t m_writeIndex;
+    std::atomic<uint64_t> m_dropped;
+  };
+
+} // namespace video
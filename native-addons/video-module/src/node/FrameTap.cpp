@@ -0,0 +1,109 @@
+#include "FrameTap.hpp"
+
+#include "Stream.hpp"
+#include "../ffmpeg/ffmpeg.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+namespace video {
+
+  FrameTap::FrameTap(const std::string& name, const TapOptions& options)
+    : m_name(name),
+      m_every(std::max(options.every, 1)),
+      m_counter(0),
+      m_ring(std::make_shared<FrameRing>(options.queueDepth)),
+      m_framePool(ffmpeg::FramePool::create()),
+      m_converter(options.conversion),
+      m_frames(QueueSize, utils::OverflowPolicy::Drop),
+      m_failed(0)
+  {
+    m_thread = std::thread(&FrameTap::loop, this);
+  }
+
+  FrameTap::~FrameTap() {
+    m_frames.close();
+    m_thread.join();
+    clearConsumers();
+  }
+
+  const std::string& FrameTap::name() const {
+    return m_name;
+  }
+
+  void FrameTap::push(const std::shared_ptr<FrameData>& frame) {
+    if (m_counter++ % static_cast<uint64_t>(m_every) == 0) {
+      m_frames.push(frame);
+    }
+  }
+
+  std::shared_ptr<FrameRing> FrameTap::ring() const {
+    return m_ring;
+  }
+
+  void FrameTap::addConsumer(std::shared_ptr<FrameConsumer> consumer) {
+    std::lock_guard<std::mutex> lock(m_consumerMutex);
+    m_consumers.push_back(consumer);
+  }
+
+  uint64_t FrameTap::clearConsumers() {
+    std::lock_guard<std::mutex> lock(m_consumerMutex);
+    uint64_t skipped = 0;
+    for (const std::shared_ptr<FrameConsumer>& consumer : m_consumers) {
+      skipped += consumer->skipped();
+      consumer->release();
+    }
+    m_consumers.clear();
+    return skipped;
+  }
+
+  uint64_t FrameTap::skipped() const {
+    std::lock_guard<std::mutex> lock(m_consumerMutex);
+    uint64_t skipped = 0;
+    for (const std::shared_ptr<FrameConsumer>& consumer : m_consumers) {
+      skipped += consumer->skipped();
+    }
+    return skipped;
+  }
+
+  uint64_t FrameTap::dropped() const {
+    return m_frames.dropped() + m_ring->dropped() + m_failed.load(std::memory_order_relaxed);
+  }
+
+  void FrameTap::loop() {
+    AVFrame* converted = av_frame_alloc();
+    while (std::optional<std::shared_ptr<FrameData>> frame = m_frames.pop()) {
+      const AVFrame* source = (*frame)->avFrame();
+      if (!source || !converted) {
+        continue;
+      }
+      av_frame_unref(converted);
+      int err = m_converter.convert(source, converted);
+      if (err < 0) {
+        if (m_failed.fetch_add(1, std::memory_order_relaxed) == 0) {
+          std::cout << "Tap " << m_name << " couldn't convert frame: "
+                    << ffmpeg::errorString(err) << std::endl;
+        }
+        continue;
+      }
+      unsigned frameNumber = (*frame)->frameNumber();
+      // Frame of the stream isn't needed anymore
+      frame->reset();
+      std::shared_ptr<FrameData> data = m_framePool->acquire(converted, frameNumber);
+      if (!data) {
+        m_failed.fetch_add(1, std::memory_order_relaxed);
+        continue;
+      }
+      deliver(data);
+    }
+    av_frame_free(&converted);
+  }
+
+  void FrameTap::deliver(const std::shared_ptr<FrameData>& data) {
+    std::lock_guard<std::mutex> lock(m_consumerMutex);
+    if (!m_consumers.empty()) {
+      m_ring->deliver(data, m_consumers);
+    }
+  }
+
+} // namespace video
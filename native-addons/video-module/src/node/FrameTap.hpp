@@ -0,0 +1,82 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Frame.hpp"
+#include "FrameRing.hpp"
+#include "../ffmpeg/FrameConverter.hpp"
+#include "../ffmpeg/FramePool.hpp"
+#include "../utils/BoundedQueue.hpp"
+
+namespace video {
+
+  class FrameConsumer;
+
+  struct TapOptions {
+    ffmpeg::FrameConversion conversion;
+    // Only every n:th frame of the stream is converted
+    int every = 1;
+    // Converted frames that can wait for the callbacks
+    size_t queueDepth = FrameRing::DefaultDepth;
+  };
+
+  /**
+   *  Named output of a stream with a size, pixel format and rate of its own.
+   *
+   *  Capture thread only queues a new reference to the frame of the stream.
+   *  Tap converts it on a thread of its own and delivers the result to all
+   *  of its callbacks through a ring of its own, so each tap is converted
+   *  once per frame no matter how many callbacks it has. Taps run in
+   *  parallel with each other. A tap that falls behind drops frames without
+   *  holding up capture or the other taps.
+   *
+   *  Only frames decoded by FFmpeg can be tapped.
+   */
+  class FrameTap {
+  public:
+    // Frames waiting for conversion, new ones are dropped when full
+    static constexpr size_t QueueSize = 2;
+
+    FrameTap(const std::string& name, const TapOptions& options);
+    ~FrameTap();
+
+    const std::string& name() const;
+
+    // Capture thread
+    void push(const std::shared_ptr<FrameData>& frame);
+
+    // Main thread
+    std::shared_ptr<FrameRing> ring() const;
+    void addConsumer(std::shared_ptr<FrameConsumer> consumer);
+    // Releases the callbacks, returns frames they skipped
+    uint64_t clearConsumers();
+    uint64_t skipped() const;
+    uint64_t dropped() const;
+
+  private:
+    void loop();
+    void deliver(const std::shared_ptr<FrameData>& data);
+
+    const std::string m_name;
+    const int m_every;
+    // Only used by the capture thread
+    uint64_t m_counter;
+
+    std::shared_ptr<FrameRing> m_ring;
+    std::shared_ptr<ffmpeg::FramePool> m_framePool;
+    ffmpeg::FrameConverter m_converter;
+    utils::BoundedQueue<std::shared_ptr<FrameData>> m_frames;
+
+    mutable std::mutex m_consumerMutex;
+    std::vector<std::shared_ptr<FrameConsumer>> m_consumers;
+    std::atomic<uint64_t> m_failed;
+
+    std::thread m_thread;
+  };
+
+} // namespace video
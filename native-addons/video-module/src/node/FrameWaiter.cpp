@@ -0,0 +1,166 @@
+#include "FrameWaiter.hpp"
+
+#include <algorithm>
+
+namespace video {
+
+  static bool isNewer(std::optional<unsigned> frame, std::optional<unsigned> lastFrame) {
+    // Frame numbers start over when the stream is restarted, so any other
+    // frame counts as newer
+    return frame && (!lastFrame || *frame != *lastFrame);
+  }
+
+  FrameWaiter* FrameWaiter::create(Napi::Env env, std::shared_ptr<utils::SharedMemory> sharedMemory) {
+    using FinalizerDataType = void;
+
+    auto waiter = new FrameWaiter(std::move(sharedMemory));
+    waiter->m_callback = FrameWaitCB::New(
+      env,
+      "Remote frame wait",
+      0,
+      1,
+      waiter,
+      [](Napi::Env, FinalizerDataType*, FrameWaiter* ctx) {
+        if (ctx->m_released) {
+          delete ctx;
+        } else {
+          // Thread-safe function is gone, the thread can't call it anymore
+          ctx->stop();
+          ctx->m_finalized = true;
+        }
+      });
+    // Only pending promises keep the process running
+    waiter->m_callback.Unref(env);
+    waiter->m_thread = std::thread(&FrameWaiter::loop, waiter);
+    return waiter;
+  }
+
+  FrameWaiter::FrameWaiter(std::shared_ptr<utils::SharedMemory> sharedMemory)
+    : m_sharedMemory(std::move(sharedMemory)),
+      m_nextId(0),
+      m_released(false),
+      m_finalized(false),
+      m_stopping(false)
+  {}
+
+  Napi::Promise FrameWaiter::wait(Napi::Env env, std::optional<unsigned> lastFrame, int timeoutMs) {
+    Napi::Promise::Deferred deferred = Napi::Promise::Deferred::New(env);
+    bool published = isNewer(m_sharedMemory->publishedFrame(), lastFrame);
+    if (published || timeoutMs <= 0) {
+      deferred.Resolve(Napi::Boolean::New(env, published));
+      return deferred.Promise();
+    }
+
+    uint64_t id = m_nextId++;
+    if (m_deferreds.empty()) {
+      m_callback.Ref(env);
+    }
+    m_deferreds.emplace(id, deferred);
+    Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(timeoutMs);
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_waits.push_back({ id, lastFrame, deadline });
+      if (m_waitingUntil && deadline < *m_waitingUntil) {
+        // Thread would sleep past the new deadline
+        m_sharedMemory->interruptWait();
+      }
+    }
+    m_changed.notify_one();
+    return deferred.Promise();
+  }
+
+  void FrameWaiter::release() {
+    stop();
+    if (m_finalized) {
+      // Environment is going away, nothing can be resolved anymore
+      delete this;
+      return;
+    }
+    // Nothing will be published to waits that are still pending
+    for (const Wait& wait : m_waits) {
+      finish(wait.id, false);
+    }
+    m_waits.clear();
+    m_released = true;
+    m_callback.Release();
+  }
+
+  void FrameWaiter::stop() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stopping = true;
+      if (m_waitingUntil) {
+        m_sharedMemory->interruptWait();
+      }
+    }
+    m_changed.notify_one();
+    if (m_thread.joinable()) {
+      m_thread.join();
+    }
+  }
+
+  void FrameWaiter::loop() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stopping) {
+      if (m_waits.empty()) {
+        m_changed.wait(lock);
+        continue;
+      }
+      std::optional<unsigned> frame = m_sharedMemory->publishedFrame();
+      Clock::time_point now = Clock::now();
+      Clock::time_point until = Clock::time_point::max();
+      for (auto it = m_waits.begin(); it != m_waits.end();) {
+        bool published = isNewer(frame, it->lastFrame);
+        if (published || it->deadline <= now) {
+          finish(it->id, published);
+          it = m_waits.erase(it);
+        } else {
+          until = std::min(until, it->deadline);
+          ++it;
+        }
+      }
+      if (m_waits.empty()) {
+        continue;
+      }
+      // Rest are all waiting for the frame after the current one
+      m_waitingUntil = until;
+      lock.unlock();
+      auto timeout = std::chrono::ceil<std::chrono::milliseconds>(until - now);
+      m_sharedMemory->waitForFrame(frame, static_cast<int>(timeout.count()));
+      lock.lock();
+      m_waitingUntil.reset();
+    }
+  }
+
+  void FrameWaiter::finish(uint64_t id, bool published) {
+    auto result = new FrameWaitResult{ id, published };
+    if (m_callback.NonBlockingCall(result) != napi_ok) {
+      delete result;
+    }
+  }
+
+  void FrameWaiter::resolve(Napi::Env env, const FrameWaitResult& result) {
+    auto it = m_deferreds.find(result.id);
+    if (it == m_deferreds.end()) {
+      return;
+    }
+    it->second.Resolve(Napi::Boolean::New(env, result.published));
+    m_deferreds.erase(it);
+    if (m_deferreds.empty() && !m_released) {
+      m_callback.Unref(env);
+    }
+  }
+
+  void callFrameWaitCB(
+    Napi::Env env,
+    Napi::Function,
+    FrameWaiter* waiter,
+    FrameWaitResult* result)
+  {
+    std::unique_ptr<FrameWaitResult> owned(result);
+    if (env != nullptr) {
+      waiter->resolve(env, *owned);
+    }
+  }
+
+} // namespace video
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "../common.hpp"
+#include "../utils/SharedMemory.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace video {
+
+  class FrameWaiter;
+
+  struct FrameWaitResult {
+    uint64_t id;
+    bool published;
+  };
+
+  void callFrameWaitCB(
+    Napi::Env env,
+    Napi::Function,
+    FrameWaiter* waiter,
+    FrameWaitResult* result);
+
+  using FrameWaitCB = Napi::TypedThreadSafeFunction<FrameWaiter, FrameWaitResult, callFrameWaitCB>;
+
+  /**
+   *  Waits for the frames of one remote stream on a thread of its own, so
+   *  that pending waitForFrame promises don't hold threads of the libuv
+   *  pool. Promises are resolved on the main thread through a thread-safe
+   *  function.
+   *
+   *  Waiter is deleted by whichever comes last, release or the finalizer of
+   *  the thread-safe function. At exit the finalizer may run first.
+   */
+  class FrameWaiter {
+  public:
+    static FrameWaiter* create(Napi::Env env, std::shared_ptr<utils::SharedMemory> sharedMemory);
+
+    // Main thread. Resolves to true once a frame other than lastFrame has
+    // been published, false after timeoutMs.
+    Napi::Promise wait(Napi::Env env, std::optional<unsigned> lastFrame, int timeoutMs);
+    // Main thread, stops waiting. Pending promises resolve to false.
+    void release();
+
+  private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Wait {
+      uint64_t id;
+      std::optional<unsigned> lastFrame;
+      Clock::time_point deadline;
+    };
+
+    FrameWaiter(std::shared_ptr<utils::SharedMemory> sharedMemory);
+
+    // Main thread, ends the waiter thread
+    void stop();
+    void loop();
+    // Waiter thread, under m_mutex
+    void finish(uint64_t id, bool published);
+
+    friend void callFrameWaitCB(Napi::Env, Napi::Function, FrameWaiter*, FrameWaitResult*);
+    void resolve(Napi::Env env, const FrameWaitResult& result);
+
+    std::shared_ptr<utils::SharedMemory> m_sharedMemory;
+    FrameWaitCB m_callback;
+
+    // Main thread only
+    std::map<uint64_t, Napi::Promise::Deferred> m_deferreds;
+    uint64_t m_nextId;
+    bool m_released;
+    bool m_finalized;
+
+    std::mutex m_mutex;
+    std::condition_variable m_changed;
+    std::vector<Wait> m_waits;
+    // Deadline of the frame wait in progress
+    std::optional<Clock::time_point> m_waitingUntil;
+    bool m_stopping;
+    std::thread m_thread;
+  };
+
+} // namespace video
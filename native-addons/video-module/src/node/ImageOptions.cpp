@@ -0,0 +1,42 @@
+#include "ImageOptions.hpp"
+#include "Utils.hpp"
+
+namespace video {
+
+  ffmpeg::ImageOptions ImageOptions::convert(const Napi::Object& obj) {
+    Napi::Env env = obj.Env();
+    ffmpeg::ImageOptions options;
+    Napi::Value target = obj.Get("outputPath");
+    if (!target.IsString() && !target.IsUndefined()) {
+      throw Napi::TypeError::New(env, "outputPath needs to be string");
+    }
+    options.outputPath = getString(obj, "outputPath", "");
+    options.format = getString(obj, "format", "");
+    if (!options.format.empty() && options.format != "jpeg" && options.format != "png" &&
+        options.format != "webp") {
+      throw Napi::TypeError::New(env, "format needs to be 'jpeg', 'png' or 'webp'");
+    }
+    options.quality = getInt(obj, "quality", -1);
+    if (options.quality == 0 || options.quality > 100) {
+      throw Napi::TypeError::New(env, "quality needs to be between 1 and 100");
+    }
+    options.width = getInt(obj, "width", 0);
+    options.height = getInt(obj, "height", 0);
+    if (options.width < 0 || options.height < 0) {
+      throw Napi::TypeError::New(env, "width and height can't be negative");
+    }
+    return options;
+  }
+
+  Napi::Buffer<uint8_t> imageBuffer(Napi::Env env, AVPacket* image) {
+    return Napi::Buffer<uint8_t>::New(
+      env,
+      image->data,
+      static_cast<size_t>(image->size),
+      [](Napi::Env, uint8_t*, AVPacket* packet) {
+        av_packet_free(&packet);
+      },
+      image);
+  }
+
+} // namespace video
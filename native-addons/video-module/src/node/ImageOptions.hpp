@@ -0,0 +1,19 @@
+#pragma once
+
+#include "../common.hpp"
+
+#include "../ffmpeg/ImageEncoder.hpp"
+
+namespace video {
+
+  class ImageOptions {
+  public:
+    // Throws TypeError for malformed options
+    static ffmpeg::ImageOptions convert(const Napi::Object& obj);
+  };
+
+  // Takes ownership of the encoded image, Buffer points to the data of the
+  // packet without copying
+  Napi::Buffer<uint8_t> imageBuffer(Napi::Env env, AVPacket* image);
+
+} // namespace video
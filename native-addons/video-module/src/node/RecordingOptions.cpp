@@ -0,0 +1,90 @@
+#include "RecordingOptions.hpp"
+#include "Utils.hpp"
+
+#include <algorithm>
+#include <map>
+
+namespace video {
+
+  // Plain object of strings and numbers, passed to FFmpeg as AVOptions
+  static std::map<std::string, std::string> convertAVOptions(const Napi::Object& obj, const char* name) {
+    std::map<std::string, std::string> options;
+    if (!obj.Has(name) || obj.Get(name).IsUndefined()) {
+      return options;
+    }
+    Napi::Value value = obj.Get(name);
+    if (!value.IsObject()) {
+      throw Napi::TypeError::New(obj.Env(), std::string(name) + " needs to be an object");
+    }
+    Napi::Object values = value.As<Napi::Object>();
+    Napi::Array keys = values.GetPropertyNames();
+    for (uint32_t i = 0; i < keys.Length(); ++i) {
+      std::string key = keys.Get(i).ToString();
+      Napi::Value option = values.Get(key);
+      if (!option.IsString() && !option.IsNumber()) {
+        throw Napi::TypeError::New(obj.Env(), std::string(name) + "." + key + " needs to be string or number");
+      }
+      options[key] = option.ToString().Utf8Value();
+    }
+    return options;
+  }
+
+  ffmpeg::RecordingOptions RecordingOptions::convert(const Napi::Object& obj, bool requirePath) {
+    Napi::Env env = obj.Env();
+    Napi::Value target = obj.Get("outputPath");
+    if (!target.IsString() && (requirePath || !target.IsUndefined())) {
+      throw Napi::TypeError::New(env, "outputPath needs to be string");
+    }
+    ffmpeg::RecordingOptions options;
+    options.outputPath = getString(obj, "outputPath", "");
+    options.format = getString(obj, "format", "");
+
+    int queueSize = getInt(obj, "queueSize", static_cast<int>(ffmpeg::RecordingOptions::DefaultQueueSize));
+    if (queueSize < 1) {
+      throw Napi::TypeError::New(env, "queueSize needs to be positive");
+    }
+    options.queueSize = static_cast<size_t>(queueSize);
+    std::string overflow = getString(obj, "overflow", "drop");
+    if (overflow == "block") {
+      options.overflow = utils::OverflowPolicy::Block;
+    } else if (overflow != "drop") {
+      throw Napi::TypeError::New(env, "overflow needs to be 'drop' or 'block'");
+    }
+    std::string timestamps = getString(obj, "timestamps", "input");
+    if (timestamps == "wallclock") {
+      options.timestamps = ffmpeg::TimestampSource::Wallclock;
+    } else if (timestamps != "input") {
+      throw Napi::TypeError::New(env, "timestamps needs to be 'input' or 'wallclock'");
+    }
+
+    options.copy = getBool(obj, "copy", false);
+    options.codec = getString(obj, "codec", "");
+    if (obj.Has("bitrate") && obj.Get("bitrate").IsNumber()) {
+      options.bitrate = obj.Get("bitrate").As<Napi::Number>().Int64Value();
+    }
+    options.crf = getInt(obj, "crf", -1);
+    options.preset = getString(obj, "preset", "");
+    options.gop = getInt(obj, "gop", ffmpeg::RecordingOptions::DefaultGop);
+    if (options.gop < 0) {
+      throw Napi::TypeError::New(env, "gop can't be negative");
+    }
+    options.pixelFormat = getString(obj, "pixelFormat", "");
+    options.threads = std::max(getInt(obj, "threads", 0), 0);
+    options.fps = std::max(getInt(obj, "fps", 0), 0);
+    options.segmentDuration = getDouble(obj, "segmentDuration", 0);
+    if (obj.Has("segmentSize") && obj.Get("segmentSize").IsNumber()) {
+      options.segmentSize = obj.Get("segmentSize").As<Napi::Number>().Int64Value();
+    }
+    if (options.segmentDuration < 0 || options.segmentSize < 0) {
+      throw Napi::TypeError::New(env, "segmentDuration and segmentSize can't be negative");
+    }
+    options.preRoll = getDouble(obj, "preRoll", 0);
+    if (options.preRoll < 0) {
+      throw Napi::TypeError::New(env, "preRoll can't be negative");
+    }
+    options.codecOptions = convertAVOptions(obj, "codecOptions");
+    options.formatOptions = convertAVOptions(obj, "formatOptions");
+    return options;
+  }
+
+} // namespace video
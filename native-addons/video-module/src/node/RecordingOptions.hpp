@@ -0,0 +1,16 @@
+#pragma once
+
+#include "../common.hpp"
+
+#include "../ffmpeg/RecordingOptions.hpp"
+
+namespace video {
+
+  class RecordingOptions {
+  public:
+    // Throws TypeError for malformed options. Pre-roll options may leave
+    // outputPath out, files are opened by startRecording.
+    static ffmpeg::RecordingOptions convert(const Napi::Object& obj, bool requirePath = true);
+  };
+
+} // namespace video
@@ -1,8 +1,12 @@
 #include "RemoteStream.hpp"
 
 #include "Frame.hpp"
+#include "FrameWaiter.hpp"
+#include "Utils.hpp"
 
+#include <algorithm>
 #include <iostream>
+
 namespace video {
 
   Napi::Object RemoteStream::Init(
@@ -12,7 +16,9 @@ namespace video {
   {
     Napi::Function func = DefineClass(env, "RemoteStream", {
       InstanceMethod<&RemoteStream::getLatestFrame>("getLatestFrame"),
+      InstanceMethod<&RemoteStream::waitForFrame>("waitForFrame"),
       InstanceMethod<&RemoteStream::streamId>("streamId"),
+      InstanceMethod<&RemoteStream::stats>("stats"),
     });
     exports.Set("RemoteStream", func);
 
@@ -24,7 +30,8 @@ namespace video {
   }
 
   RemoteStream::RemoteStream(const Napi::CallbackInfo& info)
-    : Napi::ObjectWrap<RemoteStream>(info)
+    : Napi::ObjectWrap<RemoteStream>(info),
+      m_waiter(nullptr)
   {
     Napi::Env env = info.Env();
     if (info.Length() < 1 || !info[0].IsString()) {
@@ -35,6 +42,9 @@ namespace video {
   }
 
   RemoteStream::~RemoteStream() {
+    if (m_waiter) {
+      m_waiter->release();
+    }
     m_sharedMemory.reset();
   }
 
@@ -42,9 +52,49 @@ namespace video {
     return Napi::String::New(info.Env(), m_sharedMemory->memoryId());
   }
 
+  Napi::Value RemoteStream::stats(const Napi::CallbackInfo& info) {
+    utils::SharedMemory::Stats stats = m_sharedMemory->stats();
+    Napi::Object obj = Napi::Object::New(info.Env());
+    obj.Set("framesRead", stats.frames);
+    obj.Set("tornReads", stats.torn);
+    obj.Set("skippedFrames", stats.skipped);
+    return obj;
+  }
+
   Napi::Value RemoteStream::getLatestFrame(const Napi::CallbackInfo& info) {
-    auto data = m_sharedMemory->read();
-    return Frame::create(info.Env(), data);
+    Napi::Env env = info.Env();
+    bool zeroCopy = false;
+    std::optional<unsigned> ifNewerThan;
+    if (info.Length() > 0 && info[0].IsObject()) {
+      Napi::Object options = info[0].As<Napi::Object>();
+      zeroCopy = getBool(options, "zeroCopy", false);
+      if (options.Has("ifNewerThan") && options.Get("ifNewerThan").IsNumber()) {
+        ifNewerThan = options.Get("ifNewerThan").As<Napi::Number>().Uint32Value();
+      }
+    }
+    // Frame numbers start over when the stream is restarted, so any other
+    // frame counts as newer
+    if (ifNewerThan && m_sharedMemory->publishedFrame() == ifNewerThan) {
+      return env.Null();
+    }
+    auto data = zeroCopy ? m_sharedMemory->readView() : m_sharedMemory->read();
+    if (!data || (ifNewerThan && data->frameNumber() == *ifNewerThan)) {
+      return env.Null();
+    }
+    m_lastFrameNumber = data->frameNumber();
+    return Frame::create(env, data);
+  }
+
+  Napi::Value RemoteStream::waitForFrame(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (info.Length() < 1 || !info[0].IsNumber()) {
+      throw Napi::TypeError::New(env, "Expected first argument to be timeout in milliseconds");
+    }
+    int timeoutMs = std::max(info[0].As<Napi::Number>().Int32Value(), 0);
+    if (!m_waiter) {
+      m_waiter = FrameWaiter::create(env, m_sharedMemory);
+    }
+    return m_waiter->wait(env, m_lastFrameNumber, timeoutMs);
   }
 
 } // namespace video
@@ -5,6 +5,8 @@
 
 namespace video {
 
+  class FrameWaiter;
+
   class RemoteStream : public Napi::ObjectWrap<RemoteStream> {
   public:
     static Napi::Object Init(
@@ -16,11 +18,23 @@ namespace video {
     RemoteStream(const Napi::CallbackInfo& info);
     ~RemoteStream();
 
+    // getLatestFrame({ zeroCopy, ifNewerThan })
+    // Returns null if there is no frame or it is still frame ifNewerThan
     Napi::Value getLatestFrame(const Napi::CallbackInfo& info);
+    // waitForFrame(timeoutMs)
+    // Returns promise of boolean, true once a frame other than the one last
+    // returned by getLatestFrame has been published, false on timeout or
+    // when the stream is collected
+    Napi::Value waitForFrame(const Napi::CallbackInfo& info);
     Napi::Value streamId(const Napi::CallbackInfo& info);
+    Napi::Value stats(const Napi::CallbackInfo& info);
 
   private:
-    std::unique_ptr<utils::SharedMemory> m_sharedMemory;
+    // Shared with the waiter thread
+    std::shared_ptr<utils::SharedMemory> m_sharedMemory;
+    std::optional<unsigned> m_lastFrameNumber;
+    // Created by the first waitForFrame
+    FrameWaiter* m_waiter;
   };
 
 } // namespace video
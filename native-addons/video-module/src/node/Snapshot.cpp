@@ -0,0 +1,142 @@
+#include "Snapshot.hpp"
+
+#include "ImageOptions.hpp"
+
+#include "../ffmpeg/ffmpeg.hpp"
+
+namespace video {
+
+  // Encodes in libuv thread pool so that neither capture nor JS waits
+  class SnapshotWorker : public Napi::AsyncWorker {
+  public:
+    SnapshotWorker(Napi::Env env, std::unique_ptr<SnapshotRequest> request)
+      : Napi::AsyncWorker(env),
+        m_request(std::move(request))
+    {}
+
+  protected:
+    void Execute() override {
+      m_request->encode();
+      if (m_request->error()) {
+        SetError(*m_request->error());
+      }
+    }
+
+    void OnOK() override {
+      m_request->deferred().Resolve(m_request->result(Env()));
+    }
+
+    void OnError(const Napi::Error& error) override {
+      m_request->deferred().Reject(error.Value());
+    }
+
+  private:
+    std::unique_ptr<SnapshotRequest> m_request;
+  };
+
+  void callSnapshotCB(Napi::Env env, Napi::Function, std::nullptr_t*, SnapshotRequest* request) {
+    std::unique_ptr<SnapshotRequest> owned(request);
+    if (env == nullptr) {
+      // Environment is going away, nobody is waiting for the promise
+      return;
+    }
+    auto worker = new SnapshotWorker(env, std::move(owned));
+    worker->Queue();
+  }
+
+  SnapshotRequest::SnapshotRequest(Napi::Env env, const ffmpeg::ImageOptions& options, size_t count)
+    : m_deferred(Napi::Promise::Deferred::New(env)),
+      m_callback(SnapshotCB::New(
+        env,
+        Napi::Function(), // Dummy function, request is passed as data
+        "Snapshot encode callback",
+        0,
+        1)),
+      m_options(options),
+      m_count(count)
+  {}
+
+  SnapshotRequest::~SnapshotRequest() {
+    for (AVFrame* frame : m_frames) {
+      av_frame_free(&frame);
+    }
+    for (AVPacket* packet : m_images) {
+      av_packet_free(&packet);
+    }
+  }
+
+  Napi::Promise SnapshotRequest::promise() const {
+    return m_deferred.Promise();
+  }
+
+  bool SnapshotRequest::add(const AVFrame* frame) {
+    // New reference to the buffers of the decoder, no copying
+    AVFrame* reference = av_frame_clone(frame);
+    if (!reference) {
+      m_error = ffmpeg::errorString(ffmpeg::outOfMemoryError());
+      return true;
+    }
+    m_frames.push_back(reference);
+    return m_frames.size() >= m_count;
+  }
+
+  void SnapshotRequest::finish(std::unique_ptr<SnapshotRequest> request, std::optional<std::string> error) {
+    if (error) {
+      request->m_error = std::move(error);
+    }
+    // Main thread may delete the request as soon as it has been called
+    SnapshotCB callback = request->m_callback;
+    if (callback.BlockingCall(request.get()) == napi_ok) {
+      request.release();
+    }
+    callback.Release();
+  }
+
+  void SnapshotRequest::encode() {
+    for (size_t i = 0; i < m_frames.size() && !m_error; ++i) {
+      ffmpeg::ImageOptions options = m_options;
+      if (m_count > 1 && !options.outputPath.empty()) {
+        options.outputPath = ffmpeg::numberedPath(options.outputPath, static_cast<int>(i) + 1);
+      }
+      auto image = ffmpeg::ImageEncoder::shared().encode(m_frames[i], options);
+      if (std::holds_alternative<std::string>(image)) {
+        m_error = std::get<std::string>(image);
+      } else if (options.outputPath.empty()) {
+        m_images.push_back(std::get<AVPacket*>(image));
+      } else {
+        AVPacket* packet = std::get<AVPacket*>(image);
+        av_packet_free(&packet);
+        m_paths.push_back(options.outputPath);
+      }
+      av_frame_free(&m_frames[i]);
+    }
+  }
+
+  Napi::Value SnapshotRequest::result(Napi::Env env) {
+    std::vector<Napi::Value> values;
+    for (AVPacket* image : m_images) {
+      values.push_back(imageBuffer(env, image));
+    }
+    m_images.clear();
+    for (const std::string& path : m_paths) {
+      values.push_back(Napi::String::New(env, path));
+    }
+    if (m_count == 1 && values.size() == 1) {
+      return values[0];
+    }
+    Napi::Array array = Napi::Array::New(env, values.size());
+    for (uint32_t i = 0; i < values.size(); ++i) {
+      array[i] = values[i];
+    }
+    return array;
+  }
+
+  Napi::Promise::Deferred& SnapshotRequest::deferred() {
+    return m_deferred;
+  }
+
+  const std::optional<std::string>& SnapshotRequest::error() const {
+    return m_error;
+  }
+
+} // namespace video
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "napi_include.hpp"
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "../ffmpeg/ffmpeg_include.hpp"
+#include "../ffmpeg/ImageEncoder.hpp"
+
+namespace video {
+
+  class SnapshotRequest;
+
+  void callSnapshotCB(Napi::Env env, Napi::Function, std::nullptr_t*, SnapshotRequest* request);
+
+  using SnapshotCB = Napi::TypedThreadSafeFunction<std::nullptr_t, SnapshotRequest, callSnapshotCB>;
+
+  /**
+   *  Frames wanted by a single takeSnapshot call.
+   *
+   *  Capture thread only takes new references to the next count decoded
+   *  frames. Once done, request is handed over to the main thread, which
+   *  queues the encoding to the libuv thread pool. Promise resolves with the
+   *  path of the image, or a Buffer if no path was given (array of them for
+   *  bursts).
+   */
+  class SnapshotRequest {
+  public:
+    SnapshotRequest(Napi::Env env, const ffmpeg::ImageOptions& options, size_t count);
+    ~SnapshotRequest();
+
+    Napi::Promise promise() const;
+
+    // Capture thread. Returns true once all the frames have been taken.
+    bool add(const AVFrame* frame);
+    // Capture thread, hands request over to be encoded (or rejected with the
+    // error)
+    static void finish(
+      std::unique_ptr<SnapshotRequest> request,
+      std::optional<std::string> error = std::nullopt);
+
+    // Thread pool, releases the frames
+    void encode();
+    // Main thread, once encoded
+    Napi::Value result(Napi::Env env);
+    Napi::Promise::Deferred& deferred();
+    const std::optional<std::string>& error() const;
+
+  private:
+    Napi::Promise::Deferred m_deferred;
+    SnapshotCB m_callback;
+    const ffmpeg::ImageOptions m_options;
+    const size_t m_count;
+    std::vector<AVFrame*> m_frames;
+    // Encoded images when kept in memory, paths otherwise
+    std::vector<AVPacket*> m_images;
+    std::vector<std::string> m_paths;
+    std::optional<std::string> m_error;
+  };
+
+} // namespace video
@@ -2,8 +2,10 @@
 
 #include "Frame.hpp"
 #include "VideoMode.hpp"
+#include "Utils.hpp"
 #include "../utils/PerfLogger.hpp"
 
+#include <algorithm>
 #include <iostream>
 
 using std::chrono::duration_cast;
@@ -16,10 +18,81 @@ namespace video {
       ts(duration_cast<TimeStamp>(high_resolution_clock::now().time_since_epoch()))
   {}
 
-  Stream::Stream() {}
+  FrameConsumer::FrameConsumer(std::shared_ptr<FrameRing> ring, Mode _mode)
+    : mode(_mode),
+      m_ring(ring),
+      m_pending(-1),
+      m_skipped(0),
+      m_released(false)
+  {
+  }
+
+  void FrameConsumer::deliver(StreamCacheKey* key) {
+    std::shared_ptr<FrameRing> ring = std::atomic_load(&m_ring);
+    std::lock_guard<std::mutex> lock(m_callMutex);
+    if (m_released) {
+      ring->release(*key);
+      return;
+    }
+    if (mode == Mode::Queue) {
+      if (callback.BlockingCall(key) != napi_ok) {
+        ring->release(*key);
+      }
+      return;
+    }
+    StreamCacheKey previous = m_pending.exchange(*key);
+    if (previous >= 0) {
+      // Call is already queued and will pick up the newer frame
+      ring->release(previous);
+      m_skipped.fetch_add(1, std::memory_order_relaxed);
+    } else if (callback.NonBlockingCall() != napi_ok) {
+      releasePending();
+    }
+  }
+
+  std::shared_ptr<FrameData> FrameConsumer::consume(StreamCacheKey* key) {
+    StreamCacheKey slot = mode == Mode::Queue ? *key : m_pending.exchange(-1);
+    if (slot < 0) {
+      return nullptr;
+    }
+    std::shared_ptr<FrameRing> ring = std::atomic_load(&m_ring);
+    std::shared_ptr<FrameData> data = ring->peek(slot);
+    ring->release(slot);
+    return data;
+  }
+
+  void FrameConsumer::releasePending() {
+    StreamCacheKey slot = m_pending.exchange(-1);
+    if (slot >= 0) {
+      std::atomic_load(&m_ring)->release(slot);
+    }
+  }
+
+  void FrameConsumer::release() {
+    std::lock_guard<std::mutex> lock(m_callMutex);
+    if (!m_released) {
+      m_released = true;
+      callback.Release();
+    }
+  }
+
+  void FrameConsumer::setRing(std::shared_ptr<FrameRing> ring) {
+    std::atomic_store(&m_ring, ring);
+  }
+
+  uint64_t FrameConsumer::skipped() const {
+    return m_skipped.load(std::memory_order_relaxed);
+  }
+
+  Stream::Stream()
+    : m_skippedFrames(0),
+      m_frameRing(std::make_shared<FrameRing>(FrameRing::DefaultDepth))
+  {}
 
   Stream::Stream(const std::string& name)
-    : m_name(name)
+    : m_skippedFrames(0),
+      m_name(name),
+      m_frameRing(std::make_shared<FrameRing>(FrameRing::DefaultDepth))
   {
   }
 
@@ -57,34 +130,127 @@ namespace video {
     if(info.Length() < 1 || !info[0].IsFunction()) {
       throw Napi::TypeError::New(env, "Expected first argument to be function");
     }
+    FrameConsumer::Mode mode = FrameConsumer::Mode::Queue;
+    std::shared_ptr<FrameTap> tap;
+    if (info.Length() > 1 && info[1].IsObject()) {
+      std::string modeName = getString(info[1].As<Napi::Object>(), "mode", "queue");
+      if (modeName == "latest") {
+        mode = FrameConsumer::Mode::Latest;
+      } else if (modeName != "queue") {
+        throw Napi::TypeError::New(env, "Expected mode to be 'queue' or 'latest'");
+      }
+      std::string tapName = getString(info[1].As<Napi::Object>(), "tap", "");
+      if (!tapName.empty() && !(tap = findTap(tapName))) {
+        throw Napi::TypeError::New(env, "No tap named " + tapName);
+      }
+    }
     // see https://github.com/nodejs/node-addon-api/blob/master/doc/typed_threadsafe_function.md for additional info
 
-    using FinalizerDataType = void;
+    using FinalizerDataType = std::shared_ptr<FrameConsumer>;
 
-    m_frameCallbacks.emplace_back(ThreadSafeFrameCB::New(
+    auto consumer = std::make_shared<FrameConsumer>(
+      tap ? tap->ring() : std::atomic_load(&m_frameRing), mode);
+    consumer->callback = ThreadSafeFrameCB::New(
       env,
       info[0].As<Napi::Function>(),
       "Frame consumer callback",
-      0, // unlimited queue
+      // Queue is bounded by the ring, in latest-mode only one call is queued
+      mode == FrameConsumer::Mode::Latest ? 1 : 0,
       1, // Only one thread will use this initially
-      this, // context
-      [](Napi::Env, FinalizerDataType*, Stream*) {
-      } /*, FinalizerDataType dataToFinalizer */
-    ));
+      consumer.get(), // context
+      [](Napi::Env, FinalizerDataType* owner, FrameConsumer* ctx) {
+        ctx->releasePending();
+        delete owner;
+      },
+      new FinalizerDataType(consumer)
+    );
+    if (tap) {
+      tap->addConsumer(consumer);
+    } else {
+      auto callbacks = std::make_shared<ConsumerList>();
+      if (std::shared_ptr<const ConsumerList> current = std::atomic_load(&m_frameCallbacks)) {
+        *callbacks = *current;
+      }
+      callbacks->push_back(consumer);
+      std::atomic_store(&m_frameCallbacks, std::shared_ptr<const ConsumerList>(callbacks));
+    }
   }
 
   void Stream::clearFrameCallbacks(const Napi::CallbackInfo&) {
+    // Frames already queued are released by the pending callback calls
     clearFrameCallbacks();
-    std::lock_guard<std::mutex> g(m_cacheMutex);
-    m_dataCache.clear();
   }
 
   void Stream::clearFrameCallbacks() {
-    for(auto cb : m_frameCallbacks) {
-      cb.Release();
+    std::shared_ptr<const ConsumerList> callbacks = std::atomic_load(&m_frameCallbacks);
+    std::atomic_store(&m_frameCallbacks, std::shared_ptr<const ConsumerList>());
+    if (callbacks) {
+      for (const std::shared_ptr<FrameConsumer>& consumer : *callbacks) {
+        m_skippedFrames += consumer->skipped();
+        consumer->release();
+      }
+    }
+    if (std::shared_ptr<const TapList> taps = std::atomic_load(&m_taps)) {
+      for (const std::shared_ptr<FrameTap>& tap : *taps) {
+        m_skippedFrames += tap->clearConsumers();
+      }
     }
-    m_frameCallbacks.clear();
-    m_sharedMemory.reset();
+    std::atomic_store(&m_sharedMemory, std::shared_ptr<utils::SharedMemory>());
+  }
+
+  void Stream::addTap(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (info.Length() < 2 || !info[0].IsString() || !info[1].IsObject()) {
+      throw Napi::TypeError::New(env, "Expected name and options of the tap");
+    }
+    std::string name = info[0].As<Napi::String>();
+    if (findTap(name)) {
+      throw Napi::TypeError::New(env, "Tap " + name + " already exists");
+    }
+    Napi::Object obj = info[1].As<Napi::Object>();
+    TapOptions options;
+    // Taps already run in parallel with each other
+    options.conversion = VideoMode::convertConversion(obj, 1);
+    options.every = getInt(obj, "every", 1);
+    int queueDepth = getInt(obj, "queueDepth", static_cast<int>(FrameRing::DefaultDepth));
+    if (options.every < 1 || queueDepth < 1) {
+      throw Napi::TypeError::New(env, "every and queueDepth need to be positive");
+    }
+    options.queueDepth = static_cast<size_t>(queueDepth);
+
+    auto taps = std::make_shared<TapList>();
+    if (std::shared_ptr<const TapList> current = std::atomic_load(&m_taps)) {
+      *taps = *current;
+    }
+    taps->push_back(std::make_shared<FrameTap>(name, options));
+    std::atomic_store(&m_taps, std::shared_ptr<const TapList>(taps));
+  }
+
+  void Stream::removeTap(const Napi::CallbackInfo& info) {
+    Napi::Env env = info.Env();
+    if (info.Length() < 1 || !info[0].IsString()) {
+      throw Napi::TypeError::New(env, "Expected name of the tap");
+    }
+    std::string name = info[0].As<Napi::String>();
+    std::shared_ptr<FrameTap> tap = findTap(name);
+    if (!tap) {
+      return;
+    }
+    auto taps = std::make_shared<TapList>(*std::atomic_load(&m_taps));
+    taps->erase(std::find(taps->begin(), taps->end(), tap));
+    std::atomic_store(&m_taps, std::shared_ptr<const TapList>(taps));
+    m_skippedFrames += tap->clearConsumers();
+  }
+
+  std::shared_ptr<FrameTap> Stream::findTap(const std::string& name) const {
+    if (std::shared_ptr<const TapList> taps = std::atomic_load(&m_taps)) {
+      for (const std::shared_ptr<FrameTap>& tap : *taps) {
+        if (tap->name() == name) {
+          return tap;
+        }
+      }
+    }
+    return nullptr;
   }
 
   void Stream::setName(const std::string& name) {
@@ -99,9 +265,10 @@ namespace video {
     return m_name;
   }
 
-  void Stream::frameProduced(std::vector<std::shared_ptr<FrameData>> data, bool profile) {
-    if (m_sharedMemory) {
-      auto error = m_sharedMemory->write(data);
+  void Stream::frameProduced(std::shared_ptr<FrameData> data, bool profile) {
+    std::shared_ptr<utils::SharedMemory> sharedMemory = std::atomic_load(&m_sharedMemory);
+    if (sharedMemory) {
+      auto error = sharedMemory->write(data);
       bool hasError = error.has_value();
       if (m_sharedMemoryInitFunction != nullptr) {
         auto copyPtr = new std::optional<std::string>(error);
@@ -110,25 +277,21 @@ namespace video {
         m_sharedMemoryInitFunction = SharedMemoryInitCB();
       }
       if (hasError) {
-        m_sharedMemory.reset();
+        std::atomic_store(&m_sharedMemory, std::shared_ptr<utils::SharedMemory>());
       }
     }
 
-    if (!m_frameCallbacks.empty()) {
-      CacheKey* keyPtr = addToCache(data);
-      CacheKey key = *keyPtr;
-      for (auto cb: m_frameCallbacks) {
-        incrementCacheRefs(key);
-        napi_status status = cb.BlockingCall(keyPtr);
-        if (status != napi_ok) {
-          // error - what to do?
-          consumeCacheRef(key);
-        }
+    std::shared_ptr<const ConsumerList> callbacks = std::atomic_load(&m_frameCallbacks);
+    if (callbacks && !callbacks->empty()) {
+      std::atomic_load(&m_frameRing)->deliver(data, *callbacks);
+    }
+    if (std::shared_ptr<const TapList> taps = std::atomic_load(&m_taps)) {
+      for (const std::shared_ptr<FrameTap>& tap : *taps) {
+        tap->push(data);
       }
-      checkCacheRefs(key);
     }
     utils::PerfLogger::logEntry(cppName(), utils::Key::Produced,
-                                data[0]->frameNumber(), profile);
+                                data->frameNumber(), profile);
   }
 
   Napi::Value Stream::latestFrameStats(const Napi::CallbackInfo& info) {
@@ -137,10 +300,43 @@ namespace video {
     auto statsPair = logger->latestFrameStats();
     auto& stats = statsPair.second;
 
+    Napi::Object obj = Napi::Object::New(info.Env());
+    std::shared_ptr<FrameRing> ring = std::atomic_load(&m_frameRing);
+    obj.Set("queueDepth", ring->depth());
+    obj.Set("queueDropped", ring->dropped());
+    uint64_t skipped = m_skippedFrames;
+    if (std::shared_ptr<const ConsumerList> callbacks = std::atomic_load(&m_frameCallbacks)) {
+      for (const std::shared_ptr<FrameConsumer>& consumer : *callbacks) {
+        skipped += consumer->skipped();
+      }
+    }
+    if (std::shared_ptr<const TapList> taps = std::atomic_load(&m_taps)) {
+      Napi::Array tapStats = Napi::Array::New(info.Env(), taps->size());
+      for (uint32_t i = 0; i < taps->size(); ++i) {
+        const FrameTap& tap = *(*taps)[i];
+        uint64_t tapSkipped = tap.skipped();
+        skipped += tapSkipped;
+        Napi::Object tapObj = Napi::Object::New(info.Env());
+        tapObj.Set("name", tap.name());
+        tapObj.Set("queueDepth", tap.ring()->depth());
+        tapObj.Set("dropped", tap.dropped());
+        tapObj.Set("skippedFrames", tapSkipped);
+        tapStats[i] = tapObj;
+      }
+      obj.Set("taps", tapStats);
+    }
+    obj.Set("skippedFrames", skipped);
+    std::shared_ptr<utils::SharedMemory> sharedMemory = std::atomic_load(&m_sharedMemory);
+    if (sharedMemory) {
+      utils::SharedMemory::Stats remote = sharedMemory->stats();
+      obj.Set("remoteFrames", remote.frames);
+      obj.Set("remoteUnread", remote.skipped);
+      obj.Set("remoteBlocked", remote.blocked);
+    }
     if (stats.empty()) {
-      return info.Env().Undefined();
+      // Timings are available only after a frame has been fully traced
+      return obj;
     }
-    Napi::Object obj = Napi::Object::New(info.Env());
     obj.Set("decode", (stats[utils::Key::Decoded] - stats[utils::Key::Received]).count());
     obj.Set("passing", (stats[utils::Key::Produced] - stats[utils::Key::Decoded]).count());
     obj.Set("nodeDelay", (stats[utils::Key::Handling] - stats[utils::Key::Produced]).count());
@@ -150,70 +346,34 @@ namespace video {
     return obj;
   }
 
-  Stream::CacheKey* Stream::addToCache(std::vector<std::shared_ptr<FrameData>> data) {
-    CacheItem item{data, std::make_unique<CacheKey>(), 0};
-
-    std::lock_guard<std::mutex> g(m_cacheMutex);
-
-    auto itemKey = static_cast<int>(m_dataCache.size());
-    std::unordered_map<int, CacheItem>::iterator it;
-    while (true) {
-      it = m_dataCache.find(itemKey);
-      if (it == m_dataCache.end()) {
-        break;
-      }
-      ++itemKey;
-    }
-    *item.key = itemKey;
-    auto keyAddr = item.key.get();
-    m_dataCache.insert(it, {itemKey, std::move(item)});
-    return keyAddr;
-  }
-
-  void Stream::checkCacheRefs(CacheKey key) {
-    CacheItem item; // do memory deallocation after mutex is freed
-    {
-      std::lock_guard<std::mutex> g(m_cacheMutex);
-      auto it = m_dataCache.find(key);
-      if (it != m_dataCache.end() && it->second.references == 0) {
-        item = std::move(it->second);
-        m_dataCache.erase(it);
-      }
+  bool Stream::setFrameQueueDepth(size_t depth) {
+    std::shared_ptr<FrameRing> ring = std::atomic_load(&m_frameRing);
+    if (ring->depth() == depth) {
+      return true;
     }
-  }
-
-  void Stream::incrementCacheRefs(CacheKey key) {
-    std::lock_guard<std::mutex> g(m_cacheMutex);
-    auto it = m_dataCache.find(key);
-    if (it != m_dataCache.end()) {
-      ++it->second.references;
+    // Pending callbacks refer to slots of the current ring
+    if (!ring->idle()) {
+      return false;
     }
-  }
-
-  std::vector<std::shared_ptr<FrameData>> Stream::consumeCacheRef(CacheKey key) {
-    std::vector<std::shared_ptr<FrameData>> data;
-    {
-      std::lock_guard<std::mutex> g(m_cacheMutex);
-      auto it = m_dataCache.find(key);
-      if (it != m_dataCache.end()) {
-        data = it->second.data;
-        if (--it->second.references == 0) {
-          m_dataCache.erase(it);
-        }
+    ring = std::make_shared<FrameRing>(depth);
+    if (std::shared_ptr<const ConsumerList> callbacks = std::atomic_load(&m_frameCallbacks)) {
+      for (const std::shared_ptr<FrameConsumer>& consumer : *callbacks) {
+        consumer->setRing(ring);
       }
     }
-    return data;
+    std::atomic_store(&m_frameRing, ring);
+    return true;
   }
 
   void callFrameCB(
     Napi::Env env,
     Napi::Function callback,
-    Stream* ctx,
+    FrameConsumer* ctx,
     Stream::CacheKey* data)
   {
-    Stream::CacheKey key = *data;
-    std::vector<std::shared_ptr<FrameData>> frameData = ctx->consumeCacheRef(key);
-    if (frameData.empty())
+    // Needs to be consumed even if the call is never made to free the slot
+    std::shared_ptr<FrameData> frameData = ctx->consume(data);
+    if (!frameData)
       return;
     if (env != nullptr) {
       if (callback != nullptr) {
@@ -226,7 +386,12 @@ namespace video {
   }
 
   Napi::Value Stream::enableRemoteStream(const Napi::CallbackInfo& info) {
-    m_sharedMemory = utils::SharedMemory::initWriter();
+    int slots = 0;
+    if (info.Length() > 0 && info[0].IsObject()) {
+      slots = std::max(getInt(info[0].As<Napi::Object>(), "slots", 0), 0);
+    }
+    std::atomic_store(&m_sharedMemory, std::shared_ptr<utils::SharedMemory>(
+      utils::SharedMemory::initWriter(static_cast<size_t>(slots))));
 
     m_sharedMemoryInitPromise = std::make_unique<Napi::Promise::Deferred>(
       Napi::Promise::Deferred::New(info.Env())
@@ -243,7 +408,7 @@ namespace video {
   }
 
   void Stream::disableRemoteStream(const Napi::CallbackInfo&) {
-    m_sharedMemory.reset();
+    std::atomic_store(&m_sharedMemory, std::shared_ptr<utils::SharedMemory>());
   }
 
   void callInitCB(
@@ -258,8 +423,9 @@ namespace video {
 
   void Stream::sharedMemoryInit(Napi::Env env, std::optional<std::string>& error) {
     if (env != nullptr && m_sharedMemoryInitPromise) {
-      if (!error.has_value() && m_sharedMemory != nullptr) {
-        m_sharedMemoryInitPromise->Resolve(Napi::String::New(env, m_sharedMemory->memoryId()));
+      std::shared_ptr<utils::SharedMemory> sharedMemory = std::atomic_load(&m_sharedMemory);
+      if (!error.has_value() && sharedMemory != nullptr) {
+        m_sharedMemoryInitPromise->Resolve(Napi::String::New(env, sharedMemory->memoryId()));
       } else if (error.has_value()) {
         m_sharedMemoryInitPromise->Reject(Napi::String::New(env, *error));
       } else {
@@ -338,6 +504,45 @@ namespace video {
     emitEvent(event);
   }
 
+  void Stream::emitStreamInputStalled(int64_t withoutInputMs, uint64_t stalls) {
+    EventData *event = new EventData("input-stalled");
+    event->payload["withoutInput"] = withoutInputMs;
+    event->payload["stalls"] = static_cast<int64_t>(stalls);
+    emitEvent(event);
+  }
+
+  void Stream::emitStreamInputRecovered(int64_t withoutInputMs) {
+    EventData *event = new EventData("input-recovered");
+    event->payload["withoutInput"] = withoutInputMs;
+    emitEvent(event);
+  }
+
+  void Stream::emitStreamDecoderConfigured(
+    int threads,
+    const std::string& threadType,
+    const std::string& codec)
+  {
+    EventData *event = new EventData("decoder-configured");
+    event->payload["threads"] = static_cast<int64_t>(threads);
+    event->payload["threadType"] = threadType;
+    event->payload["codec"] = codec;
+    emitEvent(event);
+  }
+
+  void Stream::emitStreamModeSwitched(
+    const std::map<std::string, double>& phases,
+    bool streamInfoSkipped,
+    bool decoderReused)
+  {
+    EventData *event = new EventData("mode-switched");
+    for (const auto& phase : phases) {
+      event->payload[phase.first] = phase.second;
+    }
+    event->payload["streamInfoSkipped"] = streamInfoSkipped;
+    event->payload["decoderReused"] = decoderReused;
+    emitEvent(event);
+  }
+
   void Stream::emitEvent(EventData* event) {
     std::lock_guard<std::mutex> g(m_eventMutex);
     if (m_eventCallback != nullptr) {
@@ -350,6 +555,11 @@ namespace video {
       Napi::Object obj = Napi::Object::New(env);
       obj.Set("type", event->type);
       obj.Set("timestamp", event->ts.count());
+      for (auto& entry : event->payload) {
+        std::visit([&obj, &entry](auto&& value) {
+          obj.Set(entry.first, value);
+        }, entry.second);
+      }
       function.Call({ obj });
     }
     delete event;
@@ -2,12 +2,16 @@
 
 #include "napi_include.hpp"
 
+#include <atomic>
 #include <chrono>
-#include <unordered_map>
+#include <map>
 #include <mutex>
 #include <string>
+#include <variant>
 
 #include "Frame.hpp"
+#include "FrameRing.hpp"
+#include "FrameTap.hpp"
 #include "../ffmpeg/VideoMode.hpp"
 #include "../utils/SharedMemory.hpp"
 
@@ -15,24 +19,73 @@ namespace video {
   // micro seconds from epoch
   typedef std::chrono::duration<long, std::micro> TimeStamp;
 
+  typedef std::variant<int64_t, double, std::string, bool> EventValue;
+
   struct EventData {
     EventData(const std::string& type);
     /* Possible payloads */
     std::string type;
     TimeStamp ts;
+    // Set as additional properties of the JS event
+    std::map<std::string, EventValue> payload;
   };
 
   class Stream;
-  typedef int StreamCacheKey;
+  class FrameConsumer;
+  typedef FrameRing::SlotKey StreamCacheKey;
 
   void callFrameCB(
     Napi::Env env,
     Napi::Function callback,
-    Stream* ctx,
+    FrameConsumer* ctx,
     StreamCacheKey* data);
 
   using ThreadSafeFrameCB =
-    Napi::TypedThreadSafeFunction<Stream, StreamCacheKey, callFrameCB>;
+    Napi::TypedThreadSafeFunction<FrameConsumer, StreamCacheKey, callFrameCB>;
+
+  /**
+   *  Delivery state of a single frame callback.
+   *
+   *  In Queue-mode every frame is queued for the callback (as long as there is
+   *  room in the ring). In Latest-mode at most one frame is waiting for the
+   *  callback: a newer frame replaces the pending one and the replaced frame
+   *  is counted as skipped. This bounds the latency when the main thread is
+   *  busy.
+   *
+   *  Consumer is shared by the lists it is in and the thread-safe function,
+   *  whose finalizer drops its reference after all the queued calls have
+   *  been made. Producer may still hold a list it was removed from, so
+   *  after release deliver only frees the slot.
+   */
+  class FrameConsumer {
+  public:
+    enum class Mode { Queue, Latest };
+
+    FrameConsumer(std::shared_ptr<FrameRing> ring, Mode mode);
+
+    // Called from the producer thread, key needs to have reference reserved
+    // for this consumer
+    void deliver(StreamCacheKey* key);
+    // Called from the main thread, returns empty if nothing to deliver
+    std::shared_ptr<FrameData> consume(StreamCacheKey* key);
+    void releasePending();
+    // Main thread, releases the callback, no calls are made after this
+    void release();
+
+    void setRing(std::shared_ptr<FrameRing> ring);
+    uint64_t skipped() const;
+
+    ThreadSafeFrameCB callback;
+    const Mode mode;
+
+  private:
+    std::shared_ptr<FrameRing> m_ring;
+    std::atomic<StreamCacheKey> m_pending;
+    std::atomic<uint64_t> m_skipped;
+    // Keeps release from racing with a call being made
+    std::mutex m_callMutex;
+    bool m_released;
+  };
 
   void callInitCB(
     Napi::Env env,
@@ -71,17 +124,21 @@ namespace video {
     void disableRemoteStream(const Napi::CallbackInfo& info);
 
     // If there is need to have more sophisticated control this could
-    // return id of callback or similar
+    // return id of callback or similar. Callbacks of a tap are given with
+    // the tap option.
     void addFrameCallback(const Napi::CallbackInfo& info);
     void clearFrameCallbacks(const Napi::CallbackInfo&);
     void clearFrameCallbacks();
 
-    void frameProduced(std::vector<std::shared_ptr<FrameData>> data, bool profile);
+    // Named outputs with a size, format and rate of their own, see FrameTap
+    void addTap(const Napi::CallbackInfo& info);
+    void removeTap(const Napi::CallbackInfo& info);
 
-    CacheKey* addToCache(std::vector<std::shared_ptr<FrameData>> data);
-    void checkCacheRefs(CacheKey key); // removes if refs == 0
-    void incrementCacheRefs(CacheKey key);
-    std::vector<std::shared_ptr<FrameData>> consumeCacheRef(CacheKey key);
+    void frameProduced(std::shared_ptr<FrameData> data, bool profile);
+
+    // Changes the amount of frames that can wait for delivery to JS. Takes
+    // effect only when no frames are in flight, returns false otherwise.
+    bool setFrameQueueDepth(size_t depth);
 
     void sharedMemoryInit(Napi::Env env, std::optional<std::string>& error);
 
@@ -100,47 +157,42 @@ namespace video {
     void emitStreamStoppedRecording();
     void emitStreamSnapShotTaken();
     void emitStreamFailedRecording(const std::string& error);
+    void emitStreamInputStalled(int64_t withoutInputMs, uint64_t stalls);
+    void emitStreamInputRecovered(int64_t withoutInputMs);
+    void emitStreamDecoderConfigured(int threads, const std::string& threadType,
+                                     const std::string& codec);
+    // Milliseconds spent in each phase of the switch by name
+    void emitStreamModeSwitched(const std::map<std::string, double>& phases,
+                                bool streamInfoSkipped, bool decoderReused);
     void emitEvent(EventData* event);
 
   private:
-    std::vector<ThreadSafeFrameCB> m_frameCallbacks;
-    std::string m_name;
+    typedef std::vector<std::shared_ptr<FrameConsumer>> ConsumerList;
+    typedef std::vector<std::shared_ptr<FrameTap>> TapList;
 
-    std::mutex m_cacheMutex;
+    std::shared_ptr<FrameTap> findTap(const std::string& name) const;
+
+    // Lists are replaced as a whole from the main thread, read by the
+    // worker thread
+    std::shared_ptr<const ConsumerList> m_frameCallbacks;
+    std::shared_ptr<const TapList> m_taps;
+    // Skipped frames of already removed latest-mode callbacks
+    uint64_t m_skippedFrames;
+    std::string m_name;
 
     /**
-     *  Getting FrameData out of the arbitrary worker thread for the Frame-
-     *  object tied to JS runtime requires some technical plumbing.
-     *
      *  We want to have FrameData managed by shared_ptr which frees the
      *  associated FrameData-object when the last reference is removed.
      *  This enables both proper copying of JS-objects and full control on
      *  C++-side if the need arises.
      *
-     *  Based on the above requirements we need to ensure that the C++-side
-     *  of Stream's API takes in shared_ptr. This is now implemented in
-     *  frameProduced-function.
-     *
-     *  Because frameProduced can be called from arbitrary thread the callbacks
-     *  executed in Node runtime's main thread are not immediately executed. The
-     *  passed FrameData needs to be kept alive at least as long before the
-     *  callbacks have been executed. The only foolproof way to implement this
-     *  is to store reference into intermediate container once the FrameData is
-     *  passed to the Stream and then fetch the reference at the time of the
-     *  callback execution.
+     *  Frames waiting for the callbacks are parked in the ring, see
+     *  FrameRing for the details. Ring is swapped atomically when the depth
+     *  is changed.
      */
-    struct CacheItem {
-      /// The actual data
-      std::vector<std::shared_ptr<FrameData>> data;
-      /// Key needs to be stored in the item as well, because the callback
-      /// expects pointer of CacheKey and we need to ensure that pointer does
-      /// point to valid address
-      std::unique_ptr<CacheKey> key;
-      /// Number of times we need to be able to fetch the item from cache
-      int references;
-    };
-    std::unordered_map<int, CacheItem> m_dataCache;
-    std::unique_ptr<utils::SharedMemory> m_sharedMemory;
+    std::shared_ptr<FrameRing> m_frameRing;
+    // Written by the worker thread, swapped atomically from the main thread
+    std::shared_ptr<utils::SharedMemory> m_sharedMemory;
 
     SharedMemoryInitCB m_sharedMemoryInitFunction;
     std::unique_ptr<Napi::Promise::Deferred> m_sharedMemoryInitPromise;
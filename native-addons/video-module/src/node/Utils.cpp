@@ -12,6 +12,16 @@ namespace video {
     return emptyValue;
   }
 
+  double getDouble(const Napi::Object &obj, const char *name, double emptyValue) {
+    if (obj.Has(name)) {
+      Napi::Value v = obj.Get(name);
+      if (v.IsNumber()) {
+        return v.As<Napi::Number>().DoubleValue();
+      }
+    }
+    return emptyValue;
+  }
+
   bool getBool(const Napi::Object &obj, const char *name, bool emptyValue) {
     if (obj.Has(name)) {
       Napi::Value v = obj.Get(name);
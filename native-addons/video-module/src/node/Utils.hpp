@@ -4,6 +4,7 @@
 
 namespace video {
   int getInt(const Napi::Object& obj, const char* name, int emptyValue);
+  double getDouble(const Napi::Object& obj, const char* name, double emptyValue);
   bool getBool(const Napi::Object& obj, const char* name, bool emptyValue);
   std::string getString(const Napi::Object& obj, const char* name, std::string emptyValue);
 }
@@ -1,4 +1,6 @@
 #include "Video.hpp"
+#include "Benchmark.hpp"
+#include "Devices.hpp"
 #include "DummyStream.hpp"
 #include "Frame.hpp"
 #include "PerfLoggerWrapper.hpp"
@@ -40,8 +42,14 @@ namespace video {
 
   Napi::Object Init(Napi::Env env, Napi::Object exports) {
     exports.Set("listStreams", Napi::Function::New(env, listStreams));
+    exports.Set("listStreamsAsync", Napi::Function::New(env, listStreamsAsync));
+    exports.Set("setDeviceChangeListener", Napi::Function::New(env, setDeviceChangeListener));
+    exports.Set("removeDeviceChangeListener", Napi::Function::New(env, removeDeviceChangeListener));
     exports.Set("logPerf", Napi::Function::New(env, logPerf));
     exports.Set("showFormats", Napi::Function::New(env, showFormats));
+    exports.Set("benchmarkDecode", Napi::Function::New(env, benchmarkDecode));
+    exports.Set("benchmarkConversion", Napi::Function::New(env, benchmarkConversion));
+    exports.Set("createFileStream", Napi::Function::New(env, FFmpegStream::createFileStream));
     auto instanceData = new InstanceData();
     FFmpegStream::Init(env, exports, instanceData->constructors);
     DummyStream::Init(env, exports, instanceData->constructors);
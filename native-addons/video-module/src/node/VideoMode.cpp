@@ -1,8 +1,51 @@
 #include "VideoMode.hpp"
 #include "Utils.hpp"
 
+#include <algorithm>
+
 namespace video {
 
+  int VideoMode::convertThreads(const Napi::Value& value) {
+    if (value.IsNumber()) {
+      return std::max(value.As<Napi::Number>().Int32Value(), 0);
+    }
+    if (value.IsString() && value.As<Napi::String>().Utf8Value() == "auto") {
+      return 0;
+    }
+    throw Napi::TypeError::New(value.Env(), "Expected threads to be number or 'auto'");
+  }
+
+  int VideoMode::convertThreadType(const Napi::Object& obj) {
+    std::string type = getString(obj, "threadType", "");
+    if (type.empty()) {
+      return 0;
+    } else if (type == "frame") {
+      return FF_THREAD_FRAME;
+    } else if (type == "slice") {
+      return FF_THREAD_SLICE;
+    }
+    throw Napi::TypeError::New(obj.Env(), "Expected threadType to be 'frame' or 'slice'");
+  }
+
+  static int convertScaling(const Napi::Object& obj) {
+    std::string scaling = getString(obj, "scaling", "bilinear");
+    if (scaling == "fast-bilinear") {
+      return SWS_FAST_BILINEAR;
+    } else if (scaling == "bilinear") {
+      return SWS_BILINEAR;
+    } else if (scaling == "bicubic") {
+      return SWS_BICUBIC;
+    } else if (scaling == "point") {
+      return SWS_POINT;
+    } else if (scaling == "area") {
+      return SWS_AREA;
+    } else if (scaling == "lanczos") {
+      return SWS_LANCZOS;
+    }
+    throw Napi::TypeError::New(obj.Env(),
+      "Expected scaling to be 'fast-bilinear', 'bilinear', 'bicubic', 'point', 'area' or 'lanczos'");
+  }
+
   Napi::Value VideoMode::create(const Napi::CallbackInfo& info, ffmpeg::VideoMode mode)
   {
     return create(info, mode.w, mode.h, mode.fps);
@@ -10,19 +53,55 @@ namespace video {
 
   Napi::Value VideoMode::create(const Napi::CallbackInfo& info, int w, int h, int fps)
   {
-    Napi::Env env = info.Env();
+    return create(info.Env(), ffmpeg::VideoMode(w, h, fps, false));
+  }
+
+  Napi::Value VideoMode::create(Napi::Env env, ffmpeg::VideoMode mode)
+  {
     Napi::Object obj = Napi::Object::New(env);
-    obj.Set("width", w);
-    obj.Set("height", h);
-    obj.Set("fps", fps);
+    obj.Set("width", mode.w);
+    obj.Set("height", mode.h);
+    obj.Set("fps", mode.fps);
     return obj;
   }
 
   ffmpeg::VideoMode VideoMode::convert(const Napi::Object& obj) {
-    return ffmpeg::VideoMode(getInt(obj, "width", 0),
-                             getInt(obj, "height", 0),
-                             getInt(obj, "fps", 0),
-                             getBool(obj, "profile", false));
+    ffmpeg::VideoMode mode(getInt(obj, "width", 0),
+                           getInt(obj, "height", 0),
+                           getInt(obj, "fps", 0),
+                           getBool(obj, "profile", false));
+    mode.queueDepth = getInt(obj, "frameQueueDepth", 0);
+    mode.framePoolSize = getInt(obj, "framePoolSize", 0);
+    if (obj.Has("threads") && !obj.Get("threads").IsUndefined()) {
+      mode.threads = convertThreads(obj.Get("threads"));
+    }
+    mode.threadType = convertThreadType(obj);
+    mode.stallTimeout = std::max(getInt(obj, "stallTimeout", ffmpeg::VideoMode::DefaultStallTimeout), 0);
+    mode.inputTimeout = std::max(getInt(obj, "inputTimeout", ffmpeg::VideoMode::DefaultInputTimeout), 0);
+    mode.packetQueueDepth = std::max(getInt(obj, "packetQueueDepth", ffmpeg::VideoMode::DefaultPacketQueueDepth), 1);
+    if (obj.Has("output") && !obj.Get("output").IsUndefined()) {
+      if (!obj.Get("output").IsObject()) {
+        throw Napi::TypeError::New(obj.Env(), "Expected output to be an object");
+      }
+      mode.conversion = convertConversion(obj.Get("output").As<Napi::Object>());
+    }
+    return mode;
+  }
+
+  ffmpeg::FrameConversion VideoMode::convertConversion(const Napi::Object& obj, int threads) {
+    ffmpeg::FrameConversion conversion;
+    std::string pixelFormat = getString(obj, "pixelFormat", "");
+    if (!pixelFormat.empty()) {
+      conversion.pixelFormat = av_get_pix_fmt(pixelFormat.c_str());
+      if (conversion.pixelFormat == AV_PIX_FMT_NONE) {
+        throw Napi::TypeError::New(obj.Env(), "Unknown pixelFormat " + pixelFormat);
+      }
+    }
+    conversion.width = std::max(getInt(obj, "width", 0), 0);
+    conversion.height = std::max(getInt(obj, "height", 0), 0);
+    conversion.algorithm = convertScaling(obj);
+    conversion.threads = std::max(getInt(obj, "threads", threads), 0);
+    return conversion;
   }
 
 }
@@ -14,8 +14,16 @@ namespace video {
   public:
     static Napi::Value create(const Napi::CallbackInfo& info, ffmpeg::VideoMode mode);
     static Napi::Value create(const Napi::CallbackInfo& info, int w, int h, int fps);
+    static Napi::Value create(Napi::Env env, ffmpeg::VideoMode mode);
 
     static ffmpeg::VideoMode convert(const Napi::Object& obj);
+    // Number of threads or 'auto', which is 0
+    static int convertThreads(const Napi::Value& value);
+    // threadType of obj, 'frame', 'slice' or none (0)
+    static int convertThreadType(const Napi::Object& obj);
+    // Pixel format, size and scaling of FrameConversion, threads is the
+    // default thread count
+    static ffmpeg::FrameConversion convertConversion(const Napi::Object& obj, int threads = 0);
   };
 
 } // namespace video
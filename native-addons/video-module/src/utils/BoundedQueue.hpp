@@ -0,0 +1,124 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+namespace utils {
+
+  enum class OverflowPolicy {
+    // New items are refused when the queue is full
+    Drop,
+    // Producer waits until there is room
+    Block
+  };
+
+  /**
+   *  Fixed capacity FIFO for handing items between threads.
+   *
+   *  When full, push either refuses the item or waits depending on the
+   *  policy. Refused items stay with the caller, so owning raw pointers can
+   *  be released there. After close, push refuses everything and pop drains
+   *  what is left before returning empty.
+   */
+  template <typename T>
+  class BoundedQueue {
+  public:
+    BoundedQueue(size_t capacity, OverflowPolicy policy)
+      : m_capacity(capacity > 0 ? capacity : 1),
+        m_policy(policy),
+        m_closed(false),
+        m_dropped(0)
+    {}
+
+    // Returns false if the item was not queued
+    bool push(T item) {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      if (m_policy == OverflowPolicy::Block) {
+        m_notFull.wait(lock, [this] { return m_closed || m_items.size() < m_capacity; });
+      }
+      if (m_closed || m_items.size() >= m_capacity) {
+        ++m_dropped;
+        return false;
+      }
+      m_items.push_back(std::move(item));
+      lock.unlock();
+      m_notEmpty.notify_one();
+      return true;
+    }
+
+    // Queues item even when full, for control items that can be neither
+    // dropped nor kept waiting. Returns false only if closed.
+    bool pushAlways(T item) {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      if (m_closed) {
+        return false;
+      }
+      m_items.push_back(std::move(item));
+      lock.unlock();
+      m_notEmpty.notify_one();
+      return true;
+    }
+
+    // Waits for an item, empty once closed and drained
+    std::optional<T> pop() {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_notEmpty.wait(lock, [this] { return m_closed || !m_items.empty(); });
+      return takeFront(lock);
+    }
+
+    // Returns immediately, empty if there is nothing queued
+    std::optional<T> tryPop() {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      return takeFront(lock);
+    }
+
+    void close() {
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed = true;
+      }
+      m_notEmpty.notify_all();
+      m_notFull.notify_all();
+    }
+
+    size_t size() const {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      return m_items.size();
+    }
+
+    size_t capacity() const {
+      return m_capacity;
+    }
+
+    uint64_t dropped() const {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      return m_dropped;
+    }
+
+  private:
+    std::optional<T> takeFront(std::unique_lock<std::mutex>& lock) {
+      if (m_items.empty()) {
+        return std::nullopt;
+      }
+      std::optional<T> item(std::move(m_items.front()));
+      m_items.pop_front();
+      lock.unlock();
+      m_notFull.notify_one();
+      return item;
+    }
+
+    const size_t m_capacity;
+    const OverflowPolicy m_policy;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_notEmpty;
+    std::condition_variable m_notFull;
+    std::deque<T> m_items;
+    bool m_closed;
+    uint64_t m_dropped;
+  };
+
+} // namespace utils
@@ -0,0 +1,21 @@
+#include "DeviceWatcher.hpp"
+
+#if defined(__linux__)
+#include "DeviceWatcherLinux.hpp"
+#endif
+
+namespace utils {
+
+  std::unique_ptr<DeviceWatcher> DeviceWatcher::create(ChangeCallback callback) {
+#if defined(__linux__)
+    auto watcher = std::make_unique<DeviceWatcherLinux>(std::move(callback));
+    return watcher->watching() ? std::move(watcher) : nullptr;
+#else
+    (void)callback;
+    return nullptr;
+#endif
+  }
+
+  DeviceWatcher::~DeviceWatcher() {}
+
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+
+namespace utils {
+
+  /**
+   *  Calls back on a thread of its own when video devices are plugged in or
+   *  removed. Changes are reported once the devices have been quiet for a
+   *  moment, as a device shows up in several steps.
+   *
+   *  Only Linux is watched, elsewhere create returns nullptr and devices
+   *  are refreshed on demand.
+   */
+  class DeviceWatcher {
+  public:
+    typedef std::function<void()> ChangeCallback;
+
+    static std::unique_ptr<DeviceWatcher> create(ChangeCallback callback);
+
+    virtual ~DeviceWatcher();
+  };
+}
@@ -0,0 +1,95 @@
+#include "DeviceWatcherLinux.hpp"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace utils {
+
+  // Node and its permissions are set up separately, devices are probed
+  // only once nothing has changed for this long
+  static const int s_settleMs = 500;
+
+  // Reads the pending events, returns true if any were about video nodes
+  static bool readVideoEvents(int fd) {
+    alignas(struct inotify_event) char buffer[4096];
+    bool video = false;
+    ssize_t length;
+    while ((length = read(fd, buffer, sizeof(buffer))) > 0) {
+      for (char* p = buffer; p < buffer + length;) {
+        const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(p);
+        if (event->len > 0 && strncmp(event->name, "video", 5) == 0) {
+          video = true;
+        }
+        p += sizeof(struct inotify_event) + event->len;
+      }
+    }
+    return video;
+  }
+
+  DeviceWatcherLinux::DeviceWatcherLinux(ChangeCallback callback)
+    : m_callback(std::move(callback)),
+      m_inotify(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)),
+      m_wake(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+  {
+    if (m_inotify >= 0 && inotify_add_watch(m_inotify, "/dev", IN_CREATE | IN_DELETE | IN_ATTRIB) < 0) {
+      close(m_inotify);
+      m_inotify = -1;
+    }
+    if (watching()) {
+      m_thread = std::thread(&DeviceWatcherLinux::loop, this);
+    }
+  }
+
+  DeviceWatcherLinux::~DeviceWatcherLinux() {
+    if (m_thread.joinable()) {
+      uint64_t one = 1;
+      ssize_t written = write(m_wake, &one, sizeof(one));
+      (void)written;
+      m_thread.join();
+    }
+    if (m_inotify >= 0) {
+      close(m_inotify);
+    }
+    if (m_wake >= 0) {
+      close(m_wake);
+    }
+  }
+
+  bool DeviceWatcherLinux::watching() const {
+    return m_inotify >= 0 && m_wake >= 0;
+  }
+
+  void DeviceWatcherLinux::loop() {
+    struct pollfd fds[2] = {
+      { m_inotify, POLLIN, 0 },
+      { m_wake, POLLIN, 0 }
+    };
+    bool changed = false;
+    while (true) {
+      // Waits for the changes to settle before reporting them
+      int ready = poll(fds, 2, changed ? s_settleMs : -1);
+      if (ready < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return;
+      }
+      if (fds[1].revents & POLLIN) {
+        return;
+      }
+      if (ready == 0 && changed) {
+        changed = false;
+        m_callback();
+      } else if (fds[0].revents & POLLIN) {
+        changed = readVideoEvents(m_inotify) || changed;
+      }
+    }
+  }
+
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "DeviceWatcher.hpp"
+
+#include <thread>
+
+namespace utils {
+
+  // Watches /dev with inotify, udev creates and removes the video nodes
+  // there as devices come and go
+  class DeviceWatcherLinux : public DeviceWatcher {
+  public:
+    DeviceWatcherLinux(ChangeCallback callback);
+    ~DeviceWatcherLinux() override;
+
+    bool watching() const;
+
+  private:
+    void loop();
+
+    const ChangeCallback m_callback;
+    int m_inotify;
+    // Written to wake up the thread for stopping
+    int m_wake;
+    std::thread m_thread;
+  };
+}
@@ -1,29 +1,42 @@
 #include "SharedMemory.hpp"
 
-#ifndef _WIN32
-#include "SharedMemoryMac.hpp"
-#else
+#if defined(_WIN32)
 #include "SharedMemoryWin.hpp"
+#else
+#include "SharedMemoryPosix.hpp"
 #endif
 
 namespace utils {
 
-  std::unique_ptr<SharedMemory> SharedMemory::initWriter() {
-#ifndef _WIN32
-    return std::make_unique<SharedMemoryMac>();
-#else
+  std::unique_ptr<SharedMemory> SharedMemory::initWriter(size_t slots) {
+#if defined(_WIN32)
+    (void)slots;
     return std::make_unique<SharedMemoryWin>();
+#else
+    return std::make_unique<SharedMemoryPosix>(slots);
 #endif
   }
 
   std::unique_ptr<SharedMemory> SharedMemory::initReader(const std::string& id) {
-#ifndef _WIN32
-    return std::make_unique<SharedMemoryMac>(id);
-#else
+#if defined(_WIN32)
     return std::make_unique<SharedMemoryWin>();
+#else
+    return std::make_unique<SharedMemoryPosix>(id);
 #endif
   }
 
   SharedMemory::~SharedMemory() {}
 
+  std::shared_ptr<video::FrameData> SharedMemory::readView() {
+    return read();
+  }
+
+  std::optional<unsigned> SharedMemory::publishedFrame() {
+    return std::nullopt;
+  }
+
+  SharedMemory::Stats SharedMemory::stats() const {
+    return Stats();
+  }
+
 }
@@ -2,6 +2,7 @@
 
 #include "../node/Frame.hpp"
 
+#include <cstdint>
 #include <memory>
 #include <optional>
 
@@ -11,15 +12,45 @@ namespace utils {
   public:
     typedef std::function<void(std::optional<std::string>)> InitCallback;
 
-    static std::unique_ptr<SharedMemory> initWriter();
+    // Counters of the frame hand-off. Not every backend keeps all of them.
+    struct Stats {
+      // Frames written (writer) or read (reader)
+      uint64_t frames = 0;
+      // Reads that raced with the writer and had to be retried
+      uint64_t torn = 0;
+      // Writer: frames replaced before any reader read them
+      // Reader: frames published between two reads that were never seen
+      uint64_t skipped = 0;
+      // Writer: frames not shared because readers held all the free slots
+      uint64_t blocked = 0;
+    };
+
+    // Slots is the amount of frames kept in shared memory, 0 uses default
+    static std::unique_ptr<SharedMemory> initWriter(size_t slots = 0);
     static std::unique_ptr<SharedMemory> initReader(const std::string& id);
 
     virtual ~SharedMemory();
 
     // Returns error message in the case of failure
-    virtual std::optional<std::string> write(std::vector<std::shared_ptr<video::FrameData>> data) = 0;
-    virtual std::vector<std::shared_ptr<video::FrameData>> read() = 0;
+    virtual std::optional<std::string> write(std::shared_ptr<video::FrameData> data) = 0;
+    virtual std::shared_ptr<video::FrameData> read() = 0;
+    // Planes of the returned frame may point directly into shared memory,
+    // in which case the frame is not overwritten as long as it is alive.
+    // Falls back to read() if the backend can't do that.
+    virtual std::shared_ptr<video::FrameData> readView();
+
+    // Frame number of the latest published frame without reading it. Empty
+    // if nothing has been published or the backend can't tell.
+    virtual std::optional<unsigned> publishedFrame();
+    // Blocks until the latest published frame is other than lastFrame (or
+    // any frame if empty), returns false on timeout or when interrupted.
+    // Can be called from another thread than the one reading frames.
+    virtual bool waitForFrame(std::optional<unsigned> lastFrame, int timeoutMs) = 0;
+    // Makes the waitForFrame in progress, or else the next one, return false
+    virtual void interruptWait() = 0;
 
     virtual const std::string& memoryId() const = 0;
+
+    virtual Stats stats() const;
   };
 }
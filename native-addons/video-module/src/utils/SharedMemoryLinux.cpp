@@ -0,0 +1,31 @@
+#include "SharedMemoryPosix.hpp"
+
+#include <climits>
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace utils {
+
+  static long futex(std::atomic<uint32_t>& word, int op, uint32_t value,
+                    const struct timespec* timeout = nullptr) {
+    // Not FUTEX_PRIVATE_FLAG, the word is shared between processes
+    return syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), op, value,
+                   timeout, nullptr, 0);
+  }
+
+  void sharedWait(std::atomic<uint32_t>& word, uint32_t value, std::chrono::microseconds timeout) {
+    auto seconds = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+    struct timespec relative;
+    relative.tv_sec = static_cast<time_t>(seconds.count());
+    relative.tv_nsec = static_cast<long>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(timeout - seconds).count());
+    futex(word, FUTEX_WAIT, value, &relative);
+  }
+
+  void sharedWake(std::atomic<uint32_t>& word) {
+    futex(word, FUTEX_WAKE, INT_MAX);
+  }
+
+}
@@ -0,0 +1,446 @@
+#include "SharedMemoryPosix.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <variant>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace utils {
+
+  static const uint32_t s_magic = 0x76696433; // "vid3"
+  // Reads racing with the writer are retried this many times
+  static const int s_readAttempts = 4;
+  // Slot data is kept cache line aligned
+  static const size_t s_slotAlignment = 64;
+
+  static std::set<int> s_sharedMemoryWriters;
+
+  static_assert(std::atomic<uint32_t>::is_always_lock_free &&
+                std::atomic<uint64_t>::is_always_lock_free,
+                "Shared atomics need to be plain integers");
+
+  struct SharedMemoryPosix::Mapping {
+    Mapping(void* address_, size_t size_) : address(address_), size(size_) {}
+    Mapping(const Mapping&) = delete;
+    Mapping& operator=(const Mapping&) = delete;
+
+    ~Mapping() {
+      munmap(address, size);
+    }
+
+    void* const address;
+    const size_t size;
+  };
+
+  // Frame whose planes point into a leased slot. Mappings stay alive and the
+  // writer leaves the slot alone until the frame is destroyed.
+  class LeasedFrameData : public video::FrameData {
+  public:
+    LeasedFrameData(std::shared_ptr<SharedMemoryPosix::Mapping> header,
+                    std::shared_ptr<SharedMemoryPosix::Mapping> data, SharedSlot& slot)
+      : m_header(std::move(header)),
+        m_data(std::move(data)),
+        m_slot(slot)
+    {
+      m_frameNumber = slot.frameNumber;
+    }
+
+    virtual ~LeasedFrameData() override {
+      m_slot.leases.fetch_sub(1, std::memory_order_release);
+    }
+
+  private:
+    std::shared_ptr<SharedMemoryPosix::Mapping> m_header;
+    std::shared_ptr<SharedMemoryPosix::Mapping> m_data;
+    SharedSlot& m_slot;
+  };
+
+  // Frame number of the latest slot, retried if the writer gets in between
+  static std::optional<unsigned> latestFrameNumber(const SharedFrameHeader* header) {
+    for (int attempt = 0; attempt < s_readAttempts; ++attempt) {
+      uint32_t index = header->latest.load(std::memory_order_acquire);
+      if (index >= header->slotCount) {
+        return std::nullopt;
+      }
+      const SharedSlot& slot = header->slot[index];
+      uint32_t sequence = slot.sequence.load(std::memory_order_acquire);
+      uint32_t frame = slot.frameNumber;
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (!(sequence & 1) && slot.sequence.load(std::memory_order_relaxed) == sequence) {
+        return frame;
+      }
+    }
+    return std::nullopt;
+  }
+
+  static std::string errorMessage(const std::string& call, const std::string& name) {
+    int errsv = errno;
+    return "Got " + std::string(strerror(errsv)) + " during " + call + " " + name;
+  }
+
+  static size_t align(size_t size) {
+    return (size + s_slotAlignment - 1) / s_slotAlignment * s_slotAlignment;
+  }
+
+  // Creates a region of size, or opens the existing one when size is 0
+  static std::variant<std::shared_ptr<SharedMemoryPosix::Mapping>, std::string>
+  mapRegion(const std::string& name, size_t size) {
+    bool create = size > 0;
+    int fd = create ? shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644)
+                    : shm_open(name.c_str(), O_RDWR, 0);
+    if (fd == -1) {
+      return errorMessage("shm_open", name);
+    }
+    std::optional<std::string> error;
+    if (create) {
+      if (ftruncate(fd, static_cast<off_t>(size)) == -1) {
+        error = errorMessage("ftruncate", name);
+      }
+    } else {
+      struct stat info;
+      if (fstat(fd, &info) == -1) {
+        error = errorMessage("fstat", name);
+      } else {
+        size = static_cast<size_t>(info.st_size);
+      }
+    }
+    void* mem = MAP_FAILED;
+    if (!error) {
+      mem = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      if (mem == MAP_FAILED) {
+        error = errorMessage("mmap", name);
+      }
+    }
+    // Mapping stays valid without the descriptor
+    close(fd);
+    if (error) {
+      if (create) {
+        shm_unlink(name.c_str());
+      }
+      return *error;
+    }
+    return std::make_shared<SharedMemoryPosix::Mapping>(mem, size);
+  }
+
+  static int allocateGlobalId() {
+    for (int i = 0; ; ++i) {
+      auto it = s_sharedMemoryWriters.find(i);
+      if (it == s_sharedMemoryWriters.end()) {
+        s_sharedMemoryWriters.insert(it, i);
+        return i;
+      }
+    }
+  }
+
+  SharedMemoryPosix::SharedMemoryPosix(size_t slots)
+    : m_globalId(allocateGlobalId()),
+      m_header(nullptr),
+      m_writer(true),
+      m_generation(0),
+      m_nextSlot(0),
+      m_slotSize(0),
+      m_frames(0),
+      m_torn(0),
+      m_skipped(0),
+      m_blocked(0),
+      m_interrupted(false)
+  {
+    // Names are kept short, macOS allows 31 characters
+    m_memoryId = "/video-module-" + std::to_string(getpid()) + "-" + std::to_string(m_globalId);
+    // Left over from an earlier process with the same pid
+    shm_unlink(m_memoryId.c_str());
+    auto region = mapRegion(m_memoryId, sizeof(SharedFrameHeader));
+    if (std::holds_alternative<std::string>(region)) {
+      s_sharedMemoryWriters.erase(m_globalId);
+      throw std::runtime_error(std::get<std::string>(region));
+    }
+    m_headerMapping = std::get<std::shared_ptr<Mapping>>(region);
+    m_header = static_cast<SharedFrameHeader*>(m_headerMapping->address);
+    m_header->magic = s_magic;
+    // Latest slot and the one being written are never available to the
+    // writer, so at least three slots are needed to always have one free
+    m_header->slotCount = static_cast<uint32_t>(std::clamp<size_t>(
+      slots == 0 ? SharedFrameHeader::DefaultSlots : slots, 3, SharedFrameHeader::MaxSlots));
+    m_header->latest.store(SharedFrameHeader::NoSlot);
+    m_header->published.store(0);
+  }
+
+  SharedMemoryPosix::SharedMemoryPosix(const std::string& name)
+    : m_memoryId(name),
+      m_globalId(-1),
+      m_header(nullptr),
+      m_writer(false),
+      m_generation(0),
+      m_nextSlot(0),
+      m_slotSize(0),
+      m_frames(0),
+      m_torn(0),
+      m_skipped(0),
+      m_blocked(0),
+      m_interrupted(false)
+  {
+    // Reader leases slots, so the region is mapped writable
+    auto region = mapRegion(m_memoryId, 0);
+    if (std::holds_alternative<std::string>(region)) {
+      throw std::runtime_error(std::get<std::string>(region));
+    }
+    m_headerMapping = std::get<std::shared_ptr<Mapping>>(region);
+    m_header = static_cast<SharedFrameHeader*>(m_headerMapping->address);
+    if (m_headerMapping->size < sizeof(SharedFrameHeader) || m_header->magic != s_magic
+        || m_header->slotCount > SharedFrameHeader::MaxSlots) {
+      throw std::runtime_error(m_memoryId + " is not a frame region");
+    }
+  }
+
+  SharedMemoryPosix::~SharedMemoryPosix()
+  {
+    if (m_writer) {
+      // Readers keep their mappings, the names just disappear
+      shm_unlink(m_memoryId.c_str());
+      if (m_data) {
+        shm_unlink(dataName(m_generation).c_str());
+      }
+    }
+    if (m_globalId >= 0) {
+      s_sharedMemoryWriters.erase(m_globalId);
+    }
+  }
+
+  std::string SharedMemoryPosix::dataName(uint32_t generation) const {
+    return m_memoryId + "-" + std::to_string(generation);
+  }
+
+  std::optional<std::string> SharedMemoryPosix::resizeSlots(size_t slotSize) {
+    slotSize = align(slotSize);
+    uint32_t generation = m_generation + 1;
+    std::string name = dataName(generation);
+    // Left over from an earlier process with the same pid
+    shm_unlink(name.c_str());
+    auto region = mapRegion(name, slotSize * m_header->slotCount);
+    if (std::holds_alternative<std::string>(region)) {
+      // Previous slots stay usable
+      return std::get<std::string>(region);
+    }
+    if (m_data) {
+      // Readers holding frames of the old region keep their mappings
+      shm_unlink(dataName(m_generation).c_str());
+    }
+    m_data = std::get<std::shared_ptr<Mapping>>(region);
+    m_generation = generation;
+    m_slotSize = slotSize;
+    return std::nullopt;
+  }
+
+  std::shared_ptr<SharedMemoryPosix::Mapping> SharedMemoryPosix::dataMapping(uint32_t generation) {
+    if (m_data && m_generation == generation) {
+      return m_data;
+    }
+    auto region = mapRegion(dataName(generation), 0);
+    if (std::holds_alternative<std::string>(region)) {
+      // Writer has moved on from the region already
+      return nullptr;
+    }
+    m_data = std::get<std::shared_ptr<Mapping>>(region);
+    m_generation = generation;
+    return m_data;
+  }
+
+  uint32_t SharedMemoryPosix::claimSlot(uint32_t& sequence) {
+    uint32_t count = m_header->slotCount;
+    uint32_t latest = m_header->latest.load(std::memory_order_relaxed);
+    for (uint32_t i = 0; i < count; ++i) {
+      uint32_t index = (m_nextSlot + i) % count;
+      SharedSlot& slot = m_header->slot[index];
+      if (index == latest || slot.leases.load(std::memory_order_relaxed) != 0) {
+        continue;
+      }
+      // Pairs with the lease in readView: either we see the lease or the
+      // reader sees the odd sequence
+      sequence = slot.sequence.load(std::memory_order_relaxed);
+      slot.sequence.store(sequence + 1, std::memory_order_seq_cst);
+      if (slot.leases.load(std::memory_order_seq_cst) != 0) {
+        // Data was not touched, reader may keep using it
+        slot.sequence.store(sequence, std::memory_order_release);
+        continue;
+      }
+      m_nextSlot = (index + 1) % count;
+      return index;
+    }
+    return SharedFrameHeader::NoSlot;
+  }
+
+  std::optional<std::string> SharedMemoryPosix::write(std::shared_ptr<video::FrameData> data) {
+    size_t bytesNeeded = 0;
+    for (size_t i = 0; i < data->planes(); ++i) {
+      bytesNeeded += data->length(i);
+    }
+    if (bytesNeeded > m_slotSize) {
+      auto error = resizeSlots(bytesNeeded);
+      if (error) {
+        return error;
+      }
+    }
+
+    uint32_t sequence = 0;
+    uint32_t index = claimSlot(sequence);
+    if (index == SharedFrameHeader::NoSlot) {
+      m_blocked.fetch_add(1, std::memory_order_relaxed);
+      return std::nullopt;
+    }
+    SharedSlot& slot = m_header->slot[index];
+    if (sequence != 0 && slot.read.load(std::memory_order_relaxed) == 0) {
+      m_skipped.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    slot.generation = m_generation;
+    slot.offset = index * m_slotSize;
+    uint8_t* target = static_cast<uint8_t*>(m_data->address) + slot.offset;
+    uint32_t offset = 0;
+    for (size_t i = 0; i < data->planes(); ++i) {
+      SharedPlane& plane = slot.plane[i];
+      plane.offset = offset;
+      plane.length = data->length(i);
+      plane.width = data->width(i);
+      plane.height = data->height(i);
+      std::memcpy(target + offset, data->data(i), plane.length);
+      offset += plane.length;
+    }
+    slot.planes = static_cast<uint32_t>(data->planes());
+    slot.frameNumber = data->frameNumber();
+    slot.read.store(0, std::memory_order_relaxed);
+    slot.sequence.store(sequence + 2, std::memory_order_release);
+
+    m_header->latest.store(index, std::memory_order_release);
+    m_header->published.fetch_add(1, std::memory_order_release);
+    sharedWake(m_header->published);
+    m_frames.fetch_add(1, std::memory_order_relaxed);
+    return std::nullopt;
+  }
+
+  std::shared_ptr<video::FrameData> SharedMemoryPosix::readView() {
+    for (int attempt = 0; attempt < s_readAttempts; ++attempt) {
+      uint32_t index = m_header->latest.load(std::memory_order_acquire);
+      if (index >= m_header->slotCount) {
+        // Nothing published yet
+        return nullptr;
+      }
+
+      SharedSlot& slot = m_header->slot[index];
+      slot.leases.fetch_add(1, std::memory_order_seq_cst);
+      uint32_t sequence = slot.sequence.load(std::memory_order_seq_cst);
+      if ((sequence & 1) || sequence == 0) {
+        // Writer got to the slot first
+        slot.leases.fetch_sub(1, std::memory_order_release);
+        m_torn.fetch_add(1, std::memory_order_relaxed);
+        continue;
+      }
+
+      // Frame has been written, the slot is ours until the lease is released
+      uint32_t planes = std::min<uint32_t>(slot.planes, video::FrameData::MaxPlanes);
+      size_t end = slot.offset;
+      for (uint32_t i = 0; i < planes; ++i) {
+        end = std::max(end, size_t(slot.offset) + slot.plane[i].offset + slot.plane[i].length);
+      }
+      std::shared_ptr<Mapping> data = dataMapping(slot.generation);
+      if (!data || end > data->size) {
+        slot.leases.fetch_sub(1, std::memory_order_release);
+        return nullptr;
+      }
+      auto result = std::make_shared<LeasedFrameData>(m_headerMapping, data, slot);
+      uint8_t* base = static_cast<uint8_t*>(data->address) + slot.offset;
+      for (uint32_t i = 0; i < planes; ++i) {
+        const SharedPlane& plane = slot.plane[i];
+        result->addPlane(base + plane.offset, plane.length, plane.width, plane.height);
+      }
+
+      slot.read.store(1, std::memory_order_relaxed);
+      uint32_t frame = slot.frameNumber;
+      if (m_lastFrameNumber && frame > *m_lastFrameNumber + 1) {
+        m_skipped.fetch_add(frame - *m_lastFrameNumber - 1, std::memory_order_relaxed);
+      }
+      if (!m_lastFrameNumber || frame != *m_lastFrameNumber) {
+        m_frames.fetch_add(1, std::memory_order_relaxed);
+      }
+      m_lastFrameNumber = frame;
+      return result;
+    }
+    return nullptr;
+  }
+
+  std::optional<unsigned> SharedMemoryPosix::publishedFrame() {
+    return latestFrameNumber(m_header);
+  }
+
+  bool SharedMemoryPosix::waitForFrame(std::optional<unsigned> lastFrame, int timeoutMs) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+    while (true) {
+      if (m_interrupted.exchange(false)) {
+        return false;
+      }
+      // Read before the frame so that a frame published in between wakes us
+      uint32_t published = m_header->published.load(std::memory_order_acquire);
+      std::optional<unsigned> frame = latestFrameNumber(m_header);
+      if (frame && (!lastFrame || *frame != *lastFrame)) {
+        return true;
+      }
+      auto left = deadline - std::chrono::steady_clock::now();
+      if (left <= std::chrono::steady_clock::duration::zero()) {
+        return false;
+      }
+      sharedWait(m_header->published, published,
+                 std::chrono::duration_cast<std::chrono::microseconds>(left) + std::chrono::microseconds(1));
+    }
+  }
+
+  void SharedMemoryPosix::interruptWait() {
+    m_interrupted.store(true);
+    // Waiters of other processes recheck their frame and go back to sleep
+    sharedWake(m_header->published);
+  }
+
+  std::shared_ptr<video::FrameData> SharedMemoryPosix::read() {
+    // Slot is leased only for the duration of the copy
+    std::shared_ptr<video::FrameData> view = readView();
+    if (!view) {
+      return nullptr;
+    }
+    size_t bytes = 0;
+    for (size_t i = 0; i < view->planes(); ++i) {
+      bytes += view->length(i);
+    }
+    // Planes are copied into one allocation
+    uint8_t* buffer = new uint8_t[bytes];
+    auto result = std::make_shared<video::FrameData>(
+      std::unique_ptr<uint8_t[]>(buffer), view->frameNumber());
+    uint8_t* target = buffer;
+    for (size_t i = 0; i < view->planes(); ++i) {
+      std::memcpy(target, view->data(i), view->length(i));
+      result->addPlane(target, view->length(i), view->width(i), view->height(i));
+      target += view->length(i);
+    }
+    return result;
+  }
+
+  const std::string& SharedMemoryPosix::memoryId() const {
+    return m_memoryId;
+  }
+
+  SharedMemory::Stats SharedMemoryPosix::stats() const {
+    Stats stats;
+    stats.frames = m_frames.load(std::memory_order_relaxed);
+    stats.torn = m_torn.load(std::memory_order_relaxed);
+    stats.skipped = m_skipped.load(std::memory_order_relaxed);
+    stats.blocked = m_blocked.load(std::memory_order_relaxed);
+    return stats;
+  }
+
+}
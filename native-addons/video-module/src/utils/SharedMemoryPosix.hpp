@@ -0,0 +1,134 @@
+#pragma once
+
+#include "SharedMemory.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <optional>
+
+namespace utils {
+
+  // Describes one plane of a frame stored in a slot
+  struct SharedPlane {
+    // Relative to the beginning of the slot data
+    uint32_t offset;
+    uint32_t length;
+    uint32_t width;
+    uint32_t height;
+  };
+
+  struct SharedSlot {
+    // Seqlock of the slot, odd while the writer copies a frame into it
+    std::atomic<uint32_t> sequence;
+    // Amount of readers using the frame, the writer skips leased slots
+    std::atomic<uint32_t> leases;
+    // Set by readers, tells the writer that the frame has been seen
+    std::atomic<uint32_t> read;
+    uint32_t frameNumber;
+    // Data region the frame was written to and its position there
+    uint32_t generation;
+    uint32_t planes;
+    uint64_t offset;
+    SharedPlane plane[video::FrameData::MaxPlanes];
+  };
+
+  // Region named by the memory id. Frame data lives in regions of its own.
+  struct SharedFrameHeader {
+    static constexpr uint32_t DefaultSlots = 4;
+    static constexpr uint32_t MaxSlots = 16;
+    static constexpr uint32_t NoSlot = UINT32_MAX;
+
+    uint32_t magic;
+    uint32_t slotCount;
+    // Index of the newest complete slot
+    std::atomic<uint32_t> latest;
+    // Bumped by the writer whenever a frame has been published, readers
+    // wait for it to change
+    std::atomic<uint32_t> published;
+    SharedSlot slot[MaxSlots];
+  };
+
+  // Blocks while word is value, at most timeout. Word is shared between
+  // processes. Wakeups may be spurious.
+  void sharedWait(std::atomic<uint32_t>& word, uint32_t value, std::chrono::microseconds timeout);
+  // Wakes everyone waiting for the word in any process
+  void sharedWake(std::atomic<uint32_t>& word);
+
+  /**
+   *  POSIX shared memory backend. Frames are kept in regions created with
+   *  shm_open and mapped by both processes.
+   *
+   *  The header region has a few frame slots. The writer always copies into
+   *  a slot that is neither the latest one nor leased by a reader, then
+   *  publishes it as the latest. It never waits for readers, if all the
+   *  slots are taken the frame is not shared.
+   *
+   *  Readers lease the latest slot for as long as they use its data, either
+   *  the duration of a copy (read) or the lifetime of the returned frame
+   *  (readView). Leasing and claiming a slot for writing are both a store
+   *  followed by a load of the other side's word, so at least one side sees
+   *  the other and backs off; the reader counts that as a torn read and
+   *  retries with the new latest slot. No locks are taken on either side.
+   *
+   *  Regions can't be resized everywhere (macOS sizes a region only once),
+   *  so when frames outgrow the slots the writer creates a data region of a
+   *  new generation. Readers map it when they first meet a slot written to
+   *  it, frames they hold keep the older mapping alive.
+   */
+  class SharedMemoryPosix : public SharedMemory {
+  public:
+    struct Mapping;
+
+    SharedMemoryPosix(size_t slots); // <- Ctor for writer
+    SharedMemoryPosix(const std::string& memoryId); // <- Ctor for reader
+    virtual ~SharedMemoryPosix() override;
+
+    virtual std::optional<std::string> write(std::shared_ptr<video::FrameData> data) override;
+    virtual std::shared_ptr<video::FrameData> read() override;
+    virtual std::shared_ptr<video::FrameData> readView() override;
+    virtual std::optional<unsigned> publishedFrame() override;
+    virtual bool waitForFrame(std::optional<unsigned> lastFrame, int timeoutMs) override;
+    virtual void interruptWait() override;
+
+    virtual const std::string& memoryId() const override;
+
+    virtual Stats stats() const override;
+
+  private:
+    std::string dataName(uint32_t generation) const;
+    std::optional<std::string> resizeSlots(size_t slotSize);
+    // Mapping of the data region of generation, maps it if needed
+    std::shared_ptr<Mapping> dataMapping(uint32_t generation);
+
+    // Marks the slot being written, returns NoSlot if all slots are in use
+    uint32_t claimSlot(uint32_t& sequence);
+
+    std::string m_memoryId;
+    int m_globalId;
+    // Leased frames keep their own reference to both mappings
+    std::shared_ptr<Mapping> m_headerMapping;
+    SharedFrameHeader* m_header;
+    bool m_writer;
+
+    // Data region the frames are written to (writer) or were last read
+    // from (reader)
+    std::shared_ptr<Mapping> m_data;
+    uint32_t m_generation;
+
+    // Writer only
+    uint32_t m_nextSlot;
+    size_t m_slotSize;
+    // Reader only
+    std::optional<uint32_t> m_lastFrameNumber;
+
+    std::atomic<uint64_t> m_frames;
+    std::atomic<uint64_t> m_torn;
+    std::atomic<uint64_t> m_skipped;
+    std::atomic<uint64_t> m_blocked;
+
+    // Set by interruptWait
+    std::atomic<bool> m_interrupted;
+  };
+
+}
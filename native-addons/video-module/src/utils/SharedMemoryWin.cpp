@@ -17,12 +17,27 @@ namespace utils {
   {
   }
 
-  std::optional<std::string> SharedMemoryWin::write(std::vector<std::shared_ptr<video::FrameData>> data) {
+  std::optional<std::string> SharedMemoryWin::write(std::shared_ptr<video::FrameData> data) {
     return std::make_optional(std::string("Not yet implemented for Windows"));
   }
 
-  std::vector<std::shared_ptr<video::FrameData>> SharedMemoryWin::read() {
-    return std::vector<std::shared_ptr<video::FrameData>>();
+  std::shared_ptr<video::FrameData> SharedMemoryWin::read() {
+    return nullptr;
+  }
+
+  bool SharedMemoryWin::waitForFrame(std::optional<unsigned>, int timeoutMs) {
+    std::unique_lock<std::mutex> lock(m_waitMutex);
+    m_waitChanged.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this] { return m_interrupted; });
+    m_interrupted = false;
+    return false;
+  }
+
+  void SharedMemoryWin::interruptWait() {
+    {
+      std::lock_guard<std::mutex> lock(m_waitMutex);
+      m_interrupted = true;
+    }
+    m_waitChanged.notify_all();
   }
 
   const std::string& SharedMemoryWin::memoryId() const {
@@ -2,6 +2,9 @@
 
 #include "SharedMemory.hpp"
 
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
 #include <optional>
 
 namespace utils {
@@ -12,14 +15,21 @@ namespace utils {
     SharedMemoryWin(const std::string& memoryId); // <- Ctor for reader
     virtual ~SharedMemoryWin() override;
 
-    virtual std::optional<std::string> write(std::vector<std::shared_ptr<video::FrameData>> data) override;
-    virtual std::vector<std::shared_ptr<video::FrameData>> read() override;
+    virtual std::optional<std::string> write(std::shared_ptr<video::FrameData> data) override;
+    virtual std::shared_ptr<video::FrameData> read() override;
+    virtual bool waitForFrame(std::optional<unsigned> lastFrame, int timeoutMs) override;
+    virtual void interruptWait() override;
 
     virtual const std::string& memoryId() const override;
 
   private:
     std::string m_memoryId;
     bool m_writer;
+
+    // Nothing is ever published, waits only end by timeout or interrupt
+    std::mutex m_waitMutex;
+    std::condition_variable m_waitChanged;
+    bool m_interrupted = false;
   };
 
 }
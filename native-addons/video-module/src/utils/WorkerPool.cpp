@@ -0,0 +1,71 @@
+#include "WorkerPool.hpp"
+
+namespace utils {
+
+  WorkerPool::WorkerPool(size_t threads)
+    : m_task(nullptr),
+      m_next(0),
+      m_count(0),
+      m_finished(0),
+      m_stopping(false)
+  {
+    for (size_t i = 0; i < threads; ++i) {
+      m_threads.emplace_back(&WorkerPool::workerLoop, this);
+    }
+  }
+
+  WorkerPool::~WorkerPool() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stopping = true;
+    }
+    m_wake.notify_all();
+    for (std::thread& thread : m_threads) {
+      thread.join();
+    }
+  }
+
+  void WorkerPool::run(size_t count, const std::function<void(size_t)>& task) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_task = &task;
+    m_next = 0;
+    m_count = count;
+    m_finished = 0;
+    m_wake.notify_all();
+    runParts(lock);
+    m_done.wait(lock, [this] { return m_finished == m_count; });
+    // Workers waking up late find nothing to do
+    m_task = nullptr;
+    m_next = 0;
+    m_count = 0;
+  }
+
+  size_t WorkerPool::threads() const {
+    return m_threads.size();
+  }
+
+  void WorkerPool::workerLoop() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+      m_wake.wait(lock, [this] { return m_stopping || m_next < m_count; });
+      if (m_stopping) {
+        return;
+      }
+      runParts(lock);
+    }
+  }
+
+  void WorkerPool::runParts(std::unique_lock<std::mutex>& lock) {
+    while (m_next < m_count) {
+      size_t part = m_next++;
+      const std::function<void(size_t)>& task = *m_task;
+      lock.unlock();
+      task(part);
+      lock.lock();
+      if (++m_finished == m_count) {
+        m_done.notify_all();
+      }
+    }
+  }
+
+} // namespace utils
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace utils {
+
+  /**
+   *  Fixed set of threads for splitting a single job into parts run in
+   *  parallel. Caller works on the parts too, so a pool of n threads runs up
+   *  to n + 1 parts at once. Jobs are run one at a time.
+   */
+  class WorkerPool {
+  public:
+    WorkerPool(size_t threads);
+    ~WorkerPool();
+
+    // Runs task(0) ... task(count - 1), returns once all of them are done
+    void run(size_t count, const std::function<void(size_t)>& task);
+
+    size_t threads() const;
+
+  private:
+    void workerLoop();
+    // Takes parts until none are left, lock is held between them
+    void runParts(std::unique_lock<std::mutex>& lock);
+
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    const std::function<void(size_t)>* m_task;
+    size_t m_next;
+    size_t m_count;
+    size_t m_finished;
+    bool m_stopping;
+  };
+
+} // namespace utils